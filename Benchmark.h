@@ -0,0 +1,191 @@
+#ifndef BENCHMARK
+#define BENCHMARK
+/*
+	Parameter sweeps.
+
+	A sweep is the grid of every combination of the values given for each swept
+	parameter ("render_distance=80,150,200" and "quad_density=2,4,8" make nine
+	points). The game rides each point headless and keeps the time of every
+	frame and the GL calls issued, and the whole sweep is written as CSV (one
+	row per point) or JSON (with the calls of every command).
+
+	Frame times are kept whole instead of in a frame_histogram_t: headless
+	frames are far shorter than its buckets.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+
+typedef struct {
+	std::string name;
+	std::vector<int> values;
+} sweep_parameter_t;
+
+typedef std::vector<sweep_parameter_t> sweep_t;
+
+typedef struct {
+	std::vector<int> values;                    // of each parameter of the sweep
+	std::vector<double> frame_ms;               // of every measured frame
+	int frames;                                 // ridden while counting calls
+	std::map<std::string, unsigned long> calls; // per command, whole ride
+	unsigned long vertices;                     // whole ride, see countedVertices()
+} sweep_result_t;
+
+bool parseSweepParameter(const char* spec, sweep_parameter_t* parameter);
+/* Parses "name=v1,v2,...". Returns false if it is malformed */
+
+int sweepPoints(const sweep_t* sweep);
+/* Number of points of the grid */
+
+std::vector<int> sweepPoint(const sweep_t* sweep, int index);
+/* Values of each parameter at the index-th point. The last parameter changes fastest */
+
+double samplePercentile(std::vector<double> samples, double p);
+/* p-th percentile (0 <= p <= 100) by nearest rank, 0 without samples */
+
+bool sweepResultDrewVertices(const sweep_result_t* result);
+/* False if the point issued draws but no vertex was counted, which means the
+   counting backend missed a way of drawing                                   */
+
+void writeSweepCSV(std::ostream& out, const sweep_t* sweep, const std::vector<sweep_result_t>& results);
+void writeSweepJSON(std::ostream& out, const sweep_t* sweep, const std::vector<sweep_result_t>& results);
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+// Commands that draw something
+static const char* SWEEP_DRAW_COMMANDS[] = {
+	"callList", "end", "drawTriangles", "drawVertexBuffer", "solidSphere", "solidCone", "texturedCylinder", "bitmapText", "blitFramebuffer"
+};
+
+bool parseSweepParameter(const char* spec, sweep_parameter_t* parameter)
+{
+	std::string text = spec;
+	size_t equals = text.find('=');
+	if (equals == std::string::npos || equals == 0) return false;
+
+	parameter->name = text.substr(0, equals);
+	parameter->values.clear();
+	const char* p = text.c_str() + equals + 1;
+	while (*p) {
+		char* end;
+		long value = strtol(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0')) return false;
+		parameter->values.push_back((int)value);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return !parameter->values.empty();
+}
+
+int sweepPoints(const sweep_t* sweep)
+{
+	int points = 1;
+	for (size_t i = 0; i < sweep->size(); i++) points *= (int)(*sweep)[i].values.size();
+	return points;
+}
+
+std::vector<int> sweepPoint(const sweep_t* sweep, int index)
+{
+	std::vector<int> values(sweep->size());
+	for (int i = (int)sweep->size() - 1; i >= 0; i--) {
+		int n = (int)(*sweep)[i].values.size();
+		values[i] = (*sweep)[i].values[index % n];
+		index /= n;
+	}
+	return values;
+}
+
+double samplePercentile(std::vector<double> samples, double p)
+{
+	if (samples.empty()) return 0;
+	size_t rank = (size_t)(p / 100 * samples.size() + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > samples.size()) rank = samples.size();
+	std::nth_element(samples.begin(), samples.begin() + rank - 1, samples.end());
+	return samples[rank - 1];
+}
+
+static double sweepMean(const std::vector<double>& samples)
+{
+	double total = 0;
+	for (size_t i = 0; i < samples.size(); i++) total += samples[i];
+	return samples.empty() ? 0 : total / samples.size();
+}
+
+// Calls per frame: every command, draws and vertices
+static void sweepCalls(const sweep_result_t* result, double* total, double* draws, double* vertices)
+{
+	*total = *draws = 0;
+	*vertices = result->vertices;
+	for (auto it = result->calls.begin(); it != result->calls.end(); ++it) {
+		*total += it->second;
+		for (size_t i = 0; i < sizeof(SWEEP_DRAW_COMMANDS) / sizeof(SWEEP_DRAW_COMMANDS[0]); i++)
+			if (it->first == SWEEP_DRAW_COMMANDS[i]) *draws += it->second;
+	}
+	int frames = result->frames > 0 ? result->frames : 1;
+	*total /= frames;
+	*draws /= frames;
+	*vertices /= frames;
+}
+
+bool sweepResultDrewVertices(const sweep_result_t* result)
+{
+	double total, draws, vertices;
+	sweepCalls(result, &total, &draws, &vertices);
+	return draws == 0 || vertices > 0;
+}
+
+void writeSweepCSV(std::ostream& out, const sweep_t* sweep, const std::vector<sweep_result_t>& results)
+{
+	for (size_t i = 0; i < sweep->size(); i++) out << (*sweep)[i].name << ",";
+	out << "frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,calls_per_frame,draws_per_frame,vertices_per_frame" << "\n";
+
+	for (size_t r = 0; r < results.size(); r++) {
+		const sweep_result_t* result = &results[r];
+		for (size_t i = 0; i < result->values.size(); i++) out << result->values[i] << ",";
+		double total, draws, vertices;
+		sweepCalls(result, &total, &draws, &vertices);
+		out << result->frame_ms.size() << ","
+			<< sweepMean(result->frame_ms) << ","
+			<< samplePercentile(result->frame_ms, 50) << ","
+			<< samplePercentile(result->frame_ms, 95) << ","
+			<< samplePercentile(result->frame_ms, 99) << ","
+			<< samplePercentile(result->frame_ms, 100) << ","
+			<< total << "," << draws << "," << vertices << "\n";
+	}
+}
+
+void writeSweepJSON(std::ostream& out, const sweep_t* sweep, const std::vector<sweep_result_t>& results)
+{
+	out << "{\n  \"points\": [";
+	for (size_t r = 0; r < results.size(); r++) {
+		const sweep_result_t* result = &results[r];
+		double total, draws, vertices;
+		sweepCalls(result, &total, &draws, &vertices);
+
+		out << (r ? "," : "") << "\n    {\n      \"parameters\": {";
+		for (size_t i = 0; i < result->values.size(); i++)
+			out << (i ? ", " : " ") << "\"" << (*sweep)[i].name << "\": " << result->values[i];
+		out << " },\n";
+		out << "      \"frames\": " << result->frame_ms.size() << ",\n";
+		out << "      \"frame_ms\": { \"mean\": " << sweepMean(result->frame_ms)
+			<< ", \"p50\": " << samplePercentile(result->frame_ms, 50)
+			<< ", \"p95\": " << samplePercentile(result->frame_ms, 95)
+			<< ", \"p99\": " << samplePercentile(result->frame_ms, 99)
+			<< ", \"max\": " << samplePercentile(result->frame_ms, 100) << " },\n";
+		out << "      \"calls_per_frame\": { \"total\": " << total
+			<< ", \"draws\": " << draws << ", \"vertices\": " << vertices << ", \"by_command\": {";
+		bool first = true;
+		for (auto it = result->calls.begin(); it != result->calls.end(); ++it) {
+			out << (first ? " " : ", ") << "\"" << it->first << "\": " << (double)it->second / (result->frames > 0 ? result->frames : 1);
+			first = false;
+		}
+		out << " } }\n    }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef CLUSTEREDLIGHTING
+#define CLUSTEREDLIGHTING
+/*
+	Clustered forward lighting for scenes with many local lights.
+
+	The view frustum is split into CLUSTER_X x CLUSTER_Y screen tiles and
+	CLUSTER_Z exponential depth slices. Every frame the lights are binned on the
+	CPU into the clusters their sphere of influence touches and the lists are
+	uploaded as integer textures, so each fragment only shades the lights of its
+	own cluster. Light 0 (directional) and light 1 (spot) of the fixed function
+	pipeline are still honoured, so moonlight and headlight need no changes.
+
+	Requires GLSL 1.30 (OpenGL 3.0), which Mesa llvmpipe provides.
+*/
+
+#include <cstring>
+#include "Utilidades.h"
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define NUM_CLUSTERS (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_CLUSTERED_LIGHTS 1024
+#define LIGHT_INDEX_TEXTURE_WIDTH 1024
+#define MAX_LIGHT_INDICES (256 * LIGHT_INDEX_TEXTURE_WIDTH)
+
+typedef struct {
+	GLfloat position[3];  // eye space
+	GLfloat range;        // distance at which the contribution reaches zero
+	GLfloat direction[3]; // eye space spot direction
+	GLfloat exponent;     // spot exponent, cutoff is always 90 degrees
+} cluster_light_t;
+
+typedef struct {
+	// Inputs
+	cluster_light_t lights[MAX_CLUSTERED_LIGHTS];
+	int num_lights;
+	GLfloat projection[16]; // column major, as returned by glGetFloatv
+	// Outputs: light list of cluster c is indices[offset_count[2c] .. +offset_count[2c+1]]
+	GLuint offset_count[2 * NUM_CLUSTERS];
+	GLuint indices[MAX_LIGHT_INDICES];
+	int num_indices;
+} cluster_grid_t;
+
+bool clusteredLightingInit();
+/* Compiles the shaders and creates the textures. Returns false when the context
+   lacks GLSL 1.30, in which case fixed function lighting must be kept       */
+
+bool clusteredLightingSupported();
+/* Whether clusteredLightingInit() succeeded */
+
+void clusteredLightingBeginFrame();
+/* Captures the current modelview (the camera) and projection and empties the light list */
+
+void clusteredLightingAdd(const GLfloat position[3], const GLfloat direction[3], GLfloat range, GLfloat exponent);
+/* Adds a light in world coordinates, transformed with the captured camera */
+
+void buildClusters(cluster_grid_t* grid);
+/* Bins the lights of grid into its clusters. CPU only, needs no GL context */
+
+void clusteredLightingUse(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4]);
+/* Builds and uploads the clusters and binds the program. The fixed function
+   lighting, texturing, fog and GL_LIGHT1 state is sampled at this point     */
+
+void clusteredLightingEnd();
+/* Returns to the fixed function pipeline */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+static const char* CLUSTERED_VERTEX_SHADER =
+	"#version 130\n"
+	"out vec3 v_eye_position;\n"
+	"out vec3 v_eye_normal;\n"
+	"out vec2 v_texcoord;\n"
+	"out vec4 v_color;\n"
+	"void main() {\n"
+	"    vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+	"    v_eye_position = eye.xyz;\n"
+	"    v_eye_normal = gl_NormalMatrix * gl_Normal;\n"
+	"    v_texcoord = (gl_TextureMatrix[0] * gl_MultiTexCoord0).xy;\n"
+	"    v_color = gl_Color;\n"
+	"    gl_Position = gl_ProjectionMatrix * eye;\n"
+	"}\n";
+
+static const char* CLUSTERED_FRAGMENT_SHADER =
+	"#version 130\n"
+	"uniform sampler2D u_texture;\n"
+	"uniform sampler2D u_lights;\n"         // row 0: position + range, row 1: direction + exponent
+	"uniform usampler2D u_clusters;\n"      // offset, count
+	"uniform usampler2D u_light_indices;\n"
+	"uniform bool u_lighting;\n"
+	"uniform bool u_texturing;\n"
+	"uniform bool u_fog;\n"
+	"uniform bool u_headlight;\n"
+	"uniform ivec3 u_grid;\n"
+	"uniform vec4 u_viewport;\n"
+	"uniform float u_near;\n"
+	"uniform float u_far;\n"
+	"uniform int u_index_width;\n"
+	"uniform vec4 u_lamp_ambient;\n"
+	"uniform vec4 u_lamp_diffuse;\n"
+	"uniform vec4 u_lamp_specular;\n"
+	"in vec3 v_eye_position;\n"
+	"in vec3 v_eye_normal;\n"
+	"in vec2 v_texcoord;\n"
+	"in vec4 v_color;\n"
+	"vec4 contribution(vec4 A, vec4 D, vec4 S, vec3 L, vec3 N, vec3 V) {\n"
+	"    float NdotL = max(dot(N, L), 0.0);\n"
+	"    vec4 c = A * gl_FrontMaterial.ambient + NdotL * D * gl_FrontMaterial.diffuse;\n"
+	"    if (NdotL > 0.0)\n"
+	"        c += pow(max(dot(N, normalize(L + V)), 0.0), gl_FrontMaterial.shininess) * S * gl_FrontMaterial.specular;\n"
+	"    return c;\n"
+	"}\n"
+	"vec4 fixedLight(int i, vec3 N, vec3 V) {\n"
+	"    vec4 p = gl_LightSource[i].position;\n"
+	"    vec3 L = normalize(p.w == 0.0 ? p.xyz : p.xyz - v_eye_position);\n"
+	"    float spot = 1.0;\n"
+	"    if (p.w != 0.0 && gl_LightSource[i].spotCutoff != 180.0) {\n"
+	"        float cosine = dot(-L, normalize(gl_LightSource[i].spotDirection));\n"
+	"        spot = cosine < gl_LightSource[i].spotCosCutoff ? 0.0 : pow(cosine, gl_LightSource[i].spotExponent);\n"
+	"    }\n"
+	"    return spot * contribution(gl_LightSource[i].ambient, gl_LightSource[i].diffuse, gl_LightSource[i].specular, L, N, V);\n"
+	"}\n"
+	"vec4 clusteredLights(vec3 N, vec3 V) {\n"
+	"    float depth = max(-v_eye_position.z, u_near);\n"
+	"    int slice = int(log(depth / u_near) / log(u_far / u_near) * float(u_grid.z));\n"
+	"    ivec2 tile = ivec2((gl_FragCoord.xy - u_viewport.xy) / u_viewport.zw * vec2(u_grid.xy));\n"
+	"    tile = clamp(tile, ivec2(0), u_grid.xy - 1);\n"
+	"    slice = clamp(slice, 0, u_grid.z - 1);\n"
+	"    uvec2 range = texelFetch(u_clusters, ivec2(tile.x + tile.y * u_grid.x, slice), 0).xy;\n"
+	"    vec4 c = vec4(0.0);\n"
+	"    for (uint i = 0u; i < range.y; i++) {\n"
+	"        int index = int(range.x + i);\n"
+	"        int light = int(texelFetch(u_light_indices, ivec2(index % u_index_width, index / u_index_width), 0).r);\n"
+	"        vec4 position_range = texelFetch(u_lights, ivec2(light, 0), 0);\n"
+	"        vec4 direction_exponent = texelFetch(u_lights, ivec2(light, 1), 0);\n"
+	"        vec3 to_light = position_range.xyz - v_eye_position;\n"
+	"        float distance = length(to_light);\n"
+	"        if (distance >= position_range.w) continue;\n"
+	"        vec3 L = to_light / distance;\n"
+	"        float cosine = dot(-L, direction_exponent.xyz);\n"
+	"        if (cosine <= 0.0) continue;\n"
+	"        float falloff = 1.0 - pow(distance / position_range.w, 4.0);\n"
+	"        float attenuation = falloff * falloff * pow(cosine, direction_exponent.w);\n"
+	"        c += attenuation * contribution(u_lamp_ambient, u_lamp_diffuse, u_lamp_specular, L, N, V);\n"
+	"    }\n"
+	"    return c;\n"
+	"}\n"
+	"void main() {\n"
+	"    vec4 color = v_color;\n"
+	"    if (u_lighting) {\n"
+	"        vec3 N = normalize(v_eye_normal);\n"
+	"        vec3 V = normalize(-v_eye_position);\n"
+	"        color = gl_FrontMaterial.emission + gl_LightModel.ambient * gl_FrontMaterial.ambient;\n"
+	"        color += fixedLight(0, N, V);\n"
+	"        if (u_headlight) color += fixedLight(1, N, V);\n"
+	"        color += clusteredLights(N, V);\n"
+	"        color = vec4(clamp(color.rgb, 0.0, 1.0), gl_FrontMaterial.diffuse.a);\n"
+	"    }\n"
+	"    if (u_texturing) color *= texture(u_texture, v_texcoord);\n"
+	"    if (u_fog) {\n"
+	"        float f = clamp(exp(-gl_Fog.density * length(v_eye_position)), 0.0, 1.0);\n"
+	"        color.rgb = mix(gl_Fog.color.rgb, color.rgb, f);\n"
+	"    }\n"
+	"    gl_FragColor = color;\n"
+	"}\n";
+
+static bool clustered_supported = false;
+static GLuint clustered_program;
+static GLuint tex_cluster_lights, tex_clusters, tex_light_indices;
+static GLfloat clustered_modelview[16];
+static cluster_grid_t clustered_grid;
+
+static GLuint compileClusteredShader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint ok;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		cerr << "Shader compilation failed: " << log << endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static GLuint createIntegerTexture(GLenum internal_format, GLenum format, GLenum type, int w, int h)
+{
+	GLuint id;
+	glGenTextures(1, &id);
+	glBindTexture(GL_TEXTURE_2D, id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, format, type, NULL);
+	return id;
+}
+
+bool clusteredLightingInit()
+{
+	const char* version = (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION);
+	if (version == NULL || atof(version) < 1.30) return false;
+
+	GLuint vs = compileClusteredShader(GL_VERTEX_SHADER, CLUSTERED_VERTEX_SHADER);
+	GLuint fs = compileClusteredShader(GL_FRAGMENT_SHADER, CLUSTERED_FRAGMENT_SHADER);
+	if (!vs || !fs) return false;
+
+	clustered_program = glCreateProgram();
+	glAttachShader(clustered_program, vs);
+	glAttachShader(clustered_program, fs);
+	glLinkProgram(clustered_program);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	GLint ok;
+	glGetProgramiv(clustered_program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetProgramInfoLog(clustered_program, sizeof(log), NULL, log);
+		cerr << "Program link failed: " << log << endl;
+		return false;
+	}
+
+	tex_cluster_lights = createIntegerTexture(GL_RGBA32F, GL_RGBA, GL_FLOAT, MAX_CLUSTERED_LIGHTS, 2);
+	tex_clusters = createIntegerTexture(GL_RG32UI, GL_RG_INTEGER, GL_UNSIGNED_INT, CLUSTER_X * CLUSTER_Y, CLUSTER_Z);
+	tex_light_indices = createIntegerTexture(GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
+	                                         LIGHT_INDEX_TEXTURE_WIDTH, MAX_LIGHT_INDICES / LIGHT_INDEX_TEXTURE_WIDTH);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glUseProgram(clustered_program);
+	glUniform1i(glGetUniformLocation(clustered_program, "u_texture"), 0);
+	glUniform1i(glGetUniformLocation(clustered_program, "u_lights"), 1);
+	glUniform1i(glGetUniformLocation(clustered_program, "u_clusters"), 2);
+	glUniform1i(glGetUniformLocation(clustered_program, "u_light_indices"), 3);
+	glUniform3i(glGetUniformLocation(clustered_program, "u_grid"), CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+	glUniform1i(glGetUniformLocation(clustered_program, "u_index_width"), LIGHT_INDEX_TEXTURE_WIDTH);
+	glUseProgram(0);
+
+	clustered_supported = true;
+	return true;
+}
+
+bool clusteredLightingSupported()
+{
+	return clustered_supported;
+}
+
+void clusteredLightingBeginFrame()
+{
+	glGetFloatv(GL_MODELVIEW_MATRIX, clustered_modelview);
+	glGetFloatv(GL_PROJECTION_MATRIX, clustered_grid.projection);
+	clustered_grid.num_lights = 0;
+}
+
+void clusteredLightingAdd(const GLfloat position[3], const GLfloat direction[3], GLfloat range, GLfloat exponent)
+{
+	if (clustered_grid.num_lights == MAX_CLUSTERED_LIGHTS) return;
+	const GLfloat* m = clustered_modelview;
+	cluster_light_t* l = &clustered_grid.lights[clustered_grid.num_lights++];
+	for (int k = 0; k < 3; k++) {
+		l->position[k] = m[k]*position[0] + m[4+k]*position[1] + m[8+k]*position[2] + m[12+k];
+		l->direction[k] = m[k]*direction[0] + m[4+k]*direction[1] + m[8+k]*direction[2];
+	}
+	float norma = sqrt(l->direction[0]*l->direction[0] + l->direction[1]*l->direction[1] + l->direction[2]*l->direction[2]);
+	for (int k = 0; k < 3; k++) l->direction[k] /= norma;
+	l->range = range;
+	l->exponent = exponent;
+}
+
+// Clusters touched by a light in a given slice. The sphere is projected at the
+// nearest depth it reaches inside the slice, which bounds every farther point.
+static bool clusterTileRange(const cluster_grid_t* grid, const cluster_light_t* l, float depth,
+                             int* x0, int* x1, int* y0, int* y1)
+{
+	const GLfloat* P = grid->projection;
+	float cx = l->position[0], cy = l->position[1], r = l->range;
+	float ndc[4] = { (cx - r) * P[0] / depth, (cx + r) * P[0] / depth,
+	                 (cy - r) * P[5] / depth, (cy + r) * P[5] / depth };
+	if (ndc[1] < -1 || ndc[0] > 1 || ndc[3] < -1 || ndc[2] > 1) return false;
+	*x0 = max(0, (int)floor((ndc[0] * 0.5f + 0.5f) * CLUSTER_X));
+	*x1 = min(CLUSTER_X - 1, (int)floor((ndc[1] * 0.5f + 0.5f) * CLUSTER_X));
+	*y0 = max(0, (int)floor((ndc[2] * 0.5f + 0.5f) * CLUSTER_Y));
+	*y1 = min(CLUSTER_Y - 1, (int)floor((ndc[3] * 0.5f + 0.5f) * CLUSTER_Y));
+	return true;
+}
+
+void buildClusters(cluster_grid_t* grid)
+{
+	const GLfloat* P = grid->projection;
+	float near_plane = P[14] / (P[10] - 1), far_plane = P[14] / (P[10] + 1);
+	float log_ratio = log(far_plane / near_plane);
+	static GLuint counts[NUM_CLUSTERS];
+	memset(counts, 0, sizeof(counts));
+
+	// Two passes: count the lights of every cluster, then scatter the indices
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < grid->num_lights; i++) {
+			const cluster_light_t* l = &grid->lights[i];
+			float depth = -l->position[2];
+			if (depth + l->range < near_plane || depth - l->range > far_plane) continue;
+
+			int z0 = (int)floor(log(max(depth - l->range, near_plane) / near_plane) / log_ratio * CLUSTER_Z);
+			int z1 = (int)floor(log(min(depth + l->range, far_plane) / near_plane) / log_ratio * CLUSTER_Z);
+			z0 = max(0, z0); z1 = min(CLUSTER_Z - 1, z1);
+			for (int z = z0; z <= z1; z++) {
+				float slice_near = near_plane * exp(log_ratio * z / CLUSTER_Z);
+				int x0, x1, y0, y1;
+				if (!clusterTileRange(grid, l, max(slice_near, depth - l->range), &x0, &x1, &y0, &y1)) continue;
+				for (int y = y0; y <= y1; y++)
+					for (int x = x0; x <= x1; x++) {
+						int c = x + y * CLUSTER_X + z * CLUSTER_X * CLUSTER_Y;
+						if (pass == 0) counts[c]++;
+						else if (grid->offset_count[2*c+1] < counts[c])
+							grid->indices[grid->offset_count[2*c] + grid->offset_count[2*c+1]++] = i;
+					}
+			}
+		}
+		if (pass == 0) {
+			// Prefix sum, lists that do not fit are truncated
+			GLuint offset = 0;
+			for (int c = 0; c < NUM_CLUSTERS; c++) {
+				if (offset + counts[c] > MAX_LIGHT_INDICES) counts[c] = MAX_LIGHT_INDICES - offset;
+				grid->offset_count[2*c] = offset;
+				grid->offset_count[2*c+1] = 0;
+				offset += counts[c];
+			}
+			grid->num_indices = offset;
+		}
+	}
+}
+
+void clusteredLightingUse(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4])
+{
+	cluster_grid_t* grid = &clustered_grid;
+	buildClusters(grid);
+
+	// Upload
+	static GLfloat light_texels[2][MAX_CLUSTERED_LIGHTS][4];
+	for (int i = 0; i < grid->num_lights; i++) {
+		memcpy(light_texels[0][i], grid->lights[i].position, 4 * sizeof(GLfloat));
+		memcpy(light_texels[1][i], grid->lights[i].direction, 4 * sizeof(GLfloat));
+	}
+	int rows = (grid->num_indices + LIGHT_INDEX_TEXTURE_WIDTH - 1) / LIGHT_INDEX_TEXTURE_WIDTH;
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, tex_cluster_lights);
+	if (grid->num_lights) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, grid->num_lights, 1, GL_RGBA, GL_FLOAT, light_texels[0]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 1, grid->num_lights, 1, GL_RGBA, GL_FLOAT, light_texels[1]);
+	}
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, tex_clusters);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_X * CLUSTER_Y, CLUSTER_Z, GL_RG_INTEGER, GL_UNSIGNED_INT, grid->offset_count);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, tex_light_indices);
+	if (rows)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_INDEX_TEXTURE_WIDTH, rows, GL_RED_INTEGER, GL_UNSIGNED_INT, grid->indices);
+	glActiveTexture(GL_TEXTURE0);
+
+	// Program and the fixed function state it replaces
+	const GLfloat* P = grid->projection;
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	glUseProgram(clustered_program);
+	glUniform1i(glGetUniformLocation(clustered_program, "u_lighting"), glIsEnabled(GL_LIGHTING));
+	glUniform1i(glGetUniformLocation(clustered_program, "u_texturing"), glIsEnabled(GL_TEXTURE_2D));
+	glUniform1i(glGetUniformLocation(clustered_program, "u_fog"), glIsEnabled(GL_FOG));
+	glUniform1i(glGetUniformLocation(clustered_program, "u_headlight"), glIsEnabled(GL_LIGHT1));
+	glUniform4f(glGetUniformLocation(clustered_program, "u_viewport"), viewport[0], viewport[1], viewport[2], viewport[3]);
+	glUniform1f(glGetUniformLocation(clustered_program, "u_near"), P[14] / (P[10] - 1));
+	glUniform1f(glGetUniformLocation(clustered_program, "u_far"), P[14] / (P[10] + 1));
+	glUniform4fv(glGetUniformLocation(clustered_program, "u_lamp_ambient"), 1, ambient);
+	glUniform4fv(glGetUniformLocation(clustered_program, "u_lamp_diffuse"), 1, diffuse);
+	glUniform4fv(glGetUniformLocation(clustered_program, "u_lamp_specular"), 1, specular);
+}
+
+void clusteredLightingEnd()
+{
+	glUseProgram(0);
+}
+#endif
@@ -0,0 +1,1380 @@
+#ifndef CORERENDERER
+#define CORERENDERER
+/*
+	OpenGL 3.3 core profile backend.
+
+	Reproduces the fixed function subset used by the game on top of shaders:
+	 - Matrix and attribute stacks are kept on the CPU.
+	 - Immediate mode primitives are transformed to eye space on the CPU and
+	   appended to per-state batches. Opaque, depth tested batches are drawn
+	   together when the frame ends (or the projection changes), one draw call
+	   per texture/material/state combination. Blended or non depth tested
+	   primitives are drawn in submission order.
+	 - Display lists and the GLUT/GLU solids are retained meshes (one VAO/VBO
+	   each) drawn with the current modelview.
+	 - Vertex buffers of the game (drawVertexBuffer) are drawn the same way,
+	   straight from the buffer, with the current color as a constant attribute.
+	 - Lights, fog and materials live in uniform buffers. Lighting follows the
+	   fixed function equations (per fragment) and fog is GL_EXP.
+	 - Text uses the bitmaps of the freeglut fonts uploaded to an atlas.
+*/
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+#define CORE_MATRIX_STACK_DEPTH 32
+#define CORE_ATTRIB_STACK_DEPTH 16
+#define CORE_MAX_LIGHTS 8
+#define CORE_MAX_MATERIALS 128
+
+#define CORE_FLAG_LIGHTING  1
+#define CORE_FLAG_TEXTURING 2
+#define CORE_FLAG_FOG       4
+#define CORE_FLAG_REPLACE   8
+#define CORE_FLAG_TEXT      16
+
+#define CORE_PI 3.14159265358979
+#define CORE_RAD(a) ((a) * CORE_PI / 180)
+
+typedef struct {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat texcoord[2];
+	GLubyte color[4];
+} core_vertex_t;
+
+typedef struct {
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+	GLfloat emission[4];
+	GLfloat shininess[4]; // only x is used, padded for std140
+} core_material_t;
+
+typedef struct {
+	GLfloat position[4];  // eye space
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+	GLfloat spot[4];      // eye space direction, w: cosine of the cutoff
+	GLfloat params[4];    // x: exponent, y: enabled, z: spot cutoff != 180
+} core_light_t;
+
+typedef struct {
+	core_light_t lights[CORE_MAX_LIGHTS];
+	GLfloat scene_ambient[4];
+	GLfloat fog_color[4];
+	GLfloat fog_params[4]; // x: density
+} core_lights_block_t;
+
+// Everything glPushAttrib can save
+typedef struct {
+	GLbitfield mask;
+	GLfloat color[4], normal[3], texcoord[2];
+	bool lighting, texture_2d, fog, blend, depth_test, cull_face, depth_mask;
+	bool lights_enabled[CORE_MAX_LIGHTS];
+	GLuint texture;
+	GLint env_mode;
+	core_material_t material;
+	core_lights_block_t lights;
+} core_attrib_t;
+
+typedef struct {
+	GLuint texture;
+	GLint material;
+	GLuint flags;
+	bool lines;
+	bool polygon_lines;
+} core_batch_key_t;
+
+typedef struct {
+	core_batch_key_t key;
+	std::vector<core_vertex_t> vertices;
+} core_batch_t;
+
+typedef struct {
+	GLuint vao, vbo;
+	GLsizei triangles, lines; // vertex counts, triangles first
+} core_list_t;
+
+typedef struct {
+	int type; // 0 sphere, 1 cone, 2 cylinder
+	GLdouble params[3];
+	GLint slices, stacks;
+	GLuint list;
+} core_mesh_t;
+
+typedef struct {
+	void* font;
+	GLuint texture;
+	int cell_width, height;
+} core_font_t;
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+// Glyph tables of freeglut. glutBitmapCharacter() draws them with glBitmap,
+// which core contexts lack, so the atlas is built from the same data.
+typedef struct {
+	char* name;
+	int quantity;
+	int height;
+	const GLubyte** characters;
+	float xorig, yorig;
+} freeglut_font_t;
+
+extern "C" freeglut_font_t fgFontFixed8x13, fgFontFixed9x15, fgFontHelvetica10, fgFontHelvetica12,
+                           fgFontHelvetica18, fgFontTimesRoman10, fgFontTimesRoman24;
+
+static const char* CORE_VERTEX_SHADER =
+	"#version 330 core\n"
+	"layout(location = 0) in vec3 a_position;\n"
+	"layout(location = 1) in vec3 a_normal;\n"
+	"layout(location = 2) in vec2 a_texcoord;\n"
+	"layout(location = 3) in vec4 a_color;\n"
+	"uniform mat4 u_modelview;\n"
+	"uniform mat3 u_normal_matrix;\n"
+	"uniform mat4 u_projection;\n"
+	"out vec3 v_eye_position;\n"
+	"out vec3 v_eye_normal;\n"
+	"out vec2 v_texcoord;\n"
+	"out vec4 v_color;\n"
+	"void main() {\n"
+	"    vec4 eye = u_modelview * vec4(a_position, 1.0);\n"
+	"    v_eye_position = eye.xyz;\n"
+	"    v_eye_normal = u_normal_matrix * a_normal;\n"
+	"    v_texcoord = a_texcoord;\n"
+	"    v_color = a_color;\n"
+	"    gl_Position = u_projection * eye;\n"
+	"}\n";
+
+static const char* CORE_FRAGMENT_SHADER =
+	"#version 330 core\n"
+	"struct Light { vec4 position; vec4 ambient; vec4 diffuse; vec4 specular; vec4 spot; vec4 params; };\n"
+	"struct Material { vec4 ambient; vec4 diffuse; vec4 specular; vec4 emission; vec4 shininess; };\n"
+	"layout(std140) uniform Lights {\n"
+	"    Light u_lights[8];\n"
+	"    vec4 u_scene_ambient;\n"
+	"    vec4 u_fog_color;\n"
+	"    vec4 u_fog_params;\n"
+	"};\n"
+	"layout(std140) uniform Materials {\n"
+	"    Material u_materials[128];\n"
+	"};\n"
+	"uniform int u_material;\n"
+	"uniform int u_flags;\n"
+	"uniform sampler2D u_texture;\n"
+	"in vec3 v_eye_position;\n"
+	"in vec3 v_eye_normal;\n"
+	"in vec2 v_texcoord;\n"
+	"in vec4 v_color;\n"
+	"out vec4 frag_color;\n"
+	"vec4 shade(Material m, vec3 N, vec3 V) {\n"
+	"    vec4 color = m.emission + u_scene_ambient * m.ambient;\n"
+	"    for (int i = 0; i < 8; i++) {\n"
+	"        Light l = u_lights[i];\n"
+	"        if (l.params.y == 0.0) continue;\n"
+	"        vec3 L = normalize(l.position.w == 0.0 ? l.position.xyz : l.position.xyz - v_eye_position);\n"
+	"        float spot = 1.0;\n"
+	"        if (l.position.w != 0.0 && l.params.z != 0.0) {\n"
+	"            float cosine = dot(-L, normalize(l.spot.xyz));\n"
+	"            spot = cosine < l.spot.w ? 0.0 : pow(cosine, l.params.x);\n"
+	"        }\n"
+	"        float NdotL = max(dot(N, L), 0.0);\n"
+	"        vec4 c = l.ambient * m.ambient + NdotL * l.diffuse * m.diffuse;\n"
+	"        if (NdotL > 0.0) {\n"
+	"            float NdotH = max(dot(N, normalize(L + V)), 0.0);\n"
+	"            c += (m.shininess.x > 0.0 ? pow(NdotH, m.shininess.x) : 1.0) * l.specular * m.specular;\n"
+	"        }\n"
+	"        color += spot * c;\n"
+	"    }\n"
+	"    return vec4(clamp(color.rgb, 0.0, 1.0), m.diffuse.a);\n"
+	"}\n"
+	"void main() {\n"
+	"    vec4 color = v_color;\n"
+	"    if ((u_flags & 16) != 0) {\n"
+	"        if (texture(u_texture, v_texcoord).r < 0.5) discard;\n"
+	"        frag_color = color;\n"
+	"        return;\n"
+	"    }\n"
+	"    if ((u_flags & 1) != 0)\n"
+	"        color = shade(u_materials[u_material], normalize(v_eye_normal), normalize(-v_eye_position));\n"
+	"    if ((u_flags & 2) != 0) {\n"
+	"        vec4 texel = texture(u_texture, v_texcoord);\n"
+	"        color = (u_flags & 8) != 0 ? texel : color * texel;\n"
+	"    }\n"
+	"    if ((u_flags & 4) != 0) {\n"
+	"        float f = clamp(exp(-u_fog_params.x * length(v_eye_position)), 0.0, 1.0);\n"
+	"        color.rgb = mix(u_fog_color.rgb, color.rgb, f);\n"
+	"    }\n"
+	"    frag_color = color;\n"
+	"}\n";
+
+static struct {
+	GLuint program;
+	GLint u_modelview, u_normal_matrix, u_projection, u_material, u_flags;
+	GLuint lights_ubo, materials_ubo;
+	GLuint stream_vao, stream_vbo;
+	GLuint buffer_vao;          // for drawVertexBuffer
+
+	// Matrices
+	GLenum matrix_mode;
+	GLfloat modelview[CORE_MATRIX_STACK_DEPTH][16];
+	GLfloat projection[CORE_MATRIX_STACK_DEPTH][16];
+	int modelview_depth, projection_depth;
+	GLfloat normal_matrix[9];
+	bool normal_matrix_dirty;
+
+	// Current vertex attributes and primitive under construction
+	GLfloat color[4], normal[3], texcoord[2];
+	GLenum primitive;
+	std::vector<core_vertex_t> primitive_vertices;
+
+	// Fixed function state
+	bool lighting, texture_2d, fog, blend, depth_test, cull_face, depth_mask;
+	GLenum polygon_mode;
+	GLuint texture;
+	GLint env_mode;
+	GLint viewport[4];
+	core_material_t material;
+	GLint material_index; // -1 when the material changed since it was registered
+	core_lights_block_t lights;
+	bool lights_dirty;
+	core_attrib_t attrib_stack[CORE_ATTRIB_STACK_DEPTH];
+	int attrib_depth;
+
+	// Uniform buffer contents
+	core_material_t materials[CORE_MAX_MATERIALS];
+	int num_materials;
+	bool materials_dirty;
+
+	// Batches waiting for the end of the frame
+	std::vector<core_batch_t> batches;
+
+	// Retained geometry
+	std::vector<core_list_t> lists; // index = list id - 1
+	GLuint compiling;               // list being compiled, 0 if none
+	GLfloat compile_saved_modelview[16];
+	std::vector<core_vertex_t> compile_triangles, compile_lines;
+	std::vector<core_mesh_t> meshes;
+	std::vector<core_font_t> fonts;
+} core;
+
+/*** Matrices ***/
+
+static void coreMultiply(GLfloat out[16], const GLfloat a[16], const GLfloat b[16])
+{
+	GLfloat r[16];
+	for (int c = 0; c < 4; c++)
+		for (int l = 0; l < 4; l++)
+			r[c*4+l] = a[l]*b[c*4] + a[4+l]*b[c*4+1] + a[8+l]*b[c*4+2] + a[12+l]*b[c*4+3];
+	memcpy(out, r, sizeof(r));
+}
+
+static void coreIdentity(GLfloat m[16])
+{
+	memset(m, 0, 16 * sizeof(GLfloat));
+	m[0] = m[5] = m[10] = m[15] = 1;
+}
+
+static GLfloat* coreCurrentMatrix()
+{
+	return core.matrix_mode == GL_PROJECTION ? core.projection[core.projection_depth]
+	                                         : core.modelview[core.modelview_depth];
+}
+
+static void coreFlushBatches();
+
+// Any change to the projection ends the batches recorded with the previous one
+static void coreMatrixChanging()
+{
+	if (core.matrix_mode == GL_PROJECTION) coreFlushBatches();
+	else core.normal_matrix_dirty = true;
+}
+
+static void coreMultMatrix(const GLfloat m[16])
+{
+	coreMatrixChanging();
+	coreMultiply(coreCurrentMatrix(), coreCurrentMatrix(), m);
+}
+
+static void coreMatrixMode(GLenum mode) { core.matrix_mode = mode; }
+
+static void coreLoadIdentity()
+{
+	coreMatrixChanging();
+	coreIdentity(coreCurrentMatrix());
+}
+
+static void corePushMatrix()
+{
+	if (core.matrix_mode == GL_PROJECTION) {
+		if (core.projection_depth + 1 == CORE_MATRIX_STACK_DEPTH) return;
+		memcpy(core.projection[core.projection_depth + 1], core.projection[core.projection_depth], 16 * sizeof(GLfloat));
+		core.projection_depth++;
+	}
+	else {
+		if (core.modelview_depth + 1 == CORE_MATRIX_STACK_DEPTH) return;
+		memcpy(core.modelview[core.modelview_depth + 1], core.modelview[core.modelview_depth], 16 * sizeof(GLfloat));
+		core.modelview_depth++;
+	}
+}
+
+static void corePopMatrix()
+{
+	coreMatrixChanging();
+	if (core.matrix_mode == GL_PROJECTION) { if (core.projection_depth > 0) core.projection_depth--; }
+	else if (core.modelview_depth > 0) core.modelview_depth--;
+}
+
+static void coreTranslatef(GLfloat x, GLfloat y, GLfloat z)
+{
+	GLfloat m[16];
+	coreIdentity(m);
+	m[12] = x; m[13] = y; m[14] = z;
+	coreMultMatrix(m);
+}
+
+static void coreRotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
+{
+	GLfloat norma = sqrt(x*x + y*y + z*z);
+	if (norma == 0) return;
+	x /= norma; y /= norma; z /= norma;
+	GLfloat c = cos(CORE_RAD(angle)), s = sin(CORE_RAD(angle)), t = 1 - c;
+	GLfloat m[16] = { x*x*t + c,   y*x*t + z*s, x*z*t - y*s, 0,
+	                  x*y*t - z*s, y*y*t + c,   y*z*t + x*s, 0,
+	                  x*z*t + y*s, y*z*t - x*s, z*z*t + c,   0,
+	                  0,           0,           0,           1 };
+	coreMultMatrix(m);
+}
+
+static void coreScalef(GLfloat x, GLfloat y, GLfloat z)
+{
+	GLfloat m[16];
+	coreIdentity(m);
+	m[0] = x; m[5] = y; m[10] = z;
+	coreMultMatrix(m);
+}
+
+static void coreOrtho(GLdouble l, GLdouble r, GLdouble b, GLdouble t, GLdouble n, GLdouble f)
+{
+	GLfloat m[16];
+	coreIdentity(m);
+	m[0] = 2 / (r - l);
+	m[5] = 2 / (t - b);
+	m[10] = -2 / (f - n);
+	m[12] = -(r + l) / (r - l);
+	m[13] = -(t + b) / (t - b);
+	m[14] = -(f + n) / (f - n);
+	coreMultMatrix(m);
+}
+
+static void corePerspective(GLdouble fovy, GLdouble aspect, GLdouble n, GLdouble f)
+{
+	GLfloat m[16] = { 0 };
+	GLdouble cotangent = 1 / tan(CORE_RAD(fovy) / 2);
+	m[0] = cotangent / aspect;
+	m[5] = cotangent;
+	m[10] = (f + n) / (n - f);
+	m[11] = -1;
+	m[14] = 2 * f * n / (n - f);
+	coreMultMatrix(m);
+}
+
+static void coreLookAt(GLdouble ex, GLdouble ey, GLdouble ez, GLdouble cx, GLdouble cy, GLdouble cz, GLdouble ux, GLdouble uy, GLdouble uz)
+{
+	GLdouble f[3] = { cx - ex, cy - ey, cz - ez };
+	GLdouble nf = sqrt(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+	for (int k = 0; k < 3; k++) f[k] /= nf;
+	GLdouble s[3] = { f[1]*uz - f[2]*uy, f[2]*ux - f[0]*uz, f[0]*uy - f[1]*ux };
+	GLdouble ns = sqrt(s[0]*s[0] + s[1]*s[1] + s[2]*s[2]);
+	for (int k = 0; k < 3; k++) s[k] /= ns;
+	GLdouble u[3] = { s[1]*f[2] - s[2]*f[1], s[2]*f[0] - s[0]*f[2], s[0]*f[1] - s[1]*f[0] };
+	GLfloat m[16] = { (GLfloat)s[0], (GLfloat)u[0], (GLfloat)-f[0], 0,
+	                  (GLfloat)s[1], (GLfloat)u[1], (GLfloat)-f[1], 0,
+	                  (GLfloat)s[2], (GLfloat)u[2], (GLfloat)-f[2], 0,
+	                  0,             0,             0,              1 };
+	coreMultMatrix(m);
+	coreTranslatef(-ex, -ey, -ez);
+}
+
+// Inverse transpose of the upper 3x3 of the modelview
+static const GLfloat* coreNormalMatrix()
+{
+	if (core.normal_matrix_dirty) {
+		const GLfloat* m = core.modelview[core.modelview_depth];
+		GLfloat a = m[0], b = m[4], c = m[8], d = m[1], e = m[5], f = m[9], g = m[2], h = m[6], i = m[10];
+		GLfloat cof[9] = { e*i - f*h, -(d*i - f*g), d*h - e*g,
+		                   -(b*i - c*h), a*i - c*g, -(a*h - b*g),
+		                   b*f - c*e, -(a*f - c*d), a*e - b*d };
+		GLfloat det = a*cof[0] + b*cof[1] + c*cof[2];
+		if (det == 0) det = 1;
+		// cofactor matrix / det, stored column major
+		for (int col = 0; col < 3; col++)
+			for (int row = 0; row < 3; row++)
+				core.normal_matrix[col*3 + row] = cof[row*3 + col] / det;
+		core.normal_matrix_dirty = false;
+	}
+	return core.normal_matrix;
+}
+
+static void coreGetFloatv(GLenum pname, GLfloat* params)
+{
+	if (pname == GL_MODELVIEW_MATRIX) memcpy(params, core.modelview[core.modelview_depth], 16 * sizeof(GLfloat));
+	else if (pname == GL_PROJECTION_MATRIX) memcpy(params, core.projection[core.projection_depth], 16 * sizeof(GLfloat));
+}
+
+/*** State ***/
+
+static bool* coreFlag(GLenum cap)
+{
+	switch (cap) {
+		case GL_LIGHTING:   return &core.lighting;
+		case GL_TEXTURE_2D: return &core.texture_2d;
+		case GL_FOG:        return &core.fog;
+		case GL_BLEND:      return &core.blend;
+		case GL_DEPTH_TEST: return &core.depth_test;
+		case GL_CULL_FACE:  return &core.cull_face;
+	}
+	return NULL;
+}
+
+static void coreSetEnabled(GLenum cap, bool value)
+{
+	if (cap >= GL_LIGHT0 && cap < GL_LIGHT0 + CORE_MAX_LIGHTS) {
+		core.lights.lights[cap - GL_LIGHT0].params[1] = value;
+		core.lights_dirty = true;
+		return;
+	}
+	bool* flag = coreFlag(cap);
+	if (flag) *flag = value; // GL_NORMALIZE is implicit, the shader always normalizes
+}
+
+static void coreEnable(GLenum cap) { coreSetEnabled(cap, true); }
+static void coreDisable(GLenum cap) { coreSetEnabled(cap, false); }
+
+static GLboolean coreIsEnabled(GLenum cap)
+{
+	if (cap >= GL_LIGHT0 && cap < GL_LIGHT0 + CORE_MAX_LIGHTS)
+		return core.lights.lights[cap - GL_LIGHT0].params[1] != 0;
+	bool* flag = coreFlag(cap);
+	return flag ? *flag : GL_TRUE;
+}
+
+static void coreDepthMask(GLboolean flag) { core.depth_mask = flag; }
+static void corePolygonMode(GLenum, GLenum mode) { core.polygon_mode = mode; }
+static void coreBindTexture(GLenum target, GLuint texture) { core.texture = texture; glBindTexture(target, texture); }
+static void coreTexEnvi(GLenum, GLenum pname, GLint param) { if (pname == GL_TEXTURE_ENV_MODE) core.env_mode = param; }
+static void coreGetIntegerv(GLenum pname, GLint* params) { if (pname == GL_VIEWPORT) memcpy(params, core.viewport, sizeof(core.viewport)); }
+
+static void coreViewport(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+	coreFlushBatches();
+	core.viewport[0] = x; core.viewport[1] = y; core.viewport[2] = w; core.viewport[3] = h;
+	glViewport(x, y, w, h);
+}
+
+static void coreBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	coreFlushBatches();
+	glBindFramebuffer(target, framebuffer);
+}
+
+static void coreBlitFramebuffer(GLint sx0, GLint sy0, GLint sx1, GLint sy1, GLint dx0, GLint dy0, GLint dx1, GLint dy1, GLbitfield mask, GLenum filter)
+{
+	coreFlushBatches();
+	glBlitFramebuffer(sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1, mask, filter);
+}
+
+static void coreReadPixelsToBuffer(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, GLuint buffer, GLintptr offset)
+{
+	coreFlushBatches();
+	legacyReadPixelsToBuffer(x, y, w, h, format, type, buffer, offset);
+}
+
+// Batched draws would land after the timestamp
+static void coreQueryTimestamp(GLuint query)
+{
+	coreFlushBatches();
+	legacyQueryTimestamp(query);
+}
+
+static void coreClear(GLbitfield mask)
+{
+	coreFlushBatches();
+	glDepthMask(GL_TRUE);
+	glClear(mask);
+}
+
+static void coreClearRect(GLint x, GLint y, GLsizei width, GLsizei height, GLbitfield mask)
+{
+	coreFlushBatches();
+	glDepthMask(GL_TRUE);
+	legacyClearRect(x, y, width, height, mask);
+}
+
+// Scalar parameters go through the *f entry points, the vector ones are RGBA
+static void coreMaterialf(GLenum, GLenum pname, GLfloat param)
+{
+	if (pname != GL_SHININESS) return;
+	core.material.shininess[0] = param;
+	core.material_index = -1;
+}
+
+static void coreMaterialfv(GLenum face, GLenum pname, const GLfloat* params)
+{
+	if (pname == GL_SHININESS) {
+		coreMaterialf(face, pname, params[0]);
+		return;
+	}
+	core_material_t* m = &core.material;
+	switch (pname) {
+		case GL_AMBIENT:  memcpy(m->ambient, params, 4 * sizeof(GLfloat)); break;
+		case GL_DIFFUSE:  memcpy(m->diffuse, params, 4 * sizeof(GLfloat)); break;
+		case GL_SPECULAR: memcpy(m->specular, params, 4 * sizeof(GLfloat)); break;
+		case GL_EMISSION: memcpy(m->emission, params, 4 * sizeof(GLfloat)); break;
+		case GL_AMBIENT_AND_DIFFUSE:
+			memcpy(m->ambient, params, 4 * sizeof(GLfloat));
+			memcpy(m->diffuse, params, 4 * sizeof(GLfloat));
+			break;
+	}
+	core.material_index = -1;
+}
+
+static void coreLightf(GLenum light, GLenum pname, GLfloat param)
+{
+	if (light < GL_LIGHT0 || light >= GL_LIGHT0 + CORE_MAX_LIGHTS) return;
+	core_light_t* l = &core.lights.lights[light - GL_LIGHT0];
+	switch (pname) {
+		case GL_SPOT_CUTOFF:
+			l->spot[3] = cos(CORE_RAD(param));
+			l->params[2] = param != 180;
+			break;
+		case GL_SPOT_EXPONENT: l->params[0] = param; break;
+		default: return;
+	}
+	core.lights_dirty = true;
+}
+
+static void coreLightfv(GLenum light, GLenum pname, const GLfloat* params)
+{
+	if (pname == GL_SPOT_CUTOFF || pname == GL_SPOT_EXPONENT) {
+		coreLightf(light, pname, params[0]);
+		return;
+	}
+	if (light < GL_LIGHT0 || light >= GL_LIGHT0 + CORE_MAX_LIGHTS) return;
+	core_light_t* l = &core.lights.lights[light - GL_LIGHT0];
+	const GLfloat* m = core.modelview[core.modelview_depth];
+	switch (pname) {
+		case GL_AMBIENT:  memcpy(l->ambient, params, 4 * sizeof(GLfloat)); break;
+		case GL_DIFFUSE:  memcpy(l->diffuse, params, 4 * sizeof(GLfloat)); break;
+		case GL_SPECULAR: memcpy(l->specular, params, 4 * sizeof(GLfloat)); break;
+		case GL_POSITION:
+			for (int k = 0; k < 4; k++)
+				l->position[k] = m[k]*params[0] + m[4+k]*params[1] + m[8+k]*params[2] + m[12+k]*params[3];
+			break;
+		case GL_SPOT_DIRECTION:
+			for (int k = 0; k < 3; k++)
+				l->spot[k] = m[k]*params[0] + m[4+k]*params[1] + m[8+k]*params[2];
+			break;
+	}
+	core.lights_dirty = true;
+}
+
+static void coreFogf(GLenum pname, GLfloat param)
+{
+	if (pname != GL_FOG_DENSITY) return;
+	core.lights.fog_params[0] = param;
+	core.lights_dirty = true;
+}
+
+static void coreFogfv(GLenum pname, const GLfloat* params)
+{
+	if (pname == GL_FOG_DENSITY) {
+		coreFogf(pname, params[0]);
+		return;
+	}
+	if (pname != GL_FOG_COLOR) return;
+	memcpy(core.lights.fog_color, params, 4 * sizeof(GLfloat));
+	core.lights_dirty = true;
+}
+
+static void corePushAttrib(GLbitfield mask)
+{
+	if (core.attrib_depth == CORE_ATTRIB_STACK_DEPTH) return;
+	core_attrib_t* a = &core.attrib_stack[core.attrib_depth++];
+	a->mask = mask;
+	memcpy(a->color, core.color, sizeof(a->color));
+	memcpy(a->normal, core.normal, sizeof(a->normal));
+	memcpy(a->texcoord, core.texcoord, sizeof(a->texcoord));
+	a->lighting = core.lighting; a->texture_2d = core.texture_2d; a->fog = core.fog;
+	a->blend = core.blend; a->depth_test = core.depth_test; a->cull_face = core.cull_face;
+	a->depth_mask = core.depth_mask;
+	for (int i = 0; i < CORE_MAX_LIGHTS; i++) a->lights_enabled[i] = core.lights.lights[i].params[1] != 0;
+	a->texture = core.texture;
+	a->env_mode = core.env_mode;
+	a->material = core.material;
+	a->lights = core.lights;
+}
+
+static void corePopAttrib()
+{
+	if (core.attrib_depth == 0) return;
+	core_attrib_t* a = &core.attrib_stack[--core.attrib_depth];
+	if (a->mask & GL_CURRENT_BIT) {
+		memcpy(core.color, a->color, sizeof(a->color));
+		memcpy(core.normal, a->normal, sizeof(a->normal));
+		memcpy(core.texcoord, a->texcoord, sizeof(a->texcoord));
+	}
+	if (a->mask & GL_LIGHTING_BIT) {
+		core.lights = a->lights;
+		core.material = a->material;
+		core.material_index = -1;
+		core.lighting = a->lighting;
+		core.lights_dirty = true;
+	}
+	if (a->mask & GL_ENABLE_BIT) {
+		core.lighting = a->lighting; core.texture_2d = a->texture_2d; core.fog = a->fog;
+		core.blend = a->blend; core.depth_test = a->depth_test; core.cull_face = a->cull_face;
+		for (int i = 0; i < CORE_MAX_LIGHTS; i++) core.lights.lights[i].params[1] = a->lights_enabled[i];
+		core.lights_dirty = true;
+	}
+	if (a->mask & GL_DEPTH_BUFFER_BIT) {
+		core.depth_test = a->depth_test;
+		core.depth_mask = a->depth_mask;
+	}
+	if (a->mask & GL_TEXTURE_BIT) {
+		coreBindTexture(GL_TEXTURE_2D, a->texture);
+		core.env_mode = a->env_mode;
+	}
+	if (a->mask & GL_FOG_BIT) core.fog = a->fog;
+}
+
+/*** Drawing ***/
+
+static GLint coreMaterialIndex()
+{
+	if (core.material_index >= 0) return core.material_index;
+	for (int i = 0; i < core.num_materials; i++) {
+		if (memcmp(&core.materials[i], &core.material, sizeof(core_material_t)) == 0)
+			return core.material_index = i;
+	}
+	if (core.num_materials == CORE_MAX_MATERIALS) {
+		// Table full: draw what uses it and start over
+		coreFlushBatches();
+		core.num_materials = 0;
+	}
+	core.materials[core.num_materials] = core.material;
+	core.materials_dirty = true;
+	return core.material_index = core.num_materials++;
+}
+
+static core_batch_key_t coreBatchKey(bool lines)
+{
+	core_batch_key_t key;
+	key.flags = 0;
+	if (core.lighting) key.flags |= CORE_FLAG_LIGHTING;
+	if (core.texture_2d && core.texture) key.flags |= CORE_FLAG_TEXTURING;
+	if (core.fog) key.flags |= CORE_FLAG_FOG;
+	if (core.env_mode == GL_REPLACE) key.flags |= CORE_FLAG_REPLACE;
+	key.texture = (key.flags & CORE_FLAG_TEXTURING) ? core.texture : 0;
+	key.material = core.lighting ? coreMaterialIndex() : 0;
+	key.lines = lines;
+	key.polygon_lines = core.polygon_mode == GL_LINE;
+	return key;
+}
+
+// Primitives that can be drawn in any order relative to each other
+static bool coreReorderable()
+{
+	return core.depth_test && core.depth_mask && !core.blend;
+}
+
+static void coreUploadUniformBuffers()
+{
+	if (core.lights_dirty) {
+		glBindBuffer(GL_UNIFORM_BUFFER, core.lights_ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(core_lights_block_t), &core.lights);
+		core.lights_dirty = false;
+	}
+	if (core.materials_dirty) {
+		glBindBuffer(GL_UNIFORM_BUFFER, core.materials_ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, core.num_materials * sizeof(core_material_t), core.materials);
+		core.materials_dirty = false;
+	}
+}
+
+// Applies a batch key and the given matrices, then the pipeline is ready to draw
+static void coreApplyState(const core_batch_key_t* key, bool ordered, const GLfloat* modelview, const GLfloat* normal_matrix, const GLfloat* projection)
+{
+	coreUploadUniformBuffers();
+	glUseProgram(core.program);
+	glUniformMatrix4fv(core.u_modelview, 1, GL_FALSE, modelview);
+	glUniformMatrix3fv(core.u_normal_matrix, 1, GL_FALSE, normal_matrix);
+	glUniformMatrix4fv(core.u_projection, 1, GL_FALSE, projection);
+	glUniform1i(core.u_material, key->material);
+	glUniform1i(core.u_flags, key->flags);
+	glBindTexture(GL_TEXTURE_2D, key->texture);
+	glPolygonMode(GL_FRONT_AND_BACK, key->polygon_lines ? GL_LINE : GL_FILL);
+
+	bool depth_test = ordered ? core.depth_test : true;
+	bool depth_mask = ordered ? core.depth_mask : true;
+	bool blend = ordered ? core.blend : false;
+	if (depth_test) glEnable(GL_DEPTH_TEST); else glDisable(GL_DEPTH_TEST);
+	glDepthMask(depth_mask);
+	if (blend) glEnable(GL_BLEND); else glDisable(GL_BLEND);
+	if (core.cull_face && ordered) glEnable(GL_CULL_FACE); else glDisable(GL_CULL_FACE);
+}
+
+static void coreStreamAndDraw(const core_vertex_t* vertices, GLsizei count, GLenum mode)
+{
+	glBindVertexArray(core.stream_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, core.stream_vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(core_vertex_t), NULL, GL_STREAM_DRAW); // orphan
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(core_vertex_t), vertices);
+	glDrawArrays(mode, 0, count);
+}
+
+static void coreFlushBatches()
+{
+	if (core.batches.empty()) return;
+
+	static GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+	static GLfloat identity3[9] = { 1,0,0, 0,1,0, 0,0,1 };
+
+	// All batches share one upload, then one draw call each
+	size_t total = 0;
+	for (size_t i = 0; i < core.batches.size(); i++) total += core.batches[i].vertices.size();
+	glBindVertexArray(core.stream_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, core.stream_vbo);
+	glBufferData(GL_ARRAY_BUFFER, total * sizeof(core_vertex_t), NULL, GL_STREAM_DRAW);
+	size_t offset = 0;
+	for (size_t i = 0; i < core.batches.size(); i++) {
+		std::vector<core_vertex_t>& v = core.batches[i].vertices;
+		glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(core_vertex_t), v.size() * sizeof(core_vertex_t), v.data());
+		offset += v.size();
+	}
+	offset = 0;
+	for (size_t i = 0; i < core.batches.size(); i++) {
+		core_batch_t* b = &core.batches[i];
+		coreApplyState(&b->key, false, identity, identity3, core.projection[core.projection_depth]);
+		glBindVertexArray(core.stream_vao);
+		glDrawArrays(b->key.lines ? GL_LINES : GL_TRIANGLES, offset, b->vertices.size());
+		offset += b->vertices.size();
+	}
+	core.batches.clear();
+}
+
+static std::vector<core_vertex_t>* coreBatchFor(const core_batch_key_t* key)
+{
+	for (size_t i = 0; i < core.batches.size(); i++) {
+		if (memcmp(&core.batches[i].key, key, sizeof(core_batch_key_t)) == 0)
+			return &core.batches[i].vertices;
+	}
+	core.batches.push_back(core_batch_t());
+	core.batches.back().key = *key;
+	return &core.batches.back().vertices;
+}
+
+static void coreBegin(GLenum mode)
+{
+	core.primitive = mode;
+	core.primitive_vertices.clear();
+}
+
+static void coreVertex3f(GLfloat x, GLfloat y, GLfloat z)
+{
+	const GLfloat* m = core.modelview[core.modelview_depth];
+	const GLfloat* n = coreNormalMatrix();
+	core_vertex_t v;
+	for (int k = 0; k < 3; k++) {
+		v.position[k] = m[k]*x + m[4+k]*y + m[8+k]*z + m[12+k];
+		v.normal[k] = n[k]*core.normal[0] + n[3+k]*core.normal[1] + n[6+k]*core.normal[2];
+	}
+	v.texcoord[0] = core.texcoord[0];
+	v.texcoord[1] = core.texcoord[1];
+	for (int k = 0; k < 4; k++) v.color[k] = (GLubyte)(std::min(std::max(core.color[k], 0.0f), 1.0f) * 255 + 0.5f);
+	core.primitive_vertices.push_back(v);
+}
+
+// Appends the primitive in core.primitive_vertices as triangles or lines
+static void coreTriangulate(std::vector<core_vertex_t>* triangles, std::vector<core_vertex_t>* lines)
+{
+	std::vector<core_vertex_t>& p = core.primitive_vertices;
+	int n = p.size();
+	switch (core.primitive) {
+		case GL_TRIANGLES:
+			triangles->insert(triangles->end(), p.begin(), p.begin() + n - n % 3);
+			break;
+		case GL_QUADS:
+			for (int i = 0; i + 3 < n; i += 4) {
+				core_vertex_t t[6] = { p[i], p[i+1], p[i+2], p[i], p[i+2], p[i+3] };
+				triangles->insert(triangles->end(), t, t + 6);
+			}
+			break;
+		case GL_QUAD_STRIP:
+			for (int i = 0; i + 3 < n; i += 2) {
+				core_vertex_t t[6] = { p[i], p[i+1], p[i+3], p[i], p[i+3], p[i+2] };
+				triangles->insert(triangles->end(), t, t + 6);
+			}
+			break;
+		case GL_TRIANGLE_STRIP:
+			for (int i = 0; i + 2 < n; i++) {
+				core_vertex_t t[3] = { p[i], p[i+1+i%2], p[i+2-i%2] };
+				triangles->insert(triangles->end(), t, t + 3);
+			}
+			break;
+		case GL_TRIANGLE_FAN:
+		case GL_POLYGON:
+			for (int i = 1; i + 1 < n; i++) {
+				core_vertex_t t[3] = { p[0], p[i], p[i+1] };
+				triangles->insert(triangles->end(), t, t + 3);
+			}
+			break;
+		case GL_LINES:
+			lines->insert(lines->end(), p.begin(), p.begin() + n - n % 2);
+			break;
+		case GL_LINE_STRIP:
+		case GL_LINE_LOOP:
+			for (int i = 0; i + 1 < n; i++) {
+				lines->push_back(p[i]);
+				lines->push_back(p[i+1]);
+			}
+			if (core.primitive == GL_LINE_LOOP && n > 2) {
+				lines->push_back(p[n-1]);
+				lines->push_back(p[0]);
+			}
+			break;
+	}
+}
+
+static void coreEnd()
+{
+	if (core.compiling) {
+		coreTriangulate(&core.compile_triangles, &core.compile_lines);
+		return;
+	}
+	bool lines = core.primitive == GL_LINES || core.primitive == GL_LINE_STRIP || core.primitive == GL_LINE_LOOP;
+	core_batch_key_t key = coreBatchKey(lines);
+	if (coreReorderable()) {
+		std::vector<core_vertex_t>* batch = coreBatchFor(&key);
+		coreTriangulate(batch, batch);
+		return;
+	}
+
+	// Ordered: draw now, after everything batched before it
+	static std::vector<core_vertex_t> vertices;
+	static GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+	static GLfloat identity3[9] = { 1,0,0, 0,1,0, 0,0,1 };
+	vertices.clear();
+	coreTriangulate(&vertices, &vertices);
+	if (vertices.empty()) return;
+	coreFlushBatches();
+	coreApplyState(&key, true, identity, identity3, core.projection[core.projection_depth]);
+	coreStreamAndDraw(vertices.data(), vertices.size(), lines ? GL_LINES : GL_TRIANGLES);
+}
+
+// Expanded into the immediate mode path, so it batches and compiles like glBegin/glEnd
+static void coreDrawTriangles(const GLfloat* vertices, const GLuint* indices, GLsizei count)
+{
+	coreBegin(GL_TRIANGLES);
+	for (GLsizei i = 0; i < count; i++) {
+		const GLfloat* v = vertices + 8 * indices[i];
+		core.normal[0] = v[3]; core.normal[1] = v[4]; core.normal[2] = v[5];
+		core.texcoord[0] = v[6]; core.texcoord[1] = v[7];
+		coreVertex3f(v[0], v[1], v[2]);
+	}
+	coreEnd();
+}
+
+// Drawn at once with the current modelview, like a display list; not compiled into lists
+static void coreDrawVertexBuffer(GLenum mode, GLuint buffer, GLintptr offset, GLsizei count)
+{
+	if (core.compiling || count <= 0) return;
+	bool ordered = !coreReorderable();
+	if (ordered) coreFlushBatches();
+	bool lines = mode == GL_LINES || mode == GL_LINE_STRIP || mode == GL_LINE_LOOP;
+	core_batch_key_t key = coreBatchKey(lines);
+	coreApplyState(&key, ordered, core.modelview[core.modelview_depth], coreNormalMatrix(), core.projection[core.projection_depth]);
+	glBindVertexArray(core.buffer_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)offset);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(offset + 3 * sizeof(GLfloat)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)(offset + 6 * sizeof(GLfloat)));
+	glVertexAttrib4fv(3, core.color); // the array of attribute 3 is disabled in this vertex array
+	glDrawArrays(mode, 0, count);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void coreNormal3f(GLfloat x, GLfloat y, GLfloat z) { core.normal[0] = x; core.normal[1] = y; core.normal[2] = z; }
+static void coreTexCoord2f(GLfloat s, GLfloat t) { core.texcoord[0] = s; core.texcoord[1] = t; }
+static void coreColor4f(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { core.color[0] = r; core.color[1] = g; core.color[2] = b; core.color[3] = a; }
+static void coreColor3f(GLfloat r, GLfloat g, GLfloat b) { coreColor4f(r, g, b, 1); }
+static void coreColor3fv(const GLfloat* c) { coreColor4f(c[0], c[1], c[2], 1); }
+
+/*** Retained geometry ***/
+
+static void coreSetupVertexArray(GLuint vao, GLuint vbo)
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(core_vertex_t), (void*)offsetof(core_vertex_t, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(core_vertex_t), (void*)offsetof(core_vertex_t, normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(core_vertex_t), (void*)offsetof(core_vertex_t, texcoord));
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(core_vertex_t), (void*)offsetof(core_vertex_t, color));
+}
+
+static GLuint coreGenLists(GLsizei range)
+{
+	GLuint first = core.lists.size() + 1;
+	for (int i = 0; i < range; i++) {
+		core_list_t l = { 0, 0, 0, 0 };
+		core.lists.push_back(l);
+	}
+	return first;
+}
+
+static void coreDeleteLists(GLuint list, GLsizei range)
+{
+	for (GLuint id = list; id < list + range && id <= core.lists.size(); id++) {
+		core_list_t* l = &core.lists[id - 1];
+		if (l->vbo) glDeleteBuffers(1, &l->vbo);
+		if (l->vao) glDeleteVertexArrays(1, &l->vao);
+		l->vao = l->vbo = 0;
+		l->triangles = l->lines = 0;
+	}
+}
+
+// Geometry is recorded relative to the modelview at glNewList time
+static void coreNewList(GLuint list, GLenum)
+{
+	if (list == 0 || list > core.lists.size()) return;
+	core.compiling = list;
+	core.compile_triangles.clear();
+	core.compile_lines.clear();
+	memcpy(core.compile_saved_modelview, core.modelview[core.modelview_depth], sizeof(core.compile_saved_modelview));
+	coreIdentity(core.modelview[core.modelview_depth]);
+	core.normal_matrix_dirty = true;
+}
+
+static void coreEndList()
+{
+	if (!core.compiling) return;
+	core_list_t* l = &core.lists[core.compiling - 1];
+	if (!l->vao) {
+		glGenVertexArrays(1, &l->vao);
+		glGenBuffers(1, &l->vbo);
+		coreSetupVertexArray(l->vao, l->vbo);
+	}
+	l->triangles = core.compile_triangles.size();
+	l->lines = core.compile_lines.size();
+	glBindBuffer(GL_ARRAY_BUFFER, l->vbo);
+	glBufferData(GL_ARRAY_BUFFER, (l->triangles + l->lines) * sizeof(core_vertex_t), NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, l->triangles * sizeof(core_vertex_t), core.compile_triangles.data());
+	glBufferSubData(GL_ARRAY_BUFFER, l->triangles * sizeof(core_vertex_t), l->lines * sizeof(core_vertex_t), core.compile_lines.data());
+
+	memcpy(core.modelview[core.modelview_depth], core.compile_saved_modelview, sizeof(core.compile_saved_modelview));
+	core.normal_matrix_dirty = true;
+	core.compiling = 0;
+}
+
+static void coreCallList(GLuint list)
+{
+	if (list == 0 || list > core.lists.size()) return;
+	core_list_t* l = &core.lists[list - 1];
+	if (!l->vao) return;
+	bool ordered = !coreReorderable();
+	if (ordered) coreFlushBatches();
+	const GLfloat* modelview = core.modelview[core.modelview_depth];
+	if (l->triangles) {
+		core_batch_key_t key = coreBatchKey(false);
+		coreApplyState(&key, ordered, modelview, coreNormalMatrix(), core.projection[core.projection_depth]);
+		glBindVertexArray(l->vao);
+		glDrawArrays(GL_TRIANGLES, 0, l->triangles);
+	}
+	if (l->lines) {
+		core_batch_key_t key = coreBatchKey(true);
+		coreApplyState(&key, ordered, modelview, coreNormalMatrix(), core.projection[core.projection_depth]);
+		glBindVertexArray(l->vao);
+		glDrawArrays(GL_LINES, l->triangles, l->lines);
+	}
+}
+
+static void coreEmitSphere(GLdouble radius, GLint slices, GLint stacks)
+{
+	for (int i = 0; i < stacks; i++) {
+		GLfloat z0 = cos(CORE_PI * i / stacks),       r0 = sin(CORE_PI * i / stacks);
+		GLfloat z1 = cos(CORE_PI * (i + 1) / stacks), r1 = sin(CORE_PI * (i + 1) / stacks);
+		coreBegin(GL_QUAD_STRIP);
+		for (int j = 0; j <= slices; j++) {
+			GLfloat x = cos(2 * CORE_PI * j / slices), y = sin(2 * CORE_PI * j / slices);
+			coreNormal3f(x * r0, y * r0, z0);
+			coreVertex3f(radius * x * r0, radius * y * r0, radius * z0);
+			coreNormal3f(x * r1, y * r1, z1);
+			coreVertex3f(radius * x * r1, radius * y * r1, radius * z1);
+		}
+		coreEnd();
+	}
+}
+
+static void coreEmitCone(GLdouble base, GLdouble height, GLint slices, GLint stacks)
+{
+	GLfloat slant = sqrt(base * base + height * height);
+	GLfloat nz = base / slant, nr = height / slant;
+	for (int i = 0; i < stacks; i++) {
+		GLfloat z0 = height * i / stacks,       r0 = base * (1 - (GLfloat)i / stacks);
+		GLfloat z1 = height * (i + 1) / stacks, r1 = base * (1 - (GLfloat)(i + 1) / stacks);
+		coreBegin(GL_QUAD_STRIP);
+		for (int j = 0; j <= slices; j++) {
+			GLfloat x = cos(2 * CORE_PI * j / slices), y = sin(2 * CORE_PI * j / slices);
+			coreNormal3f(x * nr, y * nr, nz);
+			coreVertex3f(r0 * x, r0 * y, z0);
+			coreVertex3f(r1 * x, r1 * y, z1);
+		}
+		coreEnd();
+	}
+	// Base
+	coreBegin(GL_TRIANGLE_FAN);
+	coreNormal3f(0, 0, -1);
+	coreVertex3f(0, 0, 0);
+	for (int j = slices; j >= 0; j--)
+		coreVertex3f(base * cos(2 * CORE_PI * j / slices), base * sin(2 * CORE_PI * j / slices), 0);
+	coreEnd();
+}
+
+// Same vertices and texture coordinates as gluCylinder
+static void coreEmitCylinder(GLdouble base, GLdouble top, GLdouble height, GLint slices, GLint stacks)
+{
+	GLfloat nz = (base - top) / height;
+	for (int i = 0; i < stacks; i++) {
+		GLfloat z0 = height * i / stacks,       r0 = base + (top - base) * i / stacks;
+		GLfloat z1 = height * (i + 1) / stacks, r1 = base + (top - base) * (i + 1) / stacks;
+		coreBegin(GL_QUAD_STRIP);
+		for (int j = 0; j <= slices; j++) {
+			GLfloat s = sin(2 * CORE_PI * (j % slices) / slices), c = cos(2 * CORE_PI * (j % slices) / slices);
+			coreNormal3f(s, c, nz);
+			coreTexCoord2f(1 - (GLfloat)j / slices, (GLfloat)i / stacks);
+			coreVertex3f(r0 * s, r0 * c, z0);
+			coreTexCoord2f(1 - (GLfloat)j / slices, (GLfloat)(i + 1) / stacks);
+			coreVertex3f(r1 * s, r1 * c, z1);
+		}
+		coreEnd();
+	}
+}
+
+// Solids are compiled into a list the first time they are requested with some
+// parameters. Inside a list being compiled they are emitted inline instead.
+static void coreSolid(int type, GLdouble a, GLdouble b, GLdouble c, GLint slices, GLint stacks)
+{
+	if (core.compiling) {
+		if (type == 0) coreEmitSphere(a, slices, stacks);
+		else if (type == 1) coreEmitCone(a, b, slices, stacks);
+		else coreEmitCylinder(a, b, c, slices, stacks);
+		return;
+	}
+	GLuint list = 0;
+	for (size_t i = 0; i < core.meshes.size() && !list; i++) {
+		core_mesh_t* m = &core.meshes[i];
+		if (m->type == type && m->params[0] == a && m->params[1] == b && m->params[2] == c &&
+		    m->slices == slices && m->stacks == stacks)
+			list = m->list;
+	}
+	if (!list) {
+		core_mesh_t m = { type, { a, b, c }, slices, stacks, coreGenLists(1) };
+		GLfloat saved_normal[3], saved_texcoord[2];
+		memcpy(saved_normal, core.normal, sizeof(saved_normal));
+		memcpy(saved_texcoord, core.texcoord, sizeof(saved_texcoord));
+		coreNewList(m.list, GL_COMPILE);
+		coreSolid(type, a, b, c, slices, stacks);
+		coreEndList();
+		memcpy(core.normal, saved_normal, sizeof(saved_normal));
+		memcpy(core.texcoord, saved_texcoord, sizeof(saved_texcoord));
+		core.meshes.push_back(m);
+		list = m.list;
+	}
+	coreCallList(list);
+}
+
+static void coreSolidSphere(GLdouble radius, GLint slices, GLint stacks) { coreSolid(0, radius, 0, 0, slices, stacks); }
+static void coreSolidCone(GLdouble base, GLdouble height, GLint slices, GLint stacks) { coreSolid(1, base, height, 0, slices, stacks); }
+static void coreTexturedCylinder(GLdouble base, GLdouble top, GLdouble height, GLint slices, GLint stacks) { coreSolid(2, base, top, height, slices, stacks); }
+
+/*** Text ***/
+
+static freeglut_font_t* coreFontData(void* font)
+{
+	if (font == GLUT_BITMAP_8_BY_13)        return &fgFontFixed8x13;
+	if (font == GLUT_BITMAP_9_BY_15)        return &fgFontFixed9x15;
+	if (font == GLUT_BITMAP_HELVETICA_10)   return &fgFontHelvetica10;
+	if (font == GLUT_BITMAP_HELVETICA_12)   return &fgFontHelvetica12;
+	if (font == GLUT_BITMAP_TIMES_ROMAN_10) return &fgFontTimesRoman10;
+	if (font == GLUT_BITMAP_TIMES_ROMAN_24) return &fgFontTimesRoman24;
+	return &fgFontHelvetica18;
+}
+
+// 16x16 cells, one per character, with the glyph in the lower left corner
+static core_font_t* coreFontAtlas(void* font)
+{
+	for (size_t i = 0; i < core.fonts.size(); i++)
+		if (core.fonts[i].font == font) return &core.fonts[i];
+
+	freeglut_font_t* data = coreFontData(font);
+	core_font_t f = { font, 0, 0, data->height };
+	for (int c = 0; c < data->quantity; c++)
+		if (data->characters[c]) f.cell_width = std::max(f.cell_width, (int)data->characters[c][0]);
+
+	int w = 16 * f.cell_width, h = 16 * f.height;
+	std::vector<GLubyte> texels(w * h, 0);
+	for (int c = 0; c < data->quantity && c < 256; c++) {
+		const GLubyte* face = data->characters[c];
+		if (!face) continue;
+		int width = face[0], bytes_per_row = (width + 7) / 8;
+		for (int row = 0; row < data->height; row++)
+			for (int x = 0; x < width; x++)
+				if (face[1 + row * bytes_per_row + x / 8] & (0x80 >> (x % 8)))
+					texels[((c / 16) * f.height + row) * w + (c % 16) * f.cell_width + x] = 255;
+	}
+	glGenTextures(1, &f.texture);
+	glBindTexture(GL_TEXTURE_2D, f.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, core.texture);
+	core.fonts.push_back(f);
+	return &core.fonts.back();
+}
+
+static void coreBitmapText(GLint x, GLint y, const char* text, void* font)
+{
+	// Raster position in window coordinates, as glRasterPos2i would compute it
+	GLfloat mvp[16], clip[4];
+	coreMultiply(mvp, core.projection[core.projection_depth], core.modelview[core.modelview_depth]);
+	for (int k = 0; k < 4; k++) clip[k] = mvp[k]*x + mvp[4+k]*y + mvp[12+k];
+	if (clip[3] <= 0) return;
+	GLfloat pen_x = floor((clip[0] / clip[3] * 0.5f + 0.5f) * core.viewport[2] + 0.5f);
+	GLfloat pen_y = floor((clip[1] / clip[3] * 0.5f + 0.5f) * core.viewport[3] + 0.5f);
+
+	freeglut_font_t* data = coreFontData(font);
+	core_font_t* atlas = coreFontAtlas(font);
+	GLfloat cell_s = 1.0f / 16, cell_t = 1.0f / 16;
+	std::vector<core_vertex_t> vertices;
+	for (; *text; text++) {
+		unsigned char c = *text;
+		if (c >= data->quantity || !data->characters[c]) continue;
+		int width = data->characters[c][0];
+		GLfloat x0 = pen_x - data->xorig, y0 = pen_y - data->yorig;
+		GLfloat s0 = (c % 16) * cell_s, t0 = (c / 16) * cell_t;
+		GLfloat s1 = s0 + cell_s * width / atlas->cell_width, t1 = t0 + cell_t;
+		GLfloat corners[4][4] = { { x0, y0, s0, t0 }, { x0 + width, y0, s1, t0 },
+		                          { x0 + width, y0 + data->height, s1, t1 }, { x0, y0 + data->height, s0, t1 } };
+		int order[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int k = 0; k < 6; k++) {
+			core_vertex_t v = { { corners[order[k]][0], corners[order[k]][1], 0 }, { 0, 0, 1 },
+			                    { corners[order[k]][2], corners[order[k]][3] }, { 0, 0, 0, 0 } };
+			for (int i = 0; i < 4; i++) v.color[i] = (GLubyte)(std::min(std::max(core.color[i], 0.0f), 1.0f) * 255 + 0.5f);
+			vertices.push_back(v);
+		}
+		pen_x += width;
+	}
+	if (vertices.empty()) return;
+
+	static GLfloat identity[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+	static GLfloat identity3[9] = { 1,0,0, 0,1,0, 0,0,1 };
+	GLfloat window[16];
+	coreIdentity(window);
+	window[0] = 2.0f / core.viewport[2];
+	window[5] = 2.0f / core.viewport[3];
+	window[12] = window[13] = -1;
+
+	core_batch_key_t key = { atlas->texture, 0, CORE_FLAG_TEXT, false, false };
+	coreFlushBatches();
+	coreApplyState(&key, true, identity, identity3, window);
+	glDisable(GL_DEPTH_TEST);
+	coreStreamAndDraw(vertices.data(), vertices.size(), GL_TRIANGLES);
+	glBindTexture(GL_TEXTURE_2D, core.texture);
+}
+
+static void coreSwapBuffers()
+{
+	coreFlushBatches();
+	glutSwapBuffers();
+}
+
+/*** Setup ***/
+
+static GLuint coreCompileShader(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint ok;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		std::cerr << "Shader compilation failed: " << log << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static void coreResetState()
+{
+	core.matrix_mode = GL_MODELVIEW;
+	core.modelview_depth = core.projection_depth = 0;
+	coreIdentity(core.modelview[0]);
+	coreIdentity(core.projection[0]);
+	core.normal_matrix_dirty = true;
+
+	coreColor4f(1, 1, 1, 1);
+	coreNormal3f(0, 0, 1);
+	coreTexCoord2f(0, 0);
+
+	core.lighting = core.texture_2d = core.fog = core.blend = core.depth_test = core.cull_face = false;
+	core.depth_mask = true;
+	core.polygon_mode = GL_FILL;
+	core.texture = 0;
+	core.env_mode = GL_MODULATE;
+	core.attrib_depth = 0;
+
+	// Fixed function defaults
+	core_material_t material = { { 0.2, 0.2, 0.2, 1 }, { 0.8, 0.8, 0.8, 1 }, { 0, 0, 0, 1 }, { 0, 0, 0, 1 }, { 0, 0, 0, 0 } };
+	core.material = material;
+	core.material_index = -1;
+	memset(&core.lights, 0, sizeof(core.lights));
+	for (int i = 0; i < CORE_MAX_LIGHTS; i++) {
+		core_light_t* l = &core.lights.lights[i];
+		l->ambient[3] = l->diffuse[3] = l->specular[3] = 1;
+		l->position[2] = 1;
+		l->spot[2] = -1;
+		l->spot[3] = -1; // cos(180)
+	}
+	for (int k = 0; k < 4; k++) core.lights.lights[0].diffuse[k] = core.lights.lights[0].specular[k] = 1;
+	GLfloat scene_ambient[4] = { 0.2, 0.2, 0.2, 1 };
+	memcpy(core.lights.scene_ambient, scene_ambient, sizeof(scene_ambient));
+	core.lights.fog_params[0] = 1;
+	core.lights_dirty = true;
+}
+
+bool useCoreRenderer()
+{
+	GLuint vs = coreCompileShader(GL_VERTEX_SHADER, CORE_VERTEX_SHADER);
+	GLuint fs = coreCompileShader(GL_FRAGMENT_SHADER, CORE_FRAGMENT_SHADER);
+	if (!vs || !fs) return false;
+
+	core.program = glCreateProgram();
+	glAttachShader(core.program, vs);
+	glAttachShader(core.program, fs);
+	glLinkProgram(core.program);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	GLint ok;
+	glGetProgramiv(core.program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetProgramInfoLog(core.program, sizeof(log), NULL, log);
+		std::cerr << "Program link failed: " << log << std::endl;
+		return false;
+	}
+	core.u_modelview = glGetUniformLocation(core.program, "u_modelview");
+	core.u_normal_matrix = glGetUniformLocation(core.program, "u_normal_matrix");
+	core.u_projection = glGetUniformLocation(core.program, "u_projection");
+	core.u_material = glGetUniformLocation(core.program, "u_material");
+	core.u_flags = glGetUniformLocation(core.program, "u_flags");
+	glUseProgram(core.program);
+	glUniform1i(glGetUniformLocation(core.program, "u_texture"), 0);
+
+	// Uniform buffers
+	glGenBuffers(1, &core.lights_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, core.lights_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(core_lights_block_t), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, core.lights_ubo);
+	glUniformBlockBinding(core.program, glGetUniformBlockIndex(core.program, "Lights"), 0);
+	glGenBuffers(1, &core.materials_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, core.materials_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(core.materials), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 1, core.materials_ubo);
+	glUniformBlockBinding(core.program, glGetUniformBlockIndex(core.program, "Materials"), 1);
+
+	// Streaming buffer for immediate mode
+	glGenVertexArrays(1, &core.stream_vao);
+	glGenBuffers(1, &core.stream_vbo);
+	coreSetupVertexArray(core.stream_vao, core.stream_vbo);
+	glGenVertexArrays(1, &core.buffer_vao);
+	glBindVertexArray(core.buffer_vao);
+	for (int i = 0; i < 3; i++) glEnableVertexAttribArray(i);
+
+	coreResetState();
+	glGetIntegerv(GL_VIEWPORT, core.viewport);
+
+	static render_backend_t r = legacyRenderer();
+	r.name = "core";
+	r.clear = coreClear;
+	r.clearRect = coreClearRect;
+	r.viewport = coreViewport;
+	r.getIntegerv = coreGetIntegerv;
+	r.getFloatv = coreGetFloatv;
+	r.swapBuffers = coreSwapBuffers;
+	r.matrixMode = coreMatrixMode;
+	r.loadIdentity = coreLoadIdentity;
+	r.pushMatrix = corePushMatrix;
+	r.popMatrix = corePopMatrix;
+	r.translatef = coreTranslatef;
+	r.rotatef = coreRotatef;
+	r.scalef = coreScalef;
+	r.ortho = coreOrtho;
+	r.perspective = corePerspective;
+	r.lookAt = coreLookAt;
+	r.begin = coreBegin;
+	r.end = coreEnd;
+	r.vertex3f = coreVertex3f;
+	r.normal3f = coreNormal3f;
+	r.texCoord2f = coreTexCoord2f;
+	r.color3f = coreColor3f;
+	r.color3fv = coreColor3fv;
+	r.color4f = coreColor4f;
+	r.drawTriangles = coreDrawTriangles;
+	r.drawVertexBuffer = coreDrawVertexBuffer;
+	r.genLists = coreGenLists;
+	r.newList = coreNewList;
+	r.endList = coreEndList;
+	r.callList = coreCallList;
+	r.deleteLists = coreDeleteLists;
+	r.solidSphere = coreSolidSphere;
+	r.solidCone = coreSolidCone;
+	r.texturedCylinder = coreTexturedCylinder;
+	r.materialfv = coreMaterialfv;
+	r.materialf = coreMaterialf;
+	r.lightfv = coreLightfv;
+	r.lightf = coreLightf;
+	r.fogfv = coreFogfv;
+	r.fogf = coreFogf;
+	r.bindTexture = coreBindTexture;
+	r.texEnvi = coreTexEnvi;
+	r.bindFramebuffer = coreBindFramebuffer;
+	r.blitFramebuffer = coreBlitFramebuffer;
+	r.readPixelsToBuffer = coreReadPixelsToBuffer;
+	r.enable = coreEnable;
+	r.disable = coreDisable;
+	r.isEnabled = coreIsEnabled;
+	r.depthMask = coreDepthMask;
+	r.polygonMode = corePolygonMode;
+	r.pushAttrib = corePushAttrib;
+	r.popAttrib = corePopAttrib;
+	r.bitmapText = coreBitmapText;
+	r.queryTimestamp = coreQueryTimestamp;
+	// clearColor, genTextures, texImage2D, compressedTexImage2D, texParameteri, blendFunc, cullFace and
+	// the other framebuffer calls exist in core profiles and go straight to GL
+	renderer = &r;
+	return true;
+}
+#endif
@@ -0,0 +1,124 @@
+#ifndef DYNAMICRESOLUTION
+#define DYNAMICRESOLUTION
+/*
+	Dynamic resolution.
+
+	The 3D scene is drawn into an offscreen framebuffer and stretched to the
+	window with a linear blit, so overlays drawn afterwards keep the native
+	resolution. The framebuffer is allocated at window size once and the scene
+	only uses its lower left scale x scale part, so changing the scale costs
+	nothing but the viewport.
+
+	The scale follows the measured frame time: fill-rate bound frames cost about
+	the number of pixels, so the scale that fits the budget is
+	scale * sqrt(target / frame time). Frame times are smoothed, scales are
+	rounded to RESOLUTION_STEP and, after a change, kept for
+	RESOLUTION_HOLD_FRAMES frames so that the scale does not oscillate.
+*/
+
+#include <cmath>
+#include "Renderer.h"
+
+#define MIN_RESOLUTION_SCALE 0.4f
+#define RESOLUTION_STEP 0.05f
+#define RESOLUTION_HEADROOM 0.85f   // share of the frame budget the frame aims for
+#define RESOLUTION_SMOOTHING 0.1f   // weight of the newest frame time
+#define RESOLUTION_HOLD_FRAMES 15
+
+typedef struct {
+	GLuint framebuffer, color, depth;
+	int width, height;      // of the window and the framebuffer
+	float scale;            // of the scene in each axis
+	bool dynamic;           // scale driven by frame time
+	double smoothed_ms;
+	int hold;               // frames until the scale may change again
+} scene_target_t;
+
+bool createSceneTarget(scene_target_t* target, int width, int height);
+/* Creates or resizes the framebuffer. Returns false if framebuffers are not supported */
+
+void beginScene(scene_target_t* target);
+/* Binds the framebuffer and sets the viewport to the scaled size */
+
+void endScene(scene_target_t* target);
+/* Stretches the scene to the window and restores the window framebuffer and
+   viewport. The depth buffer of the window is cleared for the overlays      */
+
+void updateResolutionScale(scene_target_t* target, double frame_ms, double budget_ms);
+/* Adjusts the scale of the next frames to the time the last frame took */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+bool createSceneTarget(scene_target_t* target, int width, int height)
+{
+	if (target->framebuffer == 0) {
+		renderer->genFramebuffers(1, &target->framebuffer);
+		renderer->genRenderbuffers(1, &target->color);
+		renderer->genRenderbuffers(1, &target->depth);
+	}
+	target->width = width;
+	target->height = height;
+
+	renderer->bindRenderbuffer(GL_RENDERBUFFER, target->color);
+	renderer->renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	renderer->bindRenderbuffer(GL_RENDERBUFFER, target->depth);
+	renderer->renderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	renderer->bindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	renderer->framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->color);
+	renderer->framebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth);
+	bool complete = renderer->checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+static int sceneSize(const scene_target_t* target, int size)
+{
+	int scaled = (int)(size * target->scale + 0.5f);
+	return scaled > 0 ? scaled : 1;
+}
+
+void beginScene(scene_target_t* target)
+{
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	renderer->viewport(0, 0, sceneSize(target, target->width), sceneSize(target, target->height));
+}
+
+void endScene(scene_target_t* target)
+{
+	renderer->bindFramebuffer(GL_READ_FRAMEBUFFER, target->framebuffer);
+	renderer->bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	renderer->blitFramebuffer(0, 0, sceneSize(target, target->width), sceneSize(target, target->height),
+	                          0, 0, target->width, target->height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, 0);
+	renderer->viewport(0, 0, target->width, target->height);
+	renderer->clear(GL_DEPTH_BUFFER_BIT);
+}
+
+void updateResolutionScale(scene_target_t* target, double frame_ms, double budget_ms)
+{
+	if (!target->dynamic) return;
+
+	target->smoothed_ms = target->smoothed_ms > 0
+		? (1 - RESOLUTION_SMOOTHING) * target->smoothed_ms + RESOLUTION_SMOOTHING * frame_ms
+		: frame_ms;
+	if (target->hold > 0) {
+		target->hold--;
+		return;
+	}
+
+	float wanted = target->scale * sqrt(RESOLUTION_HEADROOM * budget_ms / target->smoothed_ms);
+	wanted = floor(wanted / RESOLUTION_STEP + 0.5f) * RESOLUTION_STEP;
+	if (wanted > target->scale + RESOLUTION_STEP) wanted = target->scale + RESOLUTION_STEP; // grow slowly, shrink at once
+	if (wanted > 1) wanted = 1;
+	if (wanted < MIN_RESOLUTION_SCALE) wanted = MIN_RESOLUTION_SCALE;
+	if (fabs(wanted - target->scale) < RESOLUTION_STEP / 2) return;
+
+	// The smoothed time was measured at the old scale
+	target->smoothed_ms *= (wanted * wanted) / (target->scale * target->scale);
+	target->scale = wanted;
+	target->hold = RESOLUTION_HOLD_FRAMES;
+}
+
+#endif
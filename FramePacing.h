@@ -0,0 +1,232 @@
+#ifndef FRAMEPACING
+#define FRAMEPACING
+/*
+	Frame pacing.
+
+	Frames start at absolute deadlines, start + n * period, instead of a timer
+	re-armed for a whole period once the work of the previous frame is done, so
+	neither the work time nor the millisecond rounding of glutTimerFunc add up.
+	A frame that misses its deadline by more than a period restarts the schedule
+	from the present instead of rushing the frames it missed.
+
+	In vsync mode the buffer swap blocks until the display refreshes, so the next
+	frame starts as soon as the previous one is presented and the display sets the
+	pace.
+
+	The intervals between presents are recorded in histograms: one for the whole
+	run and one for the last second. Buckets are log-spaced, each about 6% wider
+	than the previous one, from FRAME_HISTOGRAM_MIN_MS to FRAME_HISTOGRAM_MAX_MS,
+	so percentiles keep the same relative precision for a headless traversal of
+	a tenth of a millisecond as for a frame of a hundred. Percentiles are
+	interpolated within their bucket. Frames of FRAME_HISTOGRAM_MAX_MS or longer
+	share the last bucket, so a percentile falling there is only known to be at
+	least that long.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <GL/glx.h>
+
+#define FRAME_HISTOGRAM_MIN_MS 0.01     // the first bucket counts every shorter frame
+#define FRAME_HISTOGRAM_MAX_MS 1000     // the last bucket counts every frame this long or longer
+#define FRAME_BUCKETS 200
+
+typedef struct {
+	unsigned long counts[FRAME_BUCKETS];
+	unsigned long frames;
+	double total_ms;
+	double min_ms;
+	double max_ms;
+} frame_histogram_t;
+
+typedef struct {
+	double period_ms;
+	bool vsync;
+	double next_deadline;       // ms since the pacer started
+	double last_present;        // ms since the pacer started, negative before the first present
+	frame_histogram_t total;
+	frame_histogram_t recent;   // being filled
+	frame_histogram_t last_second;
+	double recent_start;
+	std::chrono::steady_clock::time_point start;
+} frame_pacer_t;
+
+void framePacerInit(frame_pacer_t* pacer, double period_ms, bool vsync);
+
+int framePacerDelay(frame_pacer_t* pacer);
+/* Milliseconds to wait before starting the next frame. Call once per frame */
+
+void framePacerPresented(frame_pacer_t* pacer);
+/* Records the interval since the previous present. Call right after the swap */
+
+void frameHistogramAdd(frame_histogram_t* histogram, double ms);
+
+double frameBucketStart(int bucket);
+/* Shortest frame counted in the bucket, in ms */
+
+double frameHistogramPercentile(const frame_histogram_t* histogram, double p);
+/* p-th percentile (0 < p <= 100) in ms, interpolated within its bucket.
+   FRAME_HISTOGRAM_MAX_MS if it falls in the last bucket, meaning at least that */
+
+unsigned long frameHistogramCount(const frame_histogram_t* histogram, double from_ms, double to_ms);
+/* Frames of the buckets starting in [from_ms, to_ms) */
+
+void printFrameHistogram(std::ostream& out, const char* title, const frame_histogram_t* histogram, const char* samples = "frames");
+/* Mean, percentiles, worst frame and the share of frames per 1 ms band up to
+   50 ms, longer ones in a last band. samples
+   names what was timed, for histograms of something other than frames       */
+
+bool enableVsync();
+/* Asks the driver to sync buffer swaps to the display refresh. Requires a
+   current GLX context. Returns false if no swap control extension exists  */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+static double framePacerNow(const frame_pacer_t* pacer)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pacer->start).count();
+}
+
+void framePacerInit(frame_pacer_t* pacer, double period_ms, bool vsync)
+{
+	memset(&pacer->total, 0, sizeof(frame_histogram_t));
+	memset(&pacer->recent, 0, sizeof(frame_histogram_t));
+	memset(&pacer->last_second, 0, sizeof(frame_histogram_t));
+	pacer->period_ms = period_ms;
+	pacer->vsync = vsync;
+	pacer->start = std::chrono::steady_clock::now();
+	pacer->next_deadline = 0;
+	pacer->last_present = -1;
+	pacer->recent_start = 0;
+}
+
+int framePacerDelay(frame_pacer_t* pacer)
+{
+	if (pacer->vsync) return 0;
+
+	double now = framePacerNow(pacer);
+	pacer->next_deadline += pacer->period_ms;
+	if (pacer->next_deadline < now - pacer->period_ms)
+		pacer->next_deadline = now; // too late, do not try to catch up
+	double wait = pacer->next_deadline - now;
+	return wait > 0 ? (int)(wait + 0.5) : 0;
+}
+
+void framePacerPresented(frame_pacer_t* pacer)
+{
+	double now = framePacerNow(pacer);
+	if (pacer->last_present >= 0) {
+		frameHistogramAdd(&pacer->total, now - pacer->last_present);
+		frameHistogramAdd(&pacer->recent, now - pacer->last_present);
+	}
+	pacer->last_present = now;
+
+	if (now - pacer->recent_start >= 1000) {
+		pacer->last_second = pacer->recent;
+		memset(&pacer->recent, 0, sizeof(frame_histogram_t));
+		pacer->recent_start = now;
+	}
+}
+
+void frameHistogramAdd(frame_histogram_t* histogram, double ms)
+{
+	int bucket = 0;
+	if (ms >= FRAME_HISTOGRAM_MAX_MS)
+		bucket = FRAME_BUCKETS - 1;
+	else if (ms >= FRAME_HISTOGRAM_MIN_MS)
+		bucket = 1 + (int)((FRAME_BUCKETS - 2) * log(ms / FRAME_HISTOGRAM_MIN_MS) / log(FRAME_HISTOGRAM_MAX_MS / FRAME_HISTOGRAM_MIN_MS));
+	if (bucket > FRAME_BUCKETS - 2 && ms < FRAME_HISTOGRAM_MAX_MS) bucket = FRAME_BUCKETS - 2; // rounding
+	histogram->counts[bucket]++;
+	if (histogram->frames == 0 || ms < histogram->min_ms) histogram->min_ms = ms;
+	histogram->frames++;
+	histogram->total_ms += ms;
+	if (ms > histogram->max_ms) histogram->max_ms = ms;
+}
+
+double frameHistogramPercentile(const frame_histogram_t* histogram, double p)
+{
+	if (histogram->frames == 0) return 0;
+	double rank = p / 100 * histogram->frames;
+	unsigned long seen = 0;
+	for (int i = 0; i < FRAME_BUCKETS - 1; i++) {
+		unsigned long count = histogram->counts[i];
+		if (count > 0 && seen + count >= rank) {
+			// Spread evenly over the part of the bucket between the fastest and the slowest frame
+			double low = frameBucketStart(i), high = frameBucketStart(i + 1);
+			if (histogram->min_ms > low) low = histogram->min_ms;
+			if (histogram->max_ms < high) high = histogram->max_ms;
+			return low + (high - low) * (rank - seen) / count;
+		}
+		seen += count;
+	}
+	return FRAME_HISTOGRAM_MAX_MS;
+}
+
+double frameBucketStart(int bucket)
+{
+	if (bucket <= 0) return 0;
+	if (bucket >= FRAME_BUCKETS - 1) return FRAME_HISTOGRAM_MAX_MS;
+	return FRAME_HISTOGRAM_MIN_MS * pow(FRAME_HISTOGRAM_MAX_MS / FRAME_HISTOGRAM_MIN_MS, (bucket - 1.0) / (FRAME_BUCKETS - 2));
+}
+
+unsigned long frameHistogramCount(const frame_histogram_t* histogram, double from_ms, double to_ms)
+{
+	unsigned long count = 0;
+	for (int i = 0; i < FRAME_BUCKETS; i++) {
+		double start = frameBucketStart(i);
+		if (start >= from_ms && start < to_ms) count += histogram->counts[i];
+	}
+	return count;
+}
+
+static void printFramePercentile(std::ostream& out, const frame_histogram_t* histogram, double p)
+{
+	double ms = frameHistogramPercentile(histogram, p);
+	if (ms >= FRAME_HISTOGRAM_MAX_MS) out << ">=";
+	out << ms << " p" << (int)p;
+}
+
+void printFrameHistogram(std::ostream& out, const char* title, const frame_histogram_t* histogram, const char* samples)
+{
+	if (histogram->frames == 0) return;
+
+	out << std::fixed << std::setprecision(2);
+	out << title << ": " << histogram->total_ms / histogram->frames << " ms mean, ";
+	printFramePercentile(out, histogram, 50);
+	out << ", ";
+	printFramePercentile(out, histogram, 95);
+	out << ", ";
+	printFramePercentile(out, histogram, 99);
+	out << ", " << histogram->max_ms << " max (" << histogram->frames << " " << samples << ")" << "\n";
+
+	const int bands = 50;
+	for (int i = 0; i <= bands; i++) {
+		unsigned long count = frameHistogramCount(histogram, i, i < bands ? i + 1 : INFINITY);
+		if (count == 0) continue;
+
+		char band[32];
+		if (i < bands)
+			snprintf(band, sizeof(band), "%3d-%-3d ms", i, i + 1);
+		else
+			snprintf(band, sizeof(band), "%3d+    ms", i);
+		double share = 100.0 * count / histogram->frames;
+		out << band << std::setw(7) << share << "% " << std::string((int)(share / 2 + 0.5), '#') << "\n";
+	}
+	out << std::defaultfloat;
+}
+
+bool enableVsync()
+{
+	typedef int (*swap_interval_t)(int);
+	swap_interval_t swap_interval = (swap_interval_t)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+	if (swap_interval == NULL)
+		swap_interval = (swap_interval_t)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+	return swap_interval != NULL && swap_interval(1) == 0;
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef INPUT
+#define INPUT
+/*
+	Polled input and input latency.
+
+	Key presses and releases only update a table of key states; each simulation
+	step polls it. A key applies one step as soon as it is pressed, so a tap
+	shorter than a simulation step still counts, and INPUT_REPEAT_RATE steps per
+	second for as long as it is held, whatever the auto-repeat of the system.
+
+	Every press and release is timestamped. The step that polls it records its
+	input to simulation latency, and the first buffer swap after that step,
+	which presents the frame simulated with it, its input to present latency.
+	Under vsync the swap returns when the frame reaches the display; otherwise
+	it returns once the frame is queued, so that latency leaves out the queue
+	of the driver.
+*/
+
+#include <chrono>
+#include <vector>
+#include "FramePacing.h"
+
+#define INPUT_REPEAT_RATE 30  // steps per second of a held key
+
+typedef enum { INPUT_ACCELERATE, INPUT_BRAKE, INPUT_LEFT, INPUT_RIGHT, NUM_INPUTS } input_t;
+
+typedef struct {
+	bool down;
+	int presses;          // since the last poll
+	double down_since;    // ms, while down: press or last poll, whichever is later
+	double held_ms;       // released since the last poll
+} key_state_t;
+
+typedef struct {
+	key_state_t keys[NUM_INPUTS];
+	std::vector<double> unpolled;     // ms of every press and release not polled yet
+	std::vector<double> unpresented;  // polled, waiting for the next swap
+	frame_histogram_t to_simulation;
+	frame_histogram_t to_present;
+	std::chrono::steady_clock::time_point start;
+} input_state_t;
+
+void inputInit(input_state_t* input);
+
+void inputPress(input_state_t* input, input_t key);
+void inputRelease(input_state_t* input, input_t key);
+/* From the key callbacks. Repeated presses of a key that is down are ignored */
+
+void inputPoll(input_state_t* input, float steps[NUM_INPUTS]);
+/* Steps each key applies since the last poll. Call once per simulation step */
+
+void inputPresented(input_state_t* input);
+/* Call right after the buffer swap */
+
+void printInputLatency(std::ostream& out, const input_state_t* input);
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+static double inputNow(const input_state_t* input)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - input->start).count();
+}
+
+void inputInit(input_state_t* input)
+{
+	for (int i = 0; i < NUM_INPUTS; i++) input->keys[i] = { false, 0, 0, 0 };
+	input->unpolled.clear();
+	input->unpresented.clear();
+	memset(&input->to_simulation, 0, sizeof(frame_histogram_t));
+	memset(&input->to_present, 0, sizeof(frame_histogram_t));
+	input->start = std::chrono::steady_clock::now();
+}
+
+void inputPress(input_state_t* input, input_t key)
+{
+	key_state_t* state = &input->keys[key];
+	if (state->down) return;
+	double now = inputNow(input);
+	state->down = true;
+	state->presses++;
+	state->down_since = now;
+	input->unpolled.push_back(now);
+}
+
+void inputRelease(input_state_t* input, input_t key)
+{
+	key_state_t* state = &input->keys[key];
+	if (!state->down) return;
+	double now = inputNow(input);
+	state->down = false;
+	state->held_ms += now - state->down_since;
+	input->unpolled.push_back(now);
+}
+
+void inputPoll(input_state_t* input, float steps[NUM_INPUTS])
+{
+	double now = inputNow(input);
+	for (int i = 0; i < NUM_INPUTS; i++) {
+		key_state_t* state = &input->keys[i];
+		double held_ms = state->held_ms;
+		if (state->down) {
+			held_ms += now - state->down_since;
+			state->down_since = now;
+		}
+		steps[i] = state->presses + held_ms * INPUT_REPEAT_RATE / 1000;
+		state->presses = 0;
+		state->held_ms = 0;
+	}
+
+	for (size_t i = 0; i < input->unpolled.size(); i++) {
+		frameHistogramAdd(&input->to_simulation, now - input->unpolled[i]);
+		input->unpresented.push_back(input->unpolled[i]);
+	}
+	input->unpolled.clear();
+}
+
+void inputPresented(input_state_t* input)
+{
+	if (input->unpresented.empty()) return;
+	double now = inputNow(input);
+	for (size_t i = 0; i < input->unpresented.size(); i++)
+		frameHistogramAdd(&input->to_present, now - input->unpresented[i]);
+	input->unpresented.clear();
+}
+
+void printInputLatency(std::ostream& out, const input_state_t* input)
+{
+	printFrameHistogram(out, "Input to simulation", &input->to_simulation, "inputs");
+	printFrameHistogram(out, "Input to present", &input->to_present, "inputs");
+}
+
+#endif
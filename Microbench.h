@@ -0,0 +1,94 @@
+#ifndef MICROBENCH
+#define MICROBENCH
+/*
+	Microbenchmarks.
+
+	Times small kernels of the game in isolation, away from the noise of whole
+	frames. A benchmark is a function running its kernel a given number of
+	times. The harness first doubles that number until one run lasts at least
+	MICROBENCH_MIN_MS (which also warms caches and branch predictors up), then
+	times MICROBENCH_REPETITIONS runs of that length and reports the median,
+	fastest and slowest time per iteration: the spread says how far the median
+	can be trusted.
+
+	Results the kernel computes must be passed to benchKeep() so the compiler
+	cannot drop the work that produced them.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#define MICROBENCH_MIN_MS 100
+#define MICROBENCH_REPETITIONS 7
+
+typedef struct {
+	std::string name;
+	std::function<void(long)> run;  // runs the kernel n times
+} microbench_t;
+
+typedef struct {
+	std::string name;
+	long iterations;                // per repetition
+	double median_ns, min_ns, max_ns;  // per iteration
+} microbench_result_t;
+
+template <typename T> inline void benchKeep(const T& value);
+/* Makes value look used, and whatever memory it points to read */
+
+microbench_result_t runMicrobench(const microbench_t* bench);
+
+void printMicrobenchResults(std::ostream& out, const std::vector<microbench_result_t>& results);
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+template <typename T> inline void benchKeep(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static double microbenchRun(const microbench_t* bench, long iterations)
+{
+	auto start = std::chrono::steady_clock::now();
+	bench->run(iterations);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+microbench_result_t runMicrobench(const microbench_t* bench)
+{
+	long iterations = 1;
+	while (microbenchRun(bench, iterations) < MICROBENCH_MIN_MS * 1e6 && iterations < (1L << 40))
+		iterations *= 2;
+
+	std::vector<double> ns;
+	for (int i = 0; i < MICROBENCH_REPETITIONS; i++)
+		ns.push_back(microbenchRun(bench, iterations) / iterations);
+	std::sort(ns.begin(), ns.end());
+
+	microbench_result_t result;
+	result.name = bench->name;
+	result.iterations = iterations;
+	result.median_ns = ns[ns.size() / 2];
+	result.min_ns = ns.front();
+	result.max_ns = ns.back();
+	return result;
+}
+
+void printMicrobenchResults(std::ostream& out, const std::vector<microbench_result_t>& results)
+{
+	out << std::left << std::setw(28) << "Benchmark" << std::right << std::setw(14) << "ns/iteration"
+	    << std::setw(12) << "min" << std::setw(12) << "max" << std::setw(14) << "iterations" << "\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const microbench_result_t* r = &results[i];
+		out << std::left << std::setw(28) << r->name << std::right << std::fixed << std::setprecision(2)
+		    << std::setw(14) << r->median_ns << std::setw(12) << r->min_ns << std::setw(12) << r->max_ns
+		    << std::setw(14) << r->iterations << "\n";
+	}
+	out.unsetf(std::ios::fixed);
+}
+
+#endif
@@ -0,0 +1,703 @@
+#ifndef NULLRENDERER
+#define NULLRENDERER
+/*
+	Backends without an OpenGL context.
+
+	null:      discards every call. Only the state the game reads back is kept
+	           (list and texture names, enabled capabilities, viewport), so the
+	           scene traversal runs exactly as with a real backend and can be
+	           timed on its own.
+	           Framebuffers are always complete. Buffer objects are plain
+	           memory, so what is written into them can be read back, and
+	           fences are always signaled. The vertices of each display list
+	           are counted as it is compiled, so calling it counts them again.
+	recording: like null, but also serializes every call as one line of text
+	           ("translatef 0 -1 0"). Each frame ends with a "swapBuffers" line.
+	           The stream is kept in memory and, if a file was given, appended
+	           to it at the end of every frame, so runs of two builds can be
+	           compared with diff.
+	counting:  like recording, but only counts the calls of each command, so
+	           a run can be summarized without formatting every call. It keeps
+	           the names and state handed out by the null backend, so both can
+	           take turns within one run.
+*/
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+
+#define NULL_MAX_ENABLED_CAPS 32
+
+bool useNullRenderer(bool keep_state = false);
+/* Switches to the backend that discards every call. Needs no GL context.
+   keep_state: go on with the names and state of the counting backend     */
+
+bool useRecordingRenderer(const char* path = NULL);
+/* Switches to the recording backend. path: file the command stream is written to,
+   NULL to keep it in memory only. Returns false if the file cannot be created    */
+
+const std::string& recordedCommands();
+/* Command stream recorded so far (only kept when no file was given) */
+
+unsigned long recordedCommandCount();
+/* Number of calls recorded since useRecordingRenderer() or useCountingRenderer() */
+
+bool useCountingRenderer();
+/* Switches to the counting backend and sets every count to zero */
+
+std::map<std::string, unsigned long> countedCommands();
+/* Calls of each command ("callList", "vertex3f"...) since useCountingRenderer() */
+
+unsigned long countedVertices();
+/* Vertices drawn since useCountingRenderer(): by vertex3f, drawTriangles and
+   drawVertexBuffer, directly or through display lists. GLUT shapes are left out */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+static struct {
+	GLuint next_list, next_texture, next_framebuffer, next_renderbuffer, next_buffer;
+	std::map<GLuint, std::vector<unsigned char> > buffers;
+	GLenum enabled[NULL_MAX_ENABLED_CAPS];
+	int num_enabled;
+	GLint viewport[4];
+	GLuint compiling;                                        // display list, 0 outside newList/endList
+	std::unordered_map<GLuint, unsigned long> list_vertices;
+	unsigned long vertices;                                  // drawn outside display lists
+
+	// Recording
+	FILE* file;
+	std::string commands;
+	unsigned long count;
+
+	// Counting
+	bool counting;
+	std::unordered_map<const char*, unsigned long> counts; // per format string
+} null_backend;
+
+/*** null ***/
+
+static void nullClearColor(GLfloat, GLfloat, GLfloat, GLfloat) {}
+static void nullClear(GLbitfield) {}
+static void nullClearRect(GLint, GLint, GLsizei, GLsizei, GLbitfield) {}
+static void nullViewport(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+	null_backend.viewport[0] = x; null_backend.viewport[1] = y;
+	null_backend.viewport[2] = w; null_backend.viewport[3] = h;
+}
+static void nullGetIntegerv(GLenum pname, GLint* params) { if (pname == GL_VIEWPORT) memcpy(params, null_backend.viewport, sizeof(null_backend.viewport)); }
+static void nullGetFloatv(GLenum, GLfloat* params)
+{
+	// Matrices are not tracked
+	memset(params, 0, 16 * sizeof(GLfloat));
+	params[0] = params[5] = params[10] = params[15] = 1;
+}
+static void nullSwapBuffers() {}
+static void nullMatrixMode(GLenum) {}
+static void nullLoadIdentity() {}
+static void nullPushMatrix() {}
+static void nullPopMatrix() {}
+static void nullTranslatef(GLfloat, GLfloat, GLfloat) {}
+static void nullRotatef(GLfloat, GLfloat, GLfloat, GLfloat) {}
+static void nullScalef(GLfloat, GLfloat, GLfloat) {}
+static void nullOrtho(GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble) {}
+static void nullPerspective(GLdouble, GLdouble, GLdouble, GLdouble) {}
+static void nullLookAt(GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble) {}
+static void nullBegin(GLenum) {}
+static void nullEnd() {}
+static void nullVertices(unsigned long n)
+{
+	if (null_backend.compiling) null_backend.list_vertices[null_backend.compiling] += n;
+	else null_backend.vertices += n;
+}
+static void nullVertex3f(GLfloat, GLfloat, GLfloat) { nullVertices(1); }
+static void nullNormal3f(GLfloat, GLfloat, GLfloat) {}
+static void nullTexCoord2f(GLfloat, GLfloat) {}
+static void nullColor3f(GLfloat, GLfloat, GLfloat) {}
+static void nullColor3fv(const GLfloat*) {}
+static void nullColor4f(GLfloat, GLfloat, GLfloat, GLfloat) {}
+static void nullDrawTriangles(const GLfloat*, const GLuint*, GLsizei count) { nullVertices(count); }
+static GLuint nullGenLists(GLsizei range)
+{
+	GLuint first = null_backend.next_list;
+	null_backend.next_list += range;
+	return first;
+}
+static void nullNewList(GLuint list, GLenum)
+{
+	null_backend.compiling = list;
+	null_backend.list_vertices[list] = 0;
+}
+static void nullEndList() { null_backend.compiling = 0; }
+static void nullCallList(GLuint list)
+{
+	auto it = null_backend.list_vertices.find(list);
+	if (it != null_backend.list_vertices.end()) nullVertices(it->second);
+}
+static void nullDeleteLists(GLuint list, GLsizei range)
+{
+	for (GLsizei i = 0; i < range; i++) null_backend.list_vertices.erase(list + i);
+}
+static void nullSolidSphere(GLdouble, GLint, GLint) {}
+static void nullSolidCone(GLdouble, GLdouble, GLint, GLint) {}
+static void nullTexturedCylinder(GLdouble, GLdouble, GLdouble, GLint, GLint) {}
+static void nullMaterialfv(GLenum, GLenum, const GLfloat*) {}
+static void nullMaterialf(GLenum, GLenum, GLfloat) {}
+static void nullLightfv(GLenum, GLenum, const GLfloat*) {}
+static void nullLightf(GLenum, GLenum, GLfloat) {}
+static void nullFogfv(GLenum, const GLfloat*) {}
+static void nullFogf(GLenum, GLfloat) {}
+static void nullGenTextures(GLsizei n, GLuint* textures)
+{
+	for (int i = 0; i < n; i++) textures[i] = null_backend.next_texture++;
+}
+static void nullBindTexture(GLenum, GLuint) {}
+static void nullGenFramebuffers(GLsizei n, GLuint* framebuffers)
+{
+	for (int i = 0; i < n; i++) framebuffers[i] = null_backend.next_framebuffer++;
+}
+static void nullBindFramebuffer(GLenum, GLuint) {}
+static void nullGenRenderbuffers(GLsizei n, GLuint* renderbuffers)
+{
+	for (int i = 0; i < n; i++) renderbuffers[i] = null_backend.next_renderbuffer++;
+}
+static void nullBindRenderbuffer(GLenum, GLuint) {}
+static void nullRenderbufferStorage(GLenum, GLenum, GLsizei, GLsizei) {}
+static void nullFramebufferRenderbuffer(GLenum, GLenum, GLenum, GLuint) {}
+static GLenum nullCheckFramebufferStatus(GLenum) { return GL_FRAMEBUFFER_COMPLETE; }
+static void nullBlitFramebuffer(GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLbitfield, GLenum) {}
+static void nullGenBuffers(GLsizei n, GLuint* buffers)
+{
+	for (int i = 0; i < n; i++) buffers[i] = null_backend.next_buffer++;
+}
+static void nullDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	for (int i = 0; i < n; i++) null_backend.buffers.erase(buffers[i]);
+}
+static GLboolean nullBufferStorage(GLuint buffer, GLsizeiptr size, GLbitfield)
+{
+	null_backend.buffers[buffer].assign(size, 0);
+	return GL_TRUE;
+}
+static void nullBufferData(GLuint buffer, GLsizeiptr size, const void* data, GLenum)
+{
+	std::vector<unsigned char>& storage = null_backend.buffers[buffer];
+	storage.resize(size); // orphaning keeps the memory, nothing reads it meanwhile
+	if (data) memcpy(storage.data(), data, size);
+}
+static void* nullMapBufferRange(GLuint buffer, GLintptr offset, GLsizeiptr length, GLbitfield)
+{
+	std::vector<unsigned char>& storage = null_backend.buffers[buffer];
+	return offset + length <= (GLintptr)storage.size() ? storage.data() + offset : NULL;
+}
+static void nullUnmapBuffer(GLuint) {}
+static GLsync nullFenceSync(GLenum, GLbitfield) { return (GLsync)&null_backend; }
+static GLenum nullClientWaitSync(GLsync, GLbitfield, GLuint64) { return GL_ALREADY_SIGNALED; }
+static void nullDeleteSync(GLsync) {}
+static void nullDrawVertexBuffer(GLenum, GLuint, GLintptr, GLsizei count) { nullVertices(count); }
+static void nullReadPixelsToBuffer(GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, GLuint, GLintptr) {}
+static void nullTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) {}
+static GLboolean nullCompressedTexImage2D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*) { return GL_TRUE; }
+static void nullTexParameteri(GLenum, GLenum, GLint) {}
+static void nullTexEnvi(GLenum, GLenum, GLint) {}
+static GLboolean nullIsEnabled(GLenum cap)
+{
+	for (int i = 0; i < null_backend.num_enabled; i++)
+		if (null_backend.enabled[i] == cap) return GL_TRUE;
+	return GL_FALSE;
+}
+static void nullEnable(GLenum cap)
+{
+	if (!nullIsEnabled(cap) && null_backend.num_enabled < NULL_MAX_ENABLED_CAPS)
+		null_backend.enabled[null_backend.num_enabled++] = cap;
+}
+static void nullDisable(GLenum cap)
+{
+	for (int i = 0; i < null_backend.num_enabled; i++)
+		if (null_backend.enabled[i] == cap)
+			null_backend.enabled[i] = null_backend.enabled[--null_backend.num_enabled];
+}
+static void nullBlendFunc(GLenum, GLenum) {}
+static void nullDepthMask(GLboolean) {}
+static void nullCullFace(GLenum) {}
+static void nullPolygonMode(GLenum, GLenum) {}
+static void nullPushAttrib(GLbitfield) {}
+static void nullPopAttrib() {}
+static void nullBitmapText(GLint, GLint, const char*, void*) {}
+static GLboolean nullGenTimestampQueries(GLsizei, GLuint*) { return GL_FALSE; } // no GPU to time
+static void nullQueryTimestamp(GLuint) {}
+static GLboolean nullTimestampResult(GLuint, GLuint64*) { return GL_FALSE; }
+
+static render_backend_t nullRenderer()
+{
+	render_backend_t r;
+	r.name = "null";
+	r.clearColor = nullClearColor;
+	r.clear = nullClear;
+	r.clearRect = nullClearRect;
+	r.viewport = nullViewport;
+	r.getIntegerv = nullGetIntegerv;
+	r.getFloatv = nullGetFloatv;
+	r.swapBuffers = nullSwapBuffers;
+	r.matrixMode = nullMatrixMode;
+	r.loadIdentity = nullLoadIdentity;
+	r.pushMatrix = nullPushMatrix;
+	r.popMatrix = nullPopMatrix;
+	r.translatef = nullTranslatef;
+	r.rotatef = nullRotatef;
+	r.scalef = nullScalef;
+	r.ortho = nullOrtho;
+	r.perspective = nullPerspective;
+	r.lookAt = nullLookAt;
+	r.begin = nullBegin;
+	r.end = nullEnd;
+	r.vertex3f = nullVertex3f;
+	r.normal3f = nullNormal3f;
+	r.texCoord2f = nullTexCoord2f;
+	r.color3f = nullColor3f;
+	r.color3fv = nullColor3fv;
+	r.color4f = nullColor4f;
+	r.drawTriangles = nullDrawTriangles;
+	r.genLists = nullGenLists;
+	r.newList = nullNewList;
+	r.endList = nullEndList;
+	r.callList = nullCallList;
+	r.deleteLists = nullDeleteLists;
+	r.solidSphere = nullSolidSphere;
+	r.solidCone = nullSolidCone;
+	r.texturedCylinder = nullTexturedCylinder;
+	r.materialfv = nullMaterialfv;
+	r.materialf = nullMaterialf;
+	r.lightfv = nullLightfv;
+	r.lightf = nullLightf;
+	r.fogfv = nullFogfv;
+	r.fogf = nullFogf;
+	r.genTextures = nullGenTextures;
+	r.bindTexture = nullBindTexture;
+	r.texImage2D = nullTexImage2D;
+	r.compressedTexImage2D = nullCompressedTexImage2D;
+	r.texParameteri = nullTexParameteri;
+	r.texEnvi = nullTexEnvi;
+	r.genFramebuffers = nullGenFramebuffers;
+	r.bindFramebuffer = nullBindFramebuffer;
+	r.genRenderbuffers = nullGenRenderbuffers;
+	r.bindRenderbuffer = nullBindRenderbuffer;
+	r.renderbufferStorage = nullRenderbufferStorage;
+	r.framebufferRenderbuffer = nullFramebufferRenderbuffer;
+	r.checkFramebufferStatus = nullCheckFramebufferStatus;
+	r.blitFramebuffer = nullBlitFramebuffer;
+	r.genBuffers = nullGenBuffers;
+	r.deleteBuffers = nullDeleteBuffers;
+	r.bufferStorage = nullBufferStorage;
+	r.bufferData = nullBufferData;
+	r.mapBufferRange = nullMapBufferRange;
+	r.unmapBuffer = nullUnmapBuffer;
+	r.fenceSync = nullFenceSync;
+	r.clientWaitSync = nullClientWaitSync;
+	r.deleteSync = nullDeleteSync;
+	r.drawVertexBuffer = nullDrawVertexBuffer;
+	r.readPixelsToBuffer = nullReadPixelsToBuffer;
+	r.enable = nullEnable;
+	r.disable = nullDisable;
+	r.isEnabled = nullIsEnabled;
+	r.blendFunc = nullBlendFunc;
+	r.depthMask = nullDepthMask;
+	r.cullFace = nullCullFace;
+	r.polygonMode = nullPolygonMode;
+	r.pushAttrib = nullPushAttrib;
+	r.popAttrib = nullPopAttrib;
+	r.bitmapText = nullBitmapText;
+	r.genTimestampQueries = nullGenTimestampQueries;
+	r.queryTimestamp = nullQueryTimestamp;
+	r.timestampResult = nullTimestampResult;
+	return r;
+}
+
+static void nullResetState()
+{
+	null_backend.next_list = 1;
+	null_backend.next_texture = 1;
+	null_backend.next_framebuffer = 1;
+	null_backend.next_renderbuffer = 1;
+	null_backend.next_buffer = 1;
+	null_backend.buffers.clear();
+	null_backend.num_enabled = 0;
+	null_backend.viewport[0] = null_backend.viewport[1] = 0;
+	null_backend.viewport[2] = null_backend.viewport[3] = 0;
+	null_backend.compiling = 0;
+	null_backend.list_vertices.clear();
+	null_backend.vertices = 0;
+}
+
+bool useNullRenderer(bool keep_state)
+{
+	static render_backend_t r = nullRenderer();
+	if (!keep_state) nullResetState();
+	renderer = &r;
+	return true;
+}
+
+/*** recording ***/
+
+static void record(const char* format, ...)
+{
+	if (null_backend.counting) {
+		null_backend.counts[format]++;
+		null_backend.count++;
+		return;
+	}
+
+	char line[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	null_backend.commands += line;
+	null_backend.commands += '\n';
+	null_backend.count++;
+}
+
+static void recordVector(const char* name, GLenum a, GLenum b, const GLfloat* v, int n)
+{
+	if (null_backend.counting) {
+		record(name);
+		return;
+	}
+
+	char line[256];
+	int length = snprintf(line, sizeof(line), "%s 0x%x 0x%x", name, a, b);
+	for (int i = 0; i < n; i++) length += snprintf(line + length, sizeof(line) - length, " %g", v[i]);
+	record("%s", line);
+}
+
+static void recClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { record("clearColor %g %g %g %g", r, g, b, a); }
+static void recClear(GLbitfield mask) { record("clear 0x%x", mask); }
+static void recClearRect(GLint x, GLint y, GLsizei w, GLsizei h, GLbitfield mask) { record("clearRect %d %d %d %d 0x%x", x, y, w, h, mask); }
+static void recViewport(GLint x, GLint y, GLsizei w, GLsizei h) { record("viewport %d %d %d %d", x, y, w, h); nullViewport(x, y, w, h); }
+static void recGetIntegerv(GLenum pname, GLint* params) { nullGetIntegerv(pname, params); }
+static void recGetFloatv(GLenum pname, GLfloat* params) { nullGetFloatv(pname, params); }
+static void recSwapBuffers()
+{
+	record("swapBuffers");
+	if (null_backend.file) {
+		fwrite(null_backend.commands.data(), 1, null_backend.commands.size(), null_backend.file);
+		fflush(null_backend.file);
+		null_backend.commands.clear();
+	}
+}
+static void recMatrixMode(GLenum mode) { record("matrixMode 0x%x", mode); }
+static void recLoadIdentity() { record("loadIdentity"); }
+static void recPushMatrix() { record("pushMatrix"); }
+static void recPopMatrix() { record("popMatrix"); }
+static void recTranslatef(GLfloat x, GLfloat y, GLfloat z) { record("translatef %g %g %g", x, y, z); }
+static void recRotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z) { record("rotatef %g %g %g %g", angle, x, y, z); }
+static void recScalef(GLfloat x, GLfloat y, GLfloat z) { record("scalef %g %g %g", x, y, z); }
+static void recOrtho(GLdouble l, GLdouble r, GLdouble b, GLdouble t, GLdouble n, GLdouble f) { record("ortho %g %g %g %g %g %g", l, r, b, t, n, f); }
+static void recPerspective(GLdouble fovy, GLdouble aspect, GLdouble n, GLdouble f) { record("perspective %g %g %g %g", fovy, aspect, n, f); }
+static void recLookAt(GLdouble ex, GLdouble ey, GLdouble ez, GLdouble cx, GLdouble cy, GLdouble cz, GLdouble ux, GLdouble uy, GLdouble uz)
+{
+	record("lookAt %g %g %g %g %g %g %g %g %g", ex, ey, ez, cx, cy, cz, ux, uy, uz);
+}
+static void recBegin(GLenum mode) { record("begin 0x%x", mode); }
+static void recEnd() { record("end"); }
+static void recVertex3f(GLfloat x, GLfloat y, GLfloat z) { record("vertex3f %g %g %g", x, y, z); nullVertices(1); }
+static void recNormal3f(GLfloat x, GLfloat y, GLfloat z) { record("normal3f %g %g %g", x, y, z); }
+static void recTexCoord2f(GLfloat s, GLfloat t) { record("texCoord2f %g %g", s, t); }
+static void recColor3f(GLfloat r, GLfloat g, GLfloat b) { record("color3f %g %g %g", r, g, b); }
+static void recColor3fv(const GLfloat* c) { record("color3f %g %g %g", c[0], c[1], c[2]); }
+static void recColor4f(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { record("color4f %g %g %g %g", r, g, b, a); }
+static void recDrawTriangles(const GLfloat* vertices, const GLuint* indices, GLsizei count)
+{
+	// The triangles are summarized by the FNV-1a hash of their vertices, in index order
+	unsigned int hash = 2166136261u;
+	if (!null_backend.counting) {
+		for (GLsizei i = 0; i < count; i++) {
+			const unsigned char* p = (const unsigned char*)(vertices + 8 * indices[i]);
+			for (size_t b = 0; b < 8 * sizeof(GLfloat); b++) hash = (hash ^ p[b]) * 16777619u;
+		}
+	}
+	record("drawTriangles %d %08x", count, hash);
+	nullVertices(count);
+}
+static GLuint recGenLists(GLsizei range)
+{
+	GLuint first = nullGenLists(range);
+	record("genLists %d = %u", range, first);
+	return first;
+}
+static void recNewList(GLuint list, GLenum mode) { record("newList %u 0x%x", list, mode); nullNewList(list, mode); }
+static void recEndList() { record("endList"); nullEndList(); }
+static void recCallList(GLuint list) { record("callList %u", list); nullCallList(list); }
+static void recDeleteLists(GLuint list, GLsizei range) { record("deleteLists %u %d", list, range); nullDeleteLists(list, range); }
+static void recSolidSphere(GLdouble radius, GLint slices, GLint stacks) { record("solidSphere %g %d %d", radius, slices, stacks); }
+static void recSolidCone(GLdouble base, GLdouble height, GLint slices, GLint stacks) { record("solidCone %g %g %d %d", base, height, slices, stacks); }
+static void recTexturedCylinder(GLdouble base, GLdouble top, GLdouble height, GLint slices, GLint stacks)
+{
+	record("texturedCylinder %g %g %g %d %d", base, top, height, slices, stacks);
+}
+static void recMaterialfv(GLenum face, GLenum pname, const GLfloat* params) { recordVector("materialfv", face, pname, params, pname == GL_SHININESS ? 1 : 4); }
+static void recMaterialf(GLenum face, GLenum pname, GLfloat param) { record("materialf 0x%x 0x%x %g", face, pname, param); }
+static void recLightfv(GLenum light, GLenum pname, const GLfloat* params)
+{
+	int n = 4;
+	if (pname == GL_SPOT_DIRECTION) n = 3;
+	else if (pname == GL_SPOT_CUTOFF || pname == GL_SPOT_EXPONENT) n = 1;
+	recordVector("lightfv", light, pname, params, n);
+}
+static void recLightf(GLenum light, GLenum pname, GLfloat param) { record("lightf 0x%x 0x%x %g", light, pname, param); }
+static void recFogfv(GLenum pname, const GLfloat* params) { recordVector("fogfv", GL_FOG, pname, params, pname == GL_FOG_COLOR ? 4 : 1); }
+static void recFogf(GLenum pname, GLfloat param) { record("fogf 0x%x %g", pname, param); }
+static void recGenTextures(GLsizei n, GLuint* textures)
+{
+	nullGenTextures(n, textures);
+	for (int i = 0; i < n; i++) record("genTextures = %u", textures[i]);
+}
+static void recBindTexture(GLenum target, GLuint texture) { record("bindTexture 0x%x %u", target, texture); }
+static void recTexImage2D(GLenum target, GLint level, GLint internal_format, GLsizei w, GLsizei h, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	// Texels are summarized by their FNV-1a hash
+	unsigned int hash = 2166136261u;
+	if (pixels) {
+		int bytes_per_pixel = (format == GL_RGB || format == GL_BGR) ? 3 : (format == GL_RED || format == GL_LUMINANCE) ? 1 : 4;
+		const unsigned char* p = (const unsigned char*)pixels;
+		for (long i = 0; i < (long)w * h * bytes_per_pixel; i++) hash = (hash ^ p[i]) * 16777619u;
+	}
+	record("texImage2D 0x%x %d 0x%x %d %d %d 0x%x 0x%x %08x", target, level, internal_format, w, h, border, format, type, hash);
+}
+static GLboolean recCompressedTexImage2D(GLenum target, GLint level, GLenum format, GLsizei w, GLsizei h, GLint border, GLsizei size, const void* data)
+{
+	unsigned int hash = 2166136261u;
+	const unsigned char* p = (const unsigned char*)data;
+	for (GLsizei i = 0; p && i < size; i++) hash = (hash ^ p[i]) * 16777619u;
+	record("compressedTexImage2D 0x%x %d 0x%x %d %d %d %d %08x", target, level, format, w, h, border, size, hash);
+	return nullCompressedTexImage2D(target, level, format, w, h, border, size, data);
+}
+static void recTexParameteri(GLenum target, GLenum pname, GLint param) { record("texParameteri 0x%x 0x%x 0x%x", target, pname, param); }
+static void recTexEnvi(GLenum target, GLenum pname, GLint param) { record("texEnvi 0x%x 0x%x 0x%x", target, pname, param); }
+static void recGenFramebuffers(GLsizei n, GLuint* framebuffers)
+{
+	nullGenFramebuffers(n, framebuffers);
+	for (int i = 0; i < n; i++) record("genFramebuffers = %u", framebuffers[i]);
+}
+static void recBindFramebuffer(GLenum target, GLuint framebuffer) { record("bindFramebuffer 0x%x %u", target, framebuffer); }
+static void recGenRenderbuffers(GLsizei n, GLuint* renderbuffers)
+{
+	nullGenRenderbuffers(n, renderbuffers);
+	for (int i = 0; i < n; i++) record("genRenderbuffers = %u", renderbuffers[i]);
+}
+static void recBindRenderbuffer(GLenum target, GLuint renderbuffer) { record("bindRenderbuffer 0x%x %u", target, renderbuffer); }
+static void recRenderbufferStorage(GLenum target, GLenum format, GLsizei w, GLsizei h) { record("renderbufferStorage 0x%x 0x%x %d %d", target, format, w, h); }
+static void recFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum rb_target, GLuint renderbuffer)
+{
+	record("framebufferRenderbuffer 0x%x 0x%x 0x%x %u", target, attachment, rb_target, renderbuffer);
+}
+static GLenum recCheckFramebufferStatus(GLenum target) { return nullCheckFramebufferStatus(target); }
+static void recBlitFramebuffer(GLint sx0, GLint sy0, GLint sx1, GLint sy1, GLint dx0, GLint dy0, GLint dx1, GLint dy1, GLbitfield mask, GLenum filter)
+{
+	record("blitFramebuffer %d %d %d %d %d %d %d %d 0x%x 0x%x", sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1, mask, filter);
+}
+static void recGenBuffers(GLsizei n, GLuint* buffers)
+{
+	nullGenBuffers(n, buffers);
+	for (int i = 0; i < n; i++) record("genBuffers = %u", buffers[i]);
+}
+static void recDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	for (int i = 0; i < n; i++) record("deleteBuffers %u", buffers[i]);
+	nullDeleteBuffers(n, buffers);
+}
+static GLboolean recBufferStorage(GLuint buffer, GLsizeiptr size, GLbitfield flags)
+{
+	record("bufferStorage %u %ld 0x%x", buffer, (long)size, flags);
+	return nullBufferStorage(buffer, size, flags);
+}
+static void recBufferData(GLuint buffer, GLsizeiptr size, const void* data, GLenum usage)
+{
+	record("bufferData %u %ld 0x%x", buffer, (long)size, usage);
+	nullBufferData(buffer, size, data, usage);
+}
+static void* recMapBufferRange(GLuint buffer, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+	record("mapBufferRange %u %ld %ld 0x%x", buffer, (long)offset, (long)length, access);
+	return nullMapBufferRange(buffer, offset, length, access);
+}
+static void recUnmapBuffer(GLuint buffer) { record("unmapBuffer %u", buffer); }
+static GLsync recFenceSync(GLenum condition, GLbitfield flags) { record("fenceSync"); return nullFenceSync(condition, flags); }
+static GLenum recClientWaitSync(GLsync fence, GLbitfield flags, GLuint64 timeout)
+{
+	record("clientWaitSync 0x%x", flags);
+	return nullClientWaitSync(fence, flags, timeout);
+}
+static void recDeleteSync(GLsync) { record("deleteSync"); }
+static void recDrawVertexBuffer(GLenum mode, GLuint buffer, GLintptr offset, GLsizei count)
+{
+	// Summarized like drawTriangles by the hash of the vertices read
+	unsigned int hash = 2166136261u;
+	std::vector<unsigned char>& storage = null_backend.buffers[buffer];
+	size_t end = offset + count * 8 * sizeof(GLfloat);
+	if (!null_backend.counting && end <= storage.size()) {
+		for (size_t b = offset; b < end; b++) hash = (hash ^ storage[b]) * 16777619u;
+	}
+	record("drawVertexBuffer 0x%x %u %ld %d %08x", mode, buffer, (long)offset, count, hash);
+	nullVertices(count);
+}
+static void recReadPixelsToBuffer(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, GLuint buffer, GLintptr offset)
+{
+	record("readPixelsToBuffer %d %d %d %d 0x%x 0x%x %u %ld", x, y, w, h, format, type, buffer, (long)offset);
+}
+static void recEnable(GLenum cap) { record("enable 0x%x", cap); nullEnable(cap); }
+static void recDisable(GLenum cap) { record("disable 0x%x", cap); nullDisable(cap); }
+static GLboolean recIsEnabled(GLenum cap) { return nullIsEnabled(cap); }
+static void recBlendFunc(GLenum s, GLenum d) { record("blendFunc 0x%x 0x%x", s, d); }
+static void recDepthMask(GLboolean flag) { record("depthMask %d", flag); }
+static void recCullFace(GLenum mode) { record("cullFace 0x%x", mode); }
+static void recPolygonMode(GLenum face, GLenum mode) { record("polygonMode 0x%x 0x%x", face, mode); }
+static void recPushAttrib(GLbitfield mask) { record("pushAttrib 0x%x", mask); }
+static void recPopAttrib() { record("popAttrib"); }
+static void recBitmapText(GLint x, GLint y, const char* text, void*) { record("bitmapText %d %d %s", x, y, text); }
+
+static render_backend_t recordingRenderer(const char* name)
+{
+	render_backend_t r;
+	r.name = name;
+	r.clearColor = recClearColor;
+	r.clear = recClear;
+	r.clearRect = recClearRect;
+	r.viewport = recViewport;
+	r.getIntegerv = recGetIntegerv;
+	r.getFloatv = recGetFloatv;
+	r.swapBuffers = recSwapBuffers;
+	r.matrixMode = recMatrixMode;
+	r.loadIdentity = recLoadIdentity;
+	r.pushMatrix = recPushMatrix;
+	r.popMatrix = recPopMatrix;
+	r.translatef = recTranslatef;
+	r.rotatef = recRotatef;
+	r.scalef = recScalef;
+	r.ortho = recOrtho;
+	r.perspective = recPerspective;
+	r.lookAt = recLookAt;
+	r.begin = recBegin;
+	r.end = recEnd;
+	r.vertex3f = recVertex3f;
+	r.normal3f = recNormal3f;
+	r.texCoord2f = recTexCoord2f;
+	r.color3f = recColor3f;
+	r.color3fv = recColor3fv;
+	r.color4f = recColor4f;
+	r.drawTriangles = recDrawTriangles;
+	r.genLists = recGenLists;
+	r.newList = recNewList;
+	r.endList = recEndList;
+	r.callList = recCallList;
+	r.deleteLists = recDeleteLists;
+	r.solidSphere = recSolidSphere;
+	r.solidCone = recSolidCone;
+	r.texturedCylinder = recTexturedCylinder;
+	r.materialfv = recMaterialfv;
+	r.materialf = recMaterialf;
+	r.lightfv = recLightfv;
+	r.lightf = recLightf;
+	r.fogfv = recFogfv;
+	r.fogf = recFogf;
+	r.genTextures = recGenTextures;
+	r.bindTexture = recBindTexture;
+	r.texImage2D = recTexImage2D;
+	r.compressedTexImage2D = recCompressedTexImage2D;
+	r.texParameteri = recTexParameteri;
+	r.texEnvi = recTexEnvi;
+	r.genFramebuffers = recGenFramebuffers;
+	r.bindFramebuffer = recBindFramebuffer;
+	r.genRenderbuffers = recGenRenderbuffers;
+	r.bindRenderbuffer = recBindRenderbuffer;
+	r.renderbufferStorage = recRenderbufferStorage;
+	r.framebufferRenderbuffer = recFramebufferRenderbuffer;
+	r.checkFramebufferStatus = recCheckFramebufferStatus;
+	r.blitFramebuffer = recBlitFramebuffer;
+	r.genBuffers = recGenBuffers;
+	r.deleteBuffers = recDeleteBuffers;
+	r.bufferStorage = recBufferStorage;
+	r.bufferData = recBufferData;
+	r.mapBufferRange = recMapBufferRange;
+	r.unmapBuffer = recUnmapBuffer;
+	r.fenceSync = recFenceSync;
+	r.clientWaitSync = recClientWaitSync;
+	r.deleteSync = recDeleteSync;
+	r.drawVertexBuffer = recDrawVertexBuffer;
+	r.readPixelsToBuffer = recReadPixelsToBuffer;
+	r.enable = recEnable;
+	r.disable = recDisable;
+	r.isEnabled = recIsEnabled;
+	r.blendFunc = recBlendFunc;
+	r.depthMask = recDepthMask;
+	r.cullFace = recCullFace;
+	r.polygonMode = recPolygonMode;
+	r.pushAttrib = recPushAttrib;
+	r.popAttrib = recPopAttrib;
+	r.bitmapText = recBitmapText;
+	r.genTimestampQueries = nullGenTimestampQueries;
+	r.queryTimestamp = nullQueryTimestamp;
+	r.timestampResult = nullTimestampResult;
+	return r;
+}
+
+bool useRecordingRenderer(const char* path)
+{
+	static render_backend_t r = recordingRenderer("recording");
+	nullResetState();
+	null_backend.commands.clear();
+	null_backend.count = 0;
+	null_backend.counting = false;
+	null_backend.file = NULL;
+	if (path) {
+		null_backend.file = fopen(path, "w");
+		if (null_backend.file == NULL) {
+			std::cerr << "Cannot create " << path << std::endl;
+			return false;
+		}
+	}
+	renderer = &r;
+	return true;
+}
+
+const std::string& recordedCommands()
+{
+	return null_backend.commands;
+}
+
+unsigned long recordedCommandCount()
+{
+	return null_backend.count;
+}
+
+bool useCountingRenderer()
+{
+	static render_backend_t r = recordingRenderer("counting");
+	null_backend.count = 0;
+	null_backend.counts.clear();
+	null_backend.vertices = 0;
+	null_backend.counting = true;
+	null_backend.file = NULL;
+	renderer = &r;
+	return true;
+}
+
+std::map<std::string, unsigned long> countedCommands()
+{
+	// The command is the first word of the format
+	std::map<std::string, unsigned long> commands;
+	for (auto it = null_backend.counts.begin(); it != null_backend.counts.end(); ++it) {
+		std::string format = it->first;
+		commands[format.substr(0, format.find(' '))] += it->second;
+	}
+	return commands;
+}
+
+unsigned long countedVertices()
+{
+	return null_backend.vertices;
+}
+#endif
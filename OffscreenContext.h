@@ -0,0 +1,57 @@
+#ifndef OFFSCREENCONTEXT
+#define OFFSCREENCONTEXT
+/*
+	Offscreen OpenGL context.
+
+	A context without window, default framebuffer or display server, for
+	rendering into framebuffer objects on machines without a display: EGL on
+	Mesa's surfaceless platform, which runs on the GPU through its render node
+	or on the CPU with llvmpipe. GLUT is not initialized, so nothing that needs
+	it (windows, swaps, bitmap fonts) may be called with this context.
+*/
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstddef>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+bool createOffscreenContext(bool core_profile);
+/* Makes current an OpenGL compatibility context, or a 3.3 core profile one
+   if core_profile. Returns false if EGL cannot provide it                 */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+bool createOffscreenContext(bool core_profile)
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) return false;
+	if (!eglBindAPI(EGL_OPENGL_API)) return false;
+
+	// Any config: nothing is drawn to a surface
+	EGLint config_attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint configs = 0;
+	if (!eglChooseConfig(display, config_attributes, &config, 1, &configs)) configs = 0;
+
+	EGLint core_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE
+	};
+	EGLint compatibility_attributes[] = {
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, configs ? config : (EGLConfig)0, EGL_NO_CONTEXT,
+	                                      core_profile ? core_attributes : compatibility_attributes);
+	if (context == EGL_NO_CONTEXT) return false;
+	return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef PASSTIMER
+#define PASSTIMER
+/*
+	Pass timing.
+
+	The frame is split into passes by marks: a mark starts a pass, which lasts
+	until the next mark or the end of the frame, and a pass may be marked more
+	than once per frame (once per view, for instance), adding up. Each mark
+	reads the CPU clock and, where timer queries are available, puts a GPU
+	timestamp query in the command stream, so both clocks measure the same
+	stretches of work: the CPU the time spent issuing a pass, the GPU the time
+	spent executing it.
+
+	Queries are read back PASS_TIMER_FRAMES frames later, from a ring of one
+	set of queries per frame, and only once the GPU has reached them: the
+	results of a frame it is still behind on are dropped instead of waited
+	for, so timing never stalls the pipeline. Without timer queries (or with
+	the null backends) only CPU times are kept.
+
+	Averages are published every PASS_TIMER_WINDOW frames measured, for the
+	HUD, and totals are kept for the whole run.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include "Renderer.h"
+
+#define PASS_TIMER_FRAMES 4     // frames of queries in flight
+#define PASS_TIMER_MARKS 256    // per frame
+#define PASS_TIMER_WINDOW 60    // frames averaged for display
+
+typedef enum {
+	PASS_OTHER, PASS_ROAD, PASS_TUNNELS, PASS_PROPS, PASS_SKYLINE, PASS_GROUND, PASS_RAIN, PASS_HUD,
+	NUM_PASSES
+} pass_t;
+
+static const char* PASS_NAMES[NUM_PASSES] = { "other", "road", "tunnels", "props", "skyline", "ground", "rain", "hud" };
+
+typedef struct {
+	GLuint queries[PASS_TIMER_MARKS + 1];  // one per mark and one at the end of the frame
+	pass_t passes[PASS_TIMER_MARKS];
+	int marks;
+	bool pending;                          // queries not read yet
+} pass_frame_t;
+
+typedef struct {
+	bool gpu;                              // timer queries available
+	pass_frame_t frames[PASS_TIMER_FRAMES];
+	int frame;                             // slot of the frame being marked
+	bool marking;                          // between passTimerBeginFrame and passTimerEndFrame
+	std::chrono::steady_clock::time_point last_mark;
+	pass_t current;
+
+	// Sums of the frames measured since the last window, and of the whole run
+	double cpu_sum[NUM_PASSES], gpu_sum[NUM_PASSES];
+	int cpu_frames, gpu_frames;
+	double cpu_total[NUM_PASSES], gpu_total[NUM_PASSES];
+	long cpu_total_frames, gpu_total_frames;
+	long dropped;                          // frames whose queries were not ready in time
+
+	// Averages of the last window, ms per frame
+	double cpu_ms[NUM_PASSES], gpu_ms[NUM_PASSES];
+	double gpu_frame_ms;                   // GPU time of the latest frame read back, 0 if none yet
+} pass_timer_t;
+
+void passTimerInit(pass_timer_t* timer);
+/* Creates the queries with the current renderer. GPU times are left out
+   if it has no timer queries                                           */
+
+void passTimerBeginFrame(pass_timer_t* timer);
+/* Collects the oldest frame of queries and starts marking a new frame in PASS_OTHER */
+
+void passTimerMark(pass_timer_t* timer, pass_t pass);
+/* Ends the current pass and starts pass. Ignored outside a frame */
+
+void passTimerEndFrame(pass_timer_t* timer);
+/* Ends the current pass. Call before the buffer swap */
+
+void printPassTimes(std::ostream& out, const pass_timer_t* timer);
+/* Mean CPU and GPU ms per frame of each pass over the whole run */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+void passTimerInit(pass_timer_t* timer)
+{
+	memset(timer->frames, 0, sizeof(timer->frames));
+	timer->gpu = true;
+	for (int i = 0; i < PASS_TIMER_FRAMES && timer->gpu; i++)
+		timer->gpu = renderer->genTimestampQueries(PASS_TIMER_MARKS + 1, timer->frames[i].queries);
+	timer->frame = 0;
+	timer->marking = false;
+	timer->current = PASS_OTHER;
+	for (int p = 0; p < NUM_PASSES; p++) {
+		timer->cpu_sum[p] = timer->gpu_sum[p] = 0;
+		timer->cpu_total[p] = timer->gpu_total[p] = 0;
+		timer->cpu_ms[p] = timer->gpu_ms[p] = 0;
+	}
+	timer->gpu_frame_ms = 0;
+	timer->cpu_frames = timer->gpu_frames = 0;
+	timer->cpu_total_frames = timer->gpu_total_frames = 0;
+	timer->dropped = 0;
+}
+
+// Reads the queries of a frame if the GPU is done with them
+static void passTimerCollect(pass_timer_t* timer, pass_frame_t* frame)
+{
+	frame->pending = false;
+	GLuint64 end;
+	if (!renderer->timestampResult(frame->queries[frame->marks], &end)) {
+		timer->dropped++;
+		return;
+	}
+	GLuint64 start;
+	renderer->timestampResult(frame->queries[0], &start);
+	timer->gpu_frame_ms = (end - start) / 1e6;
+	for (int i = 0; i < frame->marks; i++) {
+		GLuint64 next = end;
+		if (i + 1 < frame->marks) renderer->timestampResult(frame->queries[i + 1], &next);
+		double ms = (next - start) / 1e6;
+		timer->gpu_sum[frame->passes[i]] += ms;
+		timer->gpu_total[frame->passes[i]] += ms;
+		start = next;
+	}
+	timer->gpu_total_frames++;
+	if (++timer->gpu_frames == PASS_TIMER_WINDOW) {
+		for (int p = 0; p < NUM_PASSES; p++) {
+			timer->gpu_ms[p] = timer->gpu_sum[p] / timer->gpu_frames;
+			timer->gpu_sum[p] = 0;
+		}
+		timer->gpu_frames = 0;
+	}
+}
+
+void passTimerBeginFrame(pass_timer_t* timer)
+{
+	timer->frame = (timer->frame + 1) % PASS_TIMER_FRAMES;
+	pass_frame_t* frame = &timer->frames[timer->frame];
+	if (frame->pending) passTimerCollect(timer, frame);
+	frame->marks = 0;
+	timer->marking = true;
+	timer->last_mark = std::chrono::steady_clock::now();
+	timer->current = PASS_OTHER;
+	passTimerMark(timer, PASS_OTHER);
+}
+
+void passTimerMark(pass_timer_t* timer, pass_t pass)
+{
+	if (!timer->marking) return;
+	auto now = std::chrono::steady_clock::now();
+	double ms = std::chrono::duration<double, std::milli>(now - timer->last_mark).count();
+	timer->cpu_sum[timer->current] += ms;
+	timer->cpu_total[timer->current] += ms;
+	timer->last_mark = now;
+	timer->current = pass;
+
+	pass_frame_t* frame = &timer->frames[timer->frame];
+	if (!timer->gpu || frame->marks == PASS_TIMER_MARKS) return;
+	if (frame->marks > 0 && frame->passes[frame->marks - 1] == pass) return; // still the same pass
+	renderer->queryTimestamp(frame->queries[frame->marks]);
+	frame->passes[frame->marks++] = pass;
+}
+
+void passTimerEndFrame(pass_timer_t* timer)
+{
+	if (!timer->marking) return;
+	passTimerMark(timer, PASS_OTHER);
+	timer->marking = false;
+	pass_frame_t* frame = &timer->frames[timer->frame];
+	if (timer->gpu) {
+		renderer->queryTimestamp(frame->queries[frame->marks]);
+		frame->pending = true;
+	}
+
+	timer->cpu_total_frames++;
+	if (++timer->cpu_frames == PASS_TIMER_WINDOW) {
+		for (int p = 0; p < NUM_PASSES; p++) {
+			timer->cpu_ms[p] = timer->cpu_sum[p] / timer->cpu_frames;
+			timer->cpu_sum[p] = 0;
+		}
+		timer->cpu_frames = 0;
+	}
+}
+
+void printPassTimes(std::ostream& out, const pass_timer_t* timer)
+{
+	if (timer->cpu_total_frames == 0) return;
+	out << "Passes, ms per frame (CPU / GPU";
+	if (!timer->gpu) out << " unavailable";
+	else out << ", " << timer->gpu_total_frames << " frames timed, " << timer->dropped << " not ready";
+	out << "):" << "\n";
+	for (int p = 0; p < NUM_PASSES; p++) {
+		out << std::setw(10) << PASS_NAMES[p] << " " << std::fixed << std::setprecision(3)
+		    << std::setw(8) << timer->cpu_total[p] / timer->cpu_total_frames;
+		if (timer->gpu && timer->gpu_total_frames > 0)
+			out << " / " << std::setw(8) << timer->gpu_total[p] / timer->gpu_total_frames;
+		out << "\n";
+	}
+	out.unsetf(std::ios::fixed);
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef PROPPOOL
+#define PROPPOOL
+/*
+	Pool of roadside props.
+
+	Every prop of the resident stretch of road (a streetlamp, with or without
+	a sign) is a row of a structure of arrays: one array per component, all of
+	them packed in [0, count), so a pass over the props reads one contiguous
+	array per component it needs and nothing else. Props are added as the
+	chunks holding them are uploaded and removed as those chunks are replaced.
+
+	A removal moves the last prop into the hole, which keeps the arrays packed
+	but moves props around, so props are known from outside by handles that
+	never change while the prop lives: handle_row[handle] is its row and
+	row_handle[row] the handle of a row. Handles of removed props go to a free
+	list and are given to the next props added.
+
+	Z is absolute, so the floating origin never touches the pool.
+*/
+
+#include <vector>
+
+typedef struct {
+	int capacity, count;
+
+	// Components, one row per prop
+	std::vector<unsigned char> type;      // of the caller
+	std::vector<double> z;                // absolute
+	std::vector<float> x;
+	std::vector<signed char> side;        // -1 left of the road, 1 right, 0 over it
+	std::vector<short> material;          // texture variant, -1 if none
+	std::vector<unsigned char> lod;       // prop_lod_t of the last pass over the pool
+	std::vector<short> light;             // light of the frame, -1 if unlit
+
+	std::vector<int> row_handle, handle_row;
+	std::vector<int> free_handles;
+} prop_pool_t;
+
+typedef enum { PROP_CULLED, PROP_IN_RANGE, PROP_LIT } prop_lod_t;
+
+void propPoolInit(prop_pool_t* pool, int capacity);
+/* Empty pool for at most capacity props */
+
+void propPoolClear(prop_pool_t* pool);
+/* Removes every prop */
+
+int propAdd(prop_pool_t* pool, int type, double z, float x, int side, int material);
+/* Adds a culled, unlit prop. Returns its handle, -1 if the pool is full */
+
+void propRemove(prop_pool_t* pool, int handle);
+/* Removes the prop, moving the last one into its row */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+void propPoolInit(prop_pool_t* pool, int capacity)
+{
+	pool->capacity = capacity;
+	pool->type.resize(capacity);
+	pool->z.resize(capacity);
+	pool->x.resize(capacity);
+	pool->side.resize(capacity);
+	pool->material.resize(capacity);
+	pool->lod.resize(capacity);
+	pool->light.resize(capacity);
+	pool->row_handle.resize(capacity);
+	pool->handle_row.resize(capacity);
+	propPoolClear(pool);
+}
+
+void propPoolClear(prop_pool_t* pool)
+{
+	pool->count = 0;
+	pool->free_handles.clear();
+	for (int handle = pool->capacity - 1; handle >= 0; handle--) // lowest handles first
+		pool->free_handles.push_back(handle);
+}
+
+int propAdd(prop_pool_t* pool, int type, double z, float x, int side, int material)
+{
+	if (pool->free_handles.empty()) return -1;
+	int handle = pool->free_handles.back();
+	pool->free_handles.pop_back();
+
+	int row = pool->count++;
+	pool->type[row] = (unsigned char)type;
+	pool->z[row] = z;
+	pool->x[row] = x;
+	pool->side[row] = (signed char)side;
+	pool->material[row] = (short)material;
+	pool->lod[row] = PROP_CULLED;
+	pool->light[row] = -1;
+	pool->row_handle[row] = handle;
+	pool->handle_row[handle] = row;
+	return handle;
+}
+
+void propRemove(prop_pool_t* pool, int handle)
+{
+	int row = pool->handle_row[handle];
+	int last = --pool->count;
+	if (row != last) {
+		pool->type[row] = pool->type[last];
+		pool->z[row] = pool->z[last];
+		pool->x[row] = pool->x[last];
+		pool->side[row] = pool->side[last];
+		pool->material[row] = pool->material[last];
+		pool->lod[row] = pool->lod[last];
+		pool->light[row] = pool->light[last];
+		pool->row_handle[row] = pool->row_handle[last];
+		pool->handle_row[pool->row_handle[row]] = row;
+	}
+	pool->free_handles.push_back(handle);
+}
+
+#endif
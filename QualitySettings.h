@@ -0,0 +1,153 @@
+#ifndef QUALITYSETTINGS
+#define QUALITYSETTINGS
+/*
+	Quality settings.
+
+	The settings that trade image quality for frame time are grouped in tiers,
+	from the cheapest to the most detailed. "high" holds the values the game
+	always used.
+
+	The governor collects the frame times of QUALITY_WINDOW_FRAMES frames and
+	then decides on the percentiles of that window: it lowers the tier at once
+	when the 95th percentile goes over the budget, and raises it when the 99th
+	percentile stayed under QUALITY_RAISE_LOAD of the budget for several windows
+	in a row. Every time a tier turns out to be too expensive, the number of calm
+	windows needed to try it again doubles, so a machine that can almost but not
+	quite sustain a tier stops bouncing between the two and settles below it.
+*/
+
+#include <cstring>
+#include "FramePacing.h"
+
+#define QUALITY_WINDOW_FRAMES 120
+#define QUALITY_LOWER_LOAD 1.0      // share of the budget the 95th percentile may use
+#define QUALITY_RAISE_LOAD 0.5      // share of the budget the 99th percentile must stay under
+#define QUALITY_RAISE_WINDOWS 3     // calm windows before the first try of a higher tier
+#define QUALITY_MAX_BACKOFF 8       // doublings of QUALITY_RAISE_WINDOWS
+
+typedef struct {
+	const char* name;
+	int render_distance;            // meters of road drawn ahead
+	int quad_density;               // subdivisions of each meter of road near the vehicle
+	int high_detail_view_distance;  // meters of road drawn with quad_density subdivisions
+	int num_raindrops;
+	int z_far;                      // far clipping plane, beyond the render distance
+	int tree_rows;                  // on each side of the road
+	int streetlamps;                // lit at once by fixed function lighting
+} quality_tier_t;
+
+static const quality_tier_t QUALITY_TIERS[] = {
+	{ "low",     80, 2, 20,  750, 120, 1, 2 },
+	{ "medium", 110, 3, 35, 1500, 160, 2, 3 },
+	{ "high",   150, 4, 50, 3000, 200, 3, 4 },
+	{ "ultra",  200, 8, 80, 6000, 250, 4, 6 },
+};
+#define NUM_QUALITY_TIERS ((int)(sizeof(QUALITY_TIERS) / sizeof(QUALITY_TIERS[0])))
+#define DEFAULT_QUALITY_TIER 2
+#define MAX_RENDER_DISTANCE 200  // of every tier, sizes the chunk slots
+#define MAX_RAINDROPS 6000       // of every tier
+#define MAX_TREE_ROWS 16         // trees further out would leave the ground
+#define MAX_FIXED_STREETLAMPS 6  // GL_LIGHT2 to GL_LIGHT7
+
+typedef struct {
+	int tier;
+	bool automatic;                 // tier chosen by the governor
+	frame_histogram_t window;
+	int calm_windows;
+	int backoff[NUM_QUALITY_TIERS]; // times each tier had to be left
+} quality_governor_t;
+
+int qualityTierByName(const char* name);
+/* Index of the tier called name, -1 if there is none */
+
+int* qualitySetting(quality_tier_t* tier, const char* name);
+/* Field of tier called name ("render_distance"...), NULL if there is none */
+
+bool clampQuality(quality_tier_t* tier);
+/* Brings every setting within what the game supports. Returns false if any was out of range */
+
+void qualityGovernorInit(quality_governor_t* governor, int tier, bool automatic);
+
+bool updateQualityGovernor(quality_governor_t* governor, double frame_ms, double budget_ms);
+/* Records the work time of the last frame, without the buffer swap. Returns
+   true if the tier changed                                              */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+int qualityTierByName(const char* name)
+{
+	for (int i = 0; i < NUM_QUALITY_TIERS; i++)
+		if (strcmp(QUALITY_TIERS[i].name, name) == 0) return i;
+	return -1;
+}
+
+int* qualitySetting(quality_tier_t* tier, const char* name)
+{
+	if (strcmp(name, "render_distance") == 0) return &tier->render_distance;
+	if (strcmp(name, "quad_density") == 0) return &tier->quad_density;
+	if (strcmp(name, "high_detail_view_distance") == 0) return &tier->high_detail_view_distance;
+	if (strcmp(name, "raindrops") == 0) return &tier->num_raindrops;
+	if (strcmp(name, "z_far") == 0) return &tier->z_far;
+	if (strcmp(name, "tree_rows") == 0) return &tier->tree_rows;
+	if (strcmp(name, "streetlamps") == 0) return &tier->streetlamps;
+	return NULL;
+}
+
+static bool clampSetting(int* value, int min, int max)
+{
+	if (*value < min) { *value = min; return false; }
+	if (*value > max) { *value = max; return false; }
+	return true;
+}
+
+bool clampQuality(quality_tier_t* tier)
+{
+	bool valid = clampSetting(&tier->render_distance, 1, MAX_RENDER_DISTANCE);
+	valid &= clampSetting(&tier->quad_density, 1, 64);
+	valid &= clampSetting(&tier->high_detail_view_distance, 0, MAX_RENDER_DISTANCE);
+	valid &= clampSetting(&tier->num_raindrops, 0, MAX_RAINDROPS);
+	valid &= clampSetting(&tier->z_far, 2, 10000);
+	valid &= clampSetting(&tier->tree_rows, 0, MAX_TREE_ROWS);
+	valid &= clampSetting(&tier->streetlamps, 0, MAX_FIXED_STREETLAMPS);
+	return valid;
+}
+
+void qualityGovernorInit(quality_governor_t* governor, int tier, bool automatic)
+{
+	memset(governor, 0, sizeof(quality_governor_t));
+	governor->tier = tier;
+	governor->automatic = automatic;
+}
+
+bool updateQualityGovernor(quality_governor_t* governor, double frame_ms, double budget_ms)
+{
+	if (!governor->automatic) return false;
+
+	frameHistogramAdd(&governor->window, frame_ms);
+	if (governor->window.frames < QUALITY_WINDOW_FRAMES) return false;
+
+	double p95 = frameHistogramPercentile(&governor->window, 95);
+	double p99 = frameHistogramPercentile(&governor->window, 99);
+	memset(&governor->window, 0, sizeof(frame_histogram_t));
+
+	if (p95 > QUALITY_LOWER_LOAD * budget_ms) {
+		governor->calm_windows = 0;
+		if (governor->tier == 0) return false;
+		if (governor->backoff[governor->tier] < QUALITY_MAX_BACKOFF) governor->backoff[governor->tier]++;
+		governor->tier--;
+		return true;
+	}
+
+	if (p99 < QUALITY_RAISE_LOAD * budget_ms) governor->calm_windows++;
+	else governor->calm_windows = 0;
+
+	int next = governor->tier + 1;
+	if (next < NUM_QUALITY_TIERS && governor->calm_windows >= QUALITY_RAISE_WINDOWS << governor->backoff[next]) {
+		governor->calm_windows = 0;
+		governor->tier = next;
+		return true;
+	}
+	return false;
+}
+
+#endif
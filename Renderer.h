@@ -0,0 +1,404 @@
+#ifndef RENDERER
+#define RENDERER
+/*
+	Rendering backends.
+
+	Every draw and state call of the game and of Utilidades.h goes through the
+	function table pointed to by "renderer" instead of calling GL directly. The
+	entries mirror the fixed function calls they replace (glPushMatrix becomes
+	renderer->pushMatrix, gluLookAt becomes renderer->lookAt...), so a backend
+	only has to reproduce the subset of OpenGL 1.x the game uses.
+
+	legacy:    forwards every call to the fixed function pipeline (default).
+	core:      OpenGL 3.3 core profile, see CoreRenderer.h.
+	null:      discards every call, no GL context needed, see NullRenderer.h.
+	recording: serializes every call to memory or a file, see NullRenderer.h.
+	counting:  counts the calls of each command, see NullRenderer.h.
+*/
+
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <GL/freeglut.h>
+#include <GL/glext.h>
+
+typedef struct {
+	const char* name;
+
+	// Frame
+	void (*clearColor)(GLfloat, GLfloat, GLfloat, GLfloat);
+	void (*clear)(GLbitfield);
+	void (*clearRect)(GLint, GLint, GLsizei, GLsizei, GLbitfield); // clear of a rectangle only (scissor test)
+	void (*viewport)(GLint, GLint, GLsizei, GLsizei);
+	void (*getIntegerv)(GLenum, GLint*);         // GL_VIEWPORT
+	void (*getFloatv)(GLenum, GLfloat*);         // GL_MODELVIEW_MATRIX, GL_PROJECTION_MATRIX
+	void (*swapBuffers)(void);
+
+	// Matrices
+	void (*matrixMode)(GLenum);
+	void (*loadIdentity)(void);
+	void (*pushMatrix)(void);
+	void (*popMatrix)(void);
+	void (*translatef)(GLfloat, GLfloat, GLfloat);
+	void (*rotatef)(GLfloat, GLfloat, GLfloat, GLfloat);
+	void (*scalef)(GLfloat, GLfloat, GLfloat);
+	void (*ortho)(GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble);
+	void (*perspective)(GLdouble, GLdouble, GLdouble, GLdouble);
+	void (*lookAt)(GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble);
+
+	// Immediate geometry
+	void (*begin)(GLenum);
+	void (*end)(void);
+	void (*vertex3f)(GLfloat, GLfloat, GLfloat);
+	void (*normal3f)(GLfloat, GLfloat, GLfloat);
+	void (*texCoord2f)(GLfloat, GLfloat);
+	void (*color3f)(GLfloat, GLfloat, GLfloat);
+	void (*color3fv)(const GLfloat*);
+	void (*color4f)(GLfloat, GLfloat, GLfloat, GLfloat);
+
+	// Batched geometry: indexed triangles over interleaved vertices of 8 floats
+	// (position, normal, texture coordinates), see Tessellator.h
+	void (*drawTriangles)(const GLfloat*, const GLuint*, GLsizei);
+
+	// Retained geometry
+	GLuint (*genLists)(GLsizei);
+	void (*newList)(GLuint, GLenum);
+	void (*endList)(void);
+	void (*callList)(GLuint);
+	void (*deleteLists)(GLuint, GLsizei);
+	void (*solidSphere)(GLdouble, GLint, GLint);
+	void (*solidCone)(GLdouble, GLdouble, GLint, GLint);
+	void (*texturedCylinder)(GLdouble, GLdouble, GLdouble, GLint, GLint); // gluCylinder with texture coordinates
+
+	// Materials, lights and fog
+	void (*materialfv)(GLenum, GLenum, const GLfloat*);
+	void (*materialf)(GLenum, GLenum, GLfloat);
+	void (*lightfv)(GLenum, GLenum, const GLfloat*);
+	void (*lightf)(GLenum, GLenum, GLfloat);
+	void (*fogfv)(GLenum, const GLfloat*);
+	void (*fogf)(GLenum, GLfloat);
+
+	// Textures
+	void (*genTextures)(GLsizei, GLuint*);
+	void (*bindTexture)(GLenum, GLuint);
+	void (*texImage2D)(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*);
+	// GL_FALSE without EXT_texture_compression_s3tc, see TextureCompression.h
+	GLboolean (*compressedTexImage2D)(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const void*);
+	void (*texParameteri)(GLenum, GLenum, GLint);
+	void (*texEnvi)(GLenum, GLenum, GLint);
+
+	// Offscreen render targets (framebuffer objects, OpenGL 3.0)
+	void (*genFramebuffers)(GLsizei, GLuint*);
+	void (*bindFramebuffer)(GLenum, GLuint);
+	void (*genRenderbuffers)(GLsizei, GLuint*);
+	void (*bindRenderbuffer)(GLenum, GLuint);
+	void (*renderbufferStorage)(GLenum, GLenum, GLsizei, GLsizei);
+	void (*framebufferRenderbuffer)(GLenum, GLenum, GLenum, GLuint);
+	GLenum (*checkFramebufferStatus)(GLenum);
+	void (*blitFramebuffer)(GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLint, GLbitfield, GLenum);
+
+	// Buffer objects and fences (OpenGL 3.2), see StreamBuffer.h. Buffers are
+	// passed by name, nothing is left bound to GL_ARRAY_BUFFER
+	void (*genBuffers)(GLsizei, GLuint*);
+	void (*deleteBuffers)(GLsizei, const GLuint*);
+	GLboolean (*bufferStorage)(GLuint, GLsizeiptr, GLbitfield); // GL_FALSE without OpenGL 4.4 or ARB_buffer_storage
+	void (*bufferData)(GLuint, GLsizeiptr, const void*, GLenum);
+	void* (*mapBufferRange)(GLuint, GLintptr, GLsizeiptr, GLbitfield);
+	void (*unmapBuffer)(GLuint);
+	GLsync (*fenceSync)(GLenum, GLbitfield);
+	GLenum (*clientWaitSync)(GLsync, GLbitfield, GLuint64);
+	void (*deleteSync)(GLsync);
+	// Vertices of 8 floats as drawTriangles from a buffer: mode, buffer, byte offset, count
+	void (*drawVertexBuffer)(GLenum, GLuint, GLintptr, GLsizei);
+	// glReadPixels of the framebuffer bound for reading into a buffer, returns at
+	// once: x, y, width, height, format, type, buffer, byte offset
+	void (*readPixelsToBuffer)(GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, GLuint, GLintptr);
+
+	// State
+	void (*enable)(GLenum);
+	void (*disable)(GLenum);
+	GLboolean (*isEnabled)(GLenum);
+	void (*blendFunc)(GLenum, GLenum);
+	void (*depthMask)(GLboolean);
+	void (*cullFace)(GLenum);
+	void (*polygonMode)(GLenum, GLenum);
+	void (*pushAttrib)(GLbitfield);
+	void (*popAttrib)(void);
+
+	// GPU timestamps (OpenGL 3.3 or ARB_timer_query), see PassTimer.h
+	GLboolean (*genTimestampQueries)(GLsizei, GLuint*);    // GL_FALSE without timer queries
+	void (*queryTimestamp)(GLuint);                        // glQueryCounter(query, GL_TIMESTAMP)
+	GLboolean (*timestampResult)(GLuint, GLuint64*);       // GL_FALSE while the GPU has not reached it
+
+	// Text: glRasterPos2i(x, y) followed by glutBitmapCharacter for each character
+	void (*bitmapText)(GLint, GLint, const char*, void*);
+} render_backend_t;
+
+render_backend_t legacyRenderer();
+/* Backend that forwards every call to the fixed function pipeline */
+
+bool useCoreRenderer();
+/* Switches to the OpenGL 3.3 core profile backend. Requires a core context
+   to be current. Returns false if its shaders cannot be built             */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+// Same as glutExtensionSupported, which needs glutInit, for contexts created without GLUT
+static bool extensionSupported(const char* extension)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	if (glGetError() == GL_NO_ERROR) {
+		for (GLint i = 0; i < count; i++) {
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && strcmp(name, extension) == 0) return true;
+		}
+		return false;
+	}
+	// Before OpenGL 3.0, one string separated by spaces
+	const char* names = (const char*)glGetString(GL_EXTENSIONS);
+	size_t length = strlen(extension);
+	for (const char* found = names ? strstr(names, extension) : NULL; found; found = strstr(found + length, extension))
+		if ((found == names || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0')) return true;
+	return false;
+}
+
+static void legacyClearRect(GLint x, GLint y, GLsizei width, GLsizei height, GLbitfield mask)
+{
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(x, y, width, height);
+	glClear(mask);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+static void legacyPerspective(GLdouble fovy, GLdouble aspect, GLdouble near_plane, GLdouble far_plane)
+{
+	gluPerspective(fovy, aspect, near_plane, far_plane);
+}
+
+static void legacyLookAt(GLdouble ex, GLdouble ey, GLdouble ez, GLdouble cx, GLdouble cy, GLdouble cz, GLdouble ux, GLdouble uy, GLdouble uz)
+{
+	gluLookAt(ex, ey, ez, cx, cy, cz, ux, uy, uz);
+}
+
+static void legacyTexturedCylinder(GLdouble base, GLdouble top, GLdouble height, GLint slices, GLint stacks)
+{
+	static GLUquadric* quadric = NULL;
+	if (quadric == NULL) {
+		quadric = gluNewQuadric();
+		gluQuadricTexture(quadric, GL_TRUE);
+	}
+	gluCylinder(quadric, base, top, height, slices, stacks);
+}
+
+static void legacyDrawTriangles(const GLfloat* vertices, const GLuint* indices, GLsizei count)
+{
+	// Inside glNewList the arrays are read at compile time
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 8 * sizeof(GLfloat), vertices);
+	glNormalPointer(GL_FLOAT, 8 * sizeof(GLfloat), vertices + 3);
+	glTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), vertices + 6);
+	glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, indices);
+	glPopClientAttrib();
+}
+
+static GLboolean legacyCompressedTexImage2D(GLenum target, GLint level, GLenum format, GLsizei w, GLsizei h, GLint border, GLsizei size, const void* data)
+{
+	static int supported = -1;
+	if (supported < 0) supported = extensionSupported("GL_EXT_texture_compression_s3tc");
+	if (!supported) return GL_FALSE;
+	glCompressedTexImage2D(target, level, format, w, h, border, size, data);
+	return GL_TRUE;
+}
+
+static GLboolean legacyBufferStorage(GLuint buffer, GLsizeiptr size, GLbitfield flags)
+{
+	static int supported = -1;
+	if (supported < 0) {
+		int major = 0, minor = 0;
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if (version) sscanf(version, "%d.%d", &major, &minor);
+		supported = major > 4 || (major == 4 && minor >= 4) || extensionSupported("GL_ARB_buffer_storage");
+	}
+	if (!supported) return GL_FALSE;
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return GL_TRUE;
+}
+
+static void legacyBufferData(GLuint buffer, GLsizeiptr size, const void* data, GLenum usage)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void* legacyMapBufferRange(GLuint buffer, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	void* pointer = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, access);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return pointer;
+}
+
+static void legacyUnmapBuffer(GLuint buffer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void legacyDrawVertexBuffer(GLenum mode, GLuint buffer, GLintptr offset, GLsizei count)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 8 * sizeof(GLfloat), (const GLvoid*)offset);
+	glNormalPointer(GL_FLOAT, 8 * sizeof(GLfloat), (const GLvoid*)(offset + 3 * sizeof(GLfloat)));
+	glTexCoordPointer(2, GL_FLOAT, 8 * sizeof(GLfloat), (const GLvoid*)(offset + 6 * sizeof(GLfloat)));
+	glDrawArrays(mode, 0, count);
+	glPopClientAttrib();
+	glBindBuffer(GL_ARRAY_BUFFER, 0); // drawTriangles points into client memory
+}
+
+static void legacyReadPixelsToBuffer(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, GLuint buffer, GLintptr offset)
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+	glReadPixels(x, y, w, h, format, type, (GLvoid*)offset);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static GLboolean legacyGenTimestampQueries(GLsizei n, GLuint* queries)
+{
+	static int supported = -1;
+	if (supported < 0) {
+		int major = 0, minor = 0;
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if (version) sscanf(version, "%d.%d", &major, &minor);
+		supported = major > 3 || (major == 3 && minor >= 3) || extensionSupported("GL_ARB_timer_query");
+	}
+	if (!supported) return GL_FALSE;
+	glGenQueries(n, queries);
+	return GL_TRUE;
+}
+
+static void legacyQueryTimestamp(GLuint query)
+{
+	glQueryCounter(query, GL_TIMESTAMP);
+}
+
+static GLboolean legacyTimestampResult(GLuint query, GLuint64* ns)
+{
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) return GL_FALSE;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, ns);
+	return GL_TRUE;
+}
+
+static void legacyBitmapText(GLint x, GLint y, const char* text, void* font)
+{
+	glRasterPos2i(x, y);
+	while (*text) glutBitmapCharacter(font, *text++);
+}
+
+render_backend_t legacyRenderer()
+{
+	render_backend_t r;
+	r.name = "legacy";
+	r.clearColor = glClearColor;
+	r.clear = glClear;
+	r.clearRect = legacyClearRect;
+	r.viewport = glViewport;
+	r.getIntegerv = glGetIntegerv;
+	r.getFloatv = glGetFloatv;
+	r.swapBuffers = glutSwapBuffers;
+	r.matrixMode = glMatrixMode;
+	r.loadIdentity = glLoadIdentity;
+	r.pushMatrix = glPushMatrix;
+	r.popMatrix = glPopMatrix;
+	r.translatef = glTranslatef;
+	r.rotatef = glRotatef;
+	r.scalef = glScalef;
+	r.ortho = glOrtho;
+	r.perspective = legacyPerspective;
+	r.lookAt = legacyLookAt;
+	r.begin = glBegin;
+	r.end = glEnd;
+	r.vertex3f = glVertex3f;
+	r.normal3f = glNormal3f;
+	r.texCoord2f = glTexCoord2f;
+	r.color3f = glColor3f;
+	r.color3fv = glColor3fv;
+	r.color4f = glColor4f;
+	r.drawTriangles = legacyDrawTriangles;
+	r.genLists = glGenLists;
+	r.newList = glNewList;
+	r.endList = glEndList;
+	r.callList = glCallList;
+	r.deleteLists = glDeleteLists;
+	r.solidSphere = glutSolidSphere;
+	r.solidCone = glutSolidCone;
+	r.texturedCylinder = legacyTexturedCylinder;
+	r.materialfv = glMaterialfv;
+	r.materialf = glMaterialf;
+	r.lightfv = glLightfv;
+	r.lightf = glLightf;
+	r.fogfv = glFogfv;
+	r.fogf = glFogf;
+	r.genTextures = glGenTextures;
+	r.bindTexture = glBindTexture;
+	r.texImage2D = glTexImage2D;
+	r.compressedTexImage2D = legacyCompressedTexImage2D;
+	r.texParameteri = glTexParameteri;
+	r.texEnvi = glTexEnvi;
+	r.genFramebuffers = glGenFramebuffers;
+	r.bindFramebuffer = glBindFramebuffer;
+	r.genRenderbuffers = glGenRenderbuffers;
+	r.bindRenderbuffer = glBindRenderbuffer;
+	r.renderbufferStorage = glRenderbufferStorage;
+	r.framebufferRenderbuffer = glFramebufferRenderbuffer;
+	r.checkFramebufferStatus = glCheckFramebufferStatus;
+	r.blitFramebuffer = glBlitFramebuffer;
+	r.genBuffers = glGenBuffers;
+	r.deleteBuffers = glDeleteBuffers;
+	r.bufferStorage = legacyBufferStorage;
+	r.bufferData = legacyBufferData;
+	r.mapBufferRange = legacyMapBufferRange;
+	r.unmapBuffer = legacyUnmapBuffer;
+	r.fenceSync = glFenceSync;
+	r.clientWaitSync = glClientWaitSync;
+	r.deleteSync = glDeleteSync;
+	r.drawVertexBuffer = legacyDrawVertexBuffer;
+	r.readPixelsToBuffer = legacyReadPixelsToBuffer;
+	r.enable = glEnable;
+	r.disable = glDisable;
+	r.isEnabled = glIsEnabled;
+	r.blendFunc = glBlendFunc;
+	r.depthMask = glDepthMask;
+	r.cullFace = glCullFace;
+	r.polygonMode = glPolygonMode;
+	r.pushAttrib = glPushAttrib;
+	r.popAttrib = glPopAttrib;
+	r.genTimestampQueries = legacyGenTimestampQueries;
+	r.queryTimestamp = legacyQueryTimestamp;
+	r.timestampResult = legacyTimestampResult;
+	r.bitmapText = legacyBitmapText;
+	return r;
+}
+
+static render_backend_t legacy_renderer = legacyRenderer();
+static render_backend_t* renderer = &legacy_renderer; // backend in use
+
+#include "CoreRenderer.h"
+#include "NullRenderer.h"
+#endif
@@ -0,0 +1,235 @@
+#ifndef RIDESIMULATION
+#define RIDESIMULATION
+/*
+	Ride simulation.
+
+	The motion of the vehicle along the road, its collisions with the border
+	and the floating origin, without GL or GLUT: rideAdvance() is the step the
+	game takes every frame, and a ride batch takes it for any number of
+	independent rides at once, for automated tests and training agents.
+
+	A batch keeps each quantity of every ride in its own array (structure of
+	arrays), and steps all the rides in lockstep: blocks of RIDE_BLOCK
+	consecutive rides are stepped as tasks of a task pool, one block per task,
+	so a step of a large batch runs on every worker. Actions and observations
+	are arrays too, one entry per ride.
+
+	Coordinates as in the game: Z along the road, X across it (the vehicle
+	turns towards +X with positive angles), absolute Z = origin + local Z.
+*/
+
+#include <cmath>
+#include <vector>
+#include "Track.h"
+#include "TaskPool.h"
+
+// Vehicle
+#define SPEED_INCREMENT 0.4f
+#define MAX_SPEED 30
+#define ANGLE_INCREMENT 0.5f
+#define MAX_ANGLE 45
+
+// Built-in road
+#define ROAD_AMPLITUDE 10
+#define ROAD_PERIOD 300
+#define ROAD_WIDTH 8 // half width of the built-in road, track files carry their own
+
+#define REBASE_DISTANCE 1000 // local Z at which the origin is moved forward
+#define RIDE_BLOCK 4096      // rides stepped by one task
+
+typedef struct {
+	const track_t* track;  // NULL for the built-in road
+	float half_width;
+} ride_road_t;
+
+typedef struct {
+	ride_road_t road;
+	bool collisions;
+	int rides;
+	std::vector<float> x, z;                  // z local
+	std::vector<long long> origin;
+	std::vector<float> speed;
+	std::vector<float> turn_angle;            // degrees
+	std::vector<float> velocity_x, velocity_z;
+} ride_batch_t;
+
+typedef struct {
+	std::vector<float> throttle;  // SPEED_INCREMENT steps to apply, negative to brake
+	std::vector<float> steer;     // ANGLE_INCREMENT steps to apply, positive towards +X
+} ride_actions_t;
+
+typedef struct {
+	std::vector<double> distance;          // absolute Z
+	std::vector<float> offset;             // X from the centre of the road
+	std::vector<float> speed;
+	std::vector<float> turn_angle;
+	std::vector<unsigned char> off_road;   // ran into the border in the last step
+} ride_observations_t;
+
+float rideRoadX(const ride_road_t* road, long long base, float u);
+/* X of the centre of the road at Z = base + u. Only base % ROAD_PERIOD matters
+   for the built-in road, which keeps the argument small at any distance      */
+
+bool rideInsideRoad(const ride_road_t* road, long long origin, float x, float z);
+/* (x, z) is clear of both borders */
+
+bool rideAdvance(const ride_road_t* road, float dt, float throttle, float steer, bool collisions,
+                 float* x, float* z, long long* origin, float* speed, float* turn_angle, float* velocity_x, float* velocity_z);
+/* Applies the actions and moves one ride dt seconds. Returns false if it ran
+   into the border, which halves its speed and pushes it back                */
+
+void rideBatchInit(ride_batch_t* batch, int rides, const ride_road_t* road, bool collisions);
+/* rides stopped at the start of the road */
+
+void rideBatchReset(ride_batch_t* batch, int ride, double distance);
+/* Stops ride on the centre of the road, distance meters from the start, facing along it */
+
+void rideActionsInit(ride_actions_t* actions, int rides);
+void rideObservationsInit(ride_observations_t* observations, int rides);
+
+void rideBatchStep(ride_batch_t* batch, const ride_actions_t* actions, float dt, ride_observations_t* observations,
+                   task_pool_t* pool = NULL);
+/* Steps every ride dt seconds. Without pool (or with one not running) all on this thread */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+float rideRoadX(const ride_road_t* road, long long base, float u)
+{
+	if (road->track != NULL)
+		return trackX(road->track, base + (double)u);
+
+	float phase = (float)(base % ROAD_PERIOD) + u;
+	return ROAD_AMPLITUDE + ROAD_AMPLITUDE * sin(2 * M_PI * (phase - ROAD_PERIOD / 4) / ROAD_PERIOD);
+}
+
+bool rideInsideRoad(const ride_road_t* road, long long origin, float x, float z)
+{
+	float centre = rideRoadX(road, origin, z);
+	return x <= centre + road->half_width - 0.7 && x >= centre - road->half_width + 0.7;
+}
+
+bool rideAdvance(const ride_road_t* road, float dt, float throttle, float steer, bool collisions,
+                 float* x, float* z, long long* origin, float* speed, float* turn_angle, float* velocity_x, float* velocity_z)
+{
+	if (throttle != 0) {
+		*speed += throttle * SPEED_INCREMENT;
+		if (*speed > MAX_SPEED) *speed = MAX_SPEED;
+		if (*speed < 0) *speed = 0;
+	}
+	if (steer != 0) {
+		*turn_angle += steer * ANGLE_INCREMENT;
+		if (*turn_angle > MAX_ANGLE) *turn_angle = MAX_ANGLE;
+		if (*turn_angle < -MAX_ANGLE) *turn_angle = -MAX_ANGLE;
+		*velocity_x = sin(*turn_angle * M_PI / 180);
+		*velocity_z = cos(*turn_angle * M_PI / 180);
+	}
+
+	float displacement = dt * *speed;
+	float next_x = *x + displacement * *velocity_x;
+	float next_z = *z + displacement * *velocity_z;
+	bool inside = !collisions || rideInsideRoad(road, *origin, next_x, next_z);
+	if (inside) {
+		*x = next_x;
+		*z = next_z;
+	}
+	else {
+		// Stays where it was, slowed down, and is pushed back towards the road
+		*speed = *speed > 2 ? *speed / 2 : 0;
+		displacement = dt * *speed;
+		float centre = rideRoadX(road, *origin, *z);
+		*x += displacement * (*x < centre ? centre : -centre) / 5;
+	}
+
+	// Whole REBASE_DISTANCE steps keep local Z small
+	if (*z >= REBASE_DISTANCE) {
+		int shift = REBASE_DISTANCE * (int)(*z / REBASE_DISTANCE);
+		*origin += shift;
+		*z -= shift;
+	}
+	return inside;
+}
+
+void rideBatchInit(ride_batch_t* batch, int rides, const ride_road_t* road, bool collisions)
+{
+	batch->road = *road;
+	batch->collisions = collisions;
+	batch->rides = rides;
+	batch->x.resize(rides);
+	batch->z.resize(rides);
+	batch->origin.resize(rides);
+	batch->speed.resize(rides);
+	batch->turn_angle.resize(rides);
+	batch->velocity_x.resize(rides);
+	batch->velocity_z.resize(rides);
+	for (int i = 0; i < rides; i++) rideBatchReset(batch, i, 0);
+}
+
+void rideBatchReset(ride_batch_t* batch, int ride, double distance)
+{
+	long long origin = REBASE_DISTANCE * (long long)(distance / REBASE_DISTANCE);
+	batch->origin[ride] = origin;
+	batch->z[ride] = (float)(distance - origin);
+	batch->x[ride] = rideRoadX(&batch->road, origin, batch->z[ride]);
+	batch->speed[ride] = 0;
+	batch->turn_angle[ride] = 0;
+	batch->velocity_x[ride] = 0;
+	batch->velocity_z[ride] = 1;
+}
+
+void rideActionsInit(ride_actions_t* actions, int rides)
+{
+	actions->throttle.assign(rides, 0);
+	actions->steer.assign(rides, 0);
+}
+
+void rideObservationsInit(ride_observations_t* observations, int rides)
+{
+	observations->distance.resize(rides);
+	observations->offset.resize(rides);
+	observations->speed.resize(rides);
+	observations->turn_angle.resize(rides);
+	observations->off_road.resize(rides);
+}
+
+// Rides [first, last)
+static void rideBlockStep(ride_batch_t* batch, const ride_actions_t* actions, float dt, ride_observations_t* observations,
+                          int first, int last)
+{
+	const ride_road_t* road = &batch->road;
+	float* x = batch->x.data();
+	float* z = batch->z.data();
+	long long* origin = batch->origin.data();
+	float* speed = batch->speed.data();
+	float* turn_angle = batch->turn_angle.data();
+	float* velocity_x = batch->velocity_x.data();
+	float* velocity_z = batch->velocity_z.data();
+	const float* throttle = actions->throttle.data();
+	const float* steer = actions->steer.data();
+
+	for (int i = first; i < last; i++) {
+		bool inside = rideAdvance(road, dt, throttle[i], steer[i], batch->collisions,
+		                          &x[i], &z[i], &origin[i], &speed[i], &turn_angle[i], &velocity_x[i], &velocity_z[i]);
+		observations->distance[i] = origin[i] + (double)z[i];
+		observations->offset[i] = x[i] - rideRoadX(road, origin[i], z[i]);
+		observations->speed[i] = speed[i];
+		observations->turn_angle[i] = turn_angle[i];
+		observations->off_road[i] = !inside;
+	}
+}
+
+void rideBatchStep(ride_batch_t* batch, const ride_actions_t* actions, float dt, ride_observations_t* observations,
+                   task_pool_t* pool)
+{
+	if (pool == NULL || taskPoolThreads(pool) == 0 || batch->rides <= RIDE_BLOCK) {
+		rideBlockStep(batch, actions, dt, observations, 0, batch->rides);
+		return;
+	}
+	task_count_t blocks(0);
+	for (int first = 0; first < batch->rides; first += RIDE_BLOCK) {
+		int last = first + RIDE_BLOCK < batch->rides ? first + RIDE_BLOCK : batch->rides;
+		taskSubmit(pool, [=] { rideBlockStep(batch, actions, dt, observations, first, last); }, &blocks);
+	}
+	taskWait(pool, &blocks);
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef STREAMBUFFER
+#define STREAMBUFFER
+/*
+	Streaming vertex buffer.
+
+	Geometry that changes every frame (rain, overlays) is written straight into
+	a buffer object and drawn from it, instead of being sent vertex by vertex.
+	Vertices have the 8 floats of the tessellator: position, normal, texture
+	coordinates; color comes from the current color.
+
+	The buffer is split in STREAM_REGIONS regions, one per frame, used in turn.
+	Where immutable storage is available (OpenGL 4.4 or ARB_buffer_storage) the
+	whole buffer stays persistently and coherently mapped: vertices are written
+	where the GPU will read them, and a fence after the last draw from a region
+	says when it may be written again, which with three regions is almost
+	always already the case. Elsewhere the buffer is orphaned each time the
+	ring wraps around and each range is mapped unsynchronized while it is
+	written, which lets the driver hand out fresh memory without a stall.
+*/
+
+#include <cstring>
+#include "Renderer.h"
+
+#define STREAM_REGIONS 3          // frames the GPU may still be reading
+#define STREAM_VERTEX_FLOATS 8    // as TESS_VERTEX_FLOATS
+
+typedef struct {
+	GLuint buffer;
+	GLsizeiptr region_size;           // bytes
+	int region;                       // written this frame
+	GLsizeiptr used;                  // bytes of the region already drawn
+	int draws;                        // draws from the region of this frame
+	GLsync fences[STREAM_REGIONS];    // after the last draw from each region, 0 if none
+	bool persistent;
+	GLfloat* mapped;                  // whole buffer when persistent, the range being written otherwise
+} stream_buffer_t;
+
+void createStreamBuffer(stream_buffer_t* stream, int vertices_per_frame);
+/* Creates the buffer, persistently mapped where immutable storage is available */
+
+GLfloat* streamVertices(stream_buffer_t* stream, int count);
+/* Space for up to count vertices in the region of this frame, NULL if it does
+   not fit. Valid until the next streamDraw                                    */
+
+void streamDraw(stream_buffer_t* stream, GLenum mode, int count);
+/* Draws the first count vertices written since streamVertices with the current
+   color, texture and matrices. mode: GL_LINES, GL_TRIANGLES or GL_TRIANGLE_STRIP */
+
+int streamDrawn(const stream_buffer_t* stream);
+/* Vertices drawn from the region of this frame so far */
+
+void streamRedraw(stream_buffer_t* stream, GLenum mode, int first, int count);
+/* Draws again count vertices drawn this frame, from the first-th on (as
+   counted by streamDrawn), for another view of the same frame          */
+
+GLfloat* streamPut(GLfloat* out, GLfloat x, GLfloat y, GLfloat z, const GLfloat normal[3], GLfloat s = 0, GLfloat t = 0);
+/* Writes one vertex at out. Returns where the next one goes */
+
+void streamTriangles(stream_buffer_t* stream, const GLfloat* vertices, const GLuint* indices, GLsizei count);
+/* Draws indexed triangles, as renderer->drawTriangles, through the stream */
+
+void streamEndFrame(stream_buffer_t* stream);
+/* Fences the region of this frame and moves to the next one, waiting for the
+   GPU if it is still reading it. Call once per frame after the last draw     */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+#define STREAM_VERTEX_SIZE (STREAM_VERTEX_FLOATS * sizeof(GLfloat))
+
+void createStreamBuffer(stream_buffer_t* stream, int vertices_per_frame)
+{
+	stream->region_size = vertices_per_frame * STREAM_VERTEX_SIZE;
+	stream->region = 0;
+	stream->used = 0;
+	stream->draws = 0;
+	for (int i = 0; i < STREAM_REGIONS; i++) stream->fences[i] = 0;
+	GLsizeiptr size = STREAM_REGIONS * stream->region_size;
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	renderer->genBuffers(1, &stream->buffer);
+	if (renderer->bufferStorage(stream->buffer, size, flags)) {
+		stream->mapped = (GLfloat*)renderer->mapBufferRange(stream->buffer, 0, size, flags);
+		stream->persistent = stream->mapped != NULL;
+		if (stream->persistent) return;
+		renderer->deleteBuffers(1, &stream->buffer); // immutable storage cannot be orphaned
+		renderer->genBuffers(1, &stream->buffer);
+	}
+
+	stream->persistent = false;
+	stream->mapped = NULL;
+	renderer->bufferData(stream->buffer, size, NULL, GL_STREAM_DRAW);
+}
+
+GLfloat* streamVertices(stream_buffer_t* stream, int count)
+{
+	GLsizeiptr bytes = count * STREAM_VERTEX_SIZE;
+	if (count <= 0 || stream->used + bytes > stream->region_size) return NULL;
+	GLintptr offset = stream->region * stream->region_size + stream->used;
+
+	if (stream->persistent) return stream->mapped + offset / sizeof(GLfloat);
+
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	stream->mapped = (GLfloat*)renderer->mapBufferRange(stream->buffer, offset, bytes, access);
+	return stream->mapped;
+}
+
+void streamDraw(stream_buffer_t* stream, GLenum mode, int count)
+{
+	if (!stream->persistent) {
+		if (stream->mapped == NULL) return;
+		renderer->unmapBuffer(stream->buffer);
+		stream->mapped = NULL;
+	}
+	if (count <= 0) return;
+	GLintptr offset = stream->region * stream->region_size + stream->used;
+	renderer->drawVertexBuffer(mode, stream->buffer, offset, count);
+	stream->used += count * STREAM_VERTEX_SIZE;
+	stream->draws++;
+}
+
+int streamDrawn(const stream_buffer_t* stream)
+{
+	return (int)(stream->used / STREAM_VERTEX_SIZE);
+}
+
+void streamRedraw(stream_buffer_t* stream, GLenum mode, int first, int count)
+{
+	if (count <= 0 || first + count > streamDrawn(stream)) return;
+	GLintptr offset = stream->region * stream->region_size + first * STREAM_VERTEX_SIZE;
+	renderer->drawVertexBuffer(mode, stream->buffer, offset, count);
+	stream->draws++;
+}
+
+GLfloat* streamPut(GLfloat* out, GLfloat x, GLfloat y, GLfloat z, const GLfloat normal[3], GLfloat s, GLfloat t)
+{
+	out[0] = x; out[1] = y; out[2] = z;
+	out[3] = normal[0]; out[4] = normal[1]; out[5] = normal[2];
+	out[6] = s; out[7] = t;
+	return out + STREAM_VERTEX_FLOATS;
+}
+
+void streamTriangles(stream_buffer_t* stream, const GLfloat* vertices, const GLuint* indices, GLsizei count)
+{
+	GLfloat* out = streamVertices(stream, count);
+	if (out == NULL) {
+		renderer->drawTriangles(vertices, indices, count);
+		return;
+	}
+	for (GLsizei i = 0; i < count; i++, out += STREAM_VERTEX_FLOATS)
+		memcpy(out, vertices + STREAM_VERTEX_FLOATS * indices[i], STREAM_VERTEX_SIZE);
+	streamDraw(stream, GL_TRIANGLES, count);
+}
+
+void streamEndFrame(stream_buffer_t* stream)
+{
+	if (stream->persistent) {
+		if (stream->fences[stream->region]) renderer->deleteSync(stream->fences[stream->region]);
+		stream->fences[stream->region] = stream->used > 0 ? renderer->fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+	}
+	stream->region = (stream->region + 1) % STREAM_REGIONS;
+	stream->used = 0;
+	stream->draws = 0;
+
+	if (stream->persistent) {
+		GLsync fence = stream->fences[stream->region];
+		if (fence) {
+			// Flushes on the first try only, then waits in 1 ms steps
+			GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			while (renderer->clientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED) flags = 0;
+			renderer->deleteSync(fence);
+			stream->fences[stream->region] = 0;
+		}
+	}
+	else if (stream->region == 0) {
+		renderer->bufferData(stream->buffer, STREAM_REGIONS * stream->region_size, NULL, GL_STREAM_DRAW); // orphan
+	}
+}
+
+#endif
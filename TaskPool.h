@@ -0,0 +1,162 @@
+#ifndef TASKPOOL
+#define TASKPOOL
+/*
+	Work-stealing task pool.
+
+	Every worker thread owns a queue of tasks. Tasks submitted from a worker go
+	to its own queue, tasks submitted from any other thread are dealt round robin
+	among the queues. A worker takes the oldest task of its queue and, when it
+	runs out, steals the newest task of another queue, so the order of
+	submission is kept where it matters (the first tasks start first) and idle
+	workers take the work furthest from it.
+
+	Tasks must not make GL calls: their results are handed back to the render
+	thread, which submits them. Waiting on a task_count_t runs queued tasks
+	meanwhile instead of blocking, so the thread waiting also works.
+*/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+typedef std::function<void()> task_t;
+
+typedef struct {
+	std::mutex mutex;
+	std::deque<task_t> tasks;
+} task_queue_t;
+
+typedef struct {
+	std::vector<std::thread> threads;
+	task_queue_t* queues;            // one per worker
+	int num_queues;
+	std::atomic<int> queued;         // tasks waiting in any queue
+	std::atomic<unsigned> next;      // queue of the next task submitted from outside
+	std::mutex sleep_mutex;
+	std::condition_variable wakeup;
+	bool stop;                       // guarded by sleep_mutex
+} task_pool_t;
+
+typedef std::atomic<int> task_count_t; // tasks of a group not finished yet
+
+void taskPoolStart(task_pool_t* pool, int threads);
+/* Starts threads workers (at least one) */
+
+void taskPoolStop(task_pool_t* pool);
+/* Waits for the running tasks and joins the workers. Queued tasks are dropped */
+
+int taskPoolThreads(const task_pool_t* pool);
+/* Number of workers, 0 if the pool is not running */
+
+void taskSubmit(task_pool_t* pool, task_t task, task_count_t* count = NULL);
+/* Queues task. If count is given it is incremented now and decremented when the task ends */
+
+void taskWait(task_pool_t* pool, task_count_t* count);
+/* Runs queued tasks until every task counted by count has ended */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+static thread_local int task_worker = -1; // queue of the worker running on this thread
+
+// Takes a task from queue self, or steals one from another queue
+static bool taskTake(task_pool_t* pool, int self, task_t* task)
+{
+	for (int i = 0; i < pool->num_queues; i++) {
+		int q = ((self < 0 ? 0 : self) + i) % pool->num_queues;
+		task_queue_t* queue = &pool->queues[q];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->tasks.empty()) continue;
+		if (q == self) {
+			*task = std::move(queue->tasks.front());
+			queue->tasks.pop_front();
+		}
+		else {
+			*task = std::move(queue->tasks.back());
+			queue->tasks.pop_back();
+		}
+		pool->queued--;
+		return true;
+	}
+	return false;
+}
+
+static void taskWorker(task_pool_t* pool, int self)
+{
+	task_worker = self;
+	task_t task;
+	while (true) {
+		if (taskTake(pool, self, &task)) {
+			task();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(pool->sleep_mutex);
+		pool->wakeup.wait(lock, [pool] { return pool->stop || pool->queued > 0; });
+		if (pool->stop) return;
+	}
+}
+
+void taskPoolStart(task_pool_t* pool, int threads)
+{
+	if (threads < 1) threads = 1;
+	pool->queues = new task_queue_t[threads];
+	pool->num_queues = threads;
+	pool->queued = 0;
+	pool->next = 0;
+	pool->stop = false;
+	for (int i = 0; i < threads; i++)
+		pool->threads.push_back(std::thread(taskWorker, pool, i));
+}
+
+void taskPoolStop(task_pool_t* pool)
+{
+	if (pool->threads.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(pool->sleep_mutex);
+		pool->stop = true;
+	}
+	pool->wakeup.notify_all();
+	for (size_t i = 0; i < pool->threads.size(); i++) pool->threads[i].join();
+	pool->threads.clear();
+	delete[] pool->queues;
+	pool->queues = NULL;
+	pool->num_queues = 0;
+}
+
+int taskPoolThreads(const task_pool_t* pool)
+{
+	return (int)pool->threads.size();
+}
+
+void taskSubmit(task_pool_t* pool, task_t task, task_count_t* count)
+{
+	if (count) {
+		(*count)++;
+		task = [task, count] { task(); (*count)--; };
+	}
+	int q = task_worker >= 0 ? task_worker : (int)(pool->next++ % pool->num_queues);
+	{
+		std::lock_guard<std::mutex> lock(pool->queues[q].mutex);
+		pool->queues[q].tasks.push_back(std::move(task));
+	}
+	{
+		// Under sleep_mutex so a worker about to sleep sees it
+		std::lock_guard<std::mutex> lock(pool->sleep_mutex);
+		pool->queued++;
+	}
+	pool->wakeup.notify_one();
+}
+
+void taskWait(task_pool_t* pool, task_count_t* count)
+{
+	task_t task;
+	while (*count > 0) {
+		if (taskTake(pool, task_worker, &task)) task();
+		else std::this_thread::yield();
+	}
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef TELEMETRY
+#define TELEMETRY
+/*
+	Live telemetry.
+
+	The render thread writes one small record per frame into a single producer,
+	single consumer ring: a store into the slot and a release store of the
+	head, no lock and no system call. When the ring is full the record is
+	dropped and counted, so a stalled exporter never slows the game down.
+
+	An exporter thread drains the ring every TELEMETRY_PERIOD_MS and
+	 - keeps totals, the last values and a frame time histogram, served in the
+	   Prometheus text format to every client of a local Unix socket (plain
+	   HTTP for scrapers that send a request, the bare text otherwise);
+	 - and/or appends every record to a memory mapped file: a header followed
+	   by a circular log of TELEMETRY_FILE_RECORDS records, record i in slot
+	   i % TELEMETRY_FILE_RECORDS. The header counts the records written, and
+	   is updated after the record, so other processes can follow the file
+	   while the game runs.
+*/
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define TELEMETRY_CAPACITY 1024       // records in the ring, a power of two
+#define TELEMETRY_PERIOD_MS 100       // between drains of the exporter
+#define TELEMETRY_FILE_RECORDS 65536  // slots of the memory mapped log
+#define TELEMETRY_BUCKETS 8
+
+static const double TELEMETRY_BUCKET_MS[TELEMETRY_BUCKETS] = { 4, 8, 12, 16.7, 25, 33.3, 50, 100 };
+
+typedef struct {
+	uint64_t frame;
+	double time_ms;          // since the start of the game, when the frame was presented
+	double distance;         // m along the road
+	float frame_ms;          // CPU time of the frame
+	float speed;             // m/s
+	float resolution_scale;  // of the scene, 1 at window resolution
+	uint32_t draws;          // draw calls of the frame
+	uint16_t streetlamps;    // lighting the frame
+	uint16_t quality_tier;
+} telemetry_record_t;
+
+typedef struct {
+	telemetry_record_t records[TELEMETRY_CAPACITY];
+	alignas(64) std::atomic<uint64_t> head;     // records pushed, written by the render thread
+	alignas(64) std::atomic<uint64_t> tail;     // records taken, written by the exporter
+	alignas(64) std::atomic<uint64_t> dropped;  // pushed with the ring full
+} telemetry_ring_t;
+
+typedef struct {
+	char magic[4];                  // "TLMY"
+	uint32_t record_size;           // sizeof(telemetry_record_t)
+	uint32_t capacity;              // TELEMETRY_FILE_RECORDS
+	uint32_t reserved;
+	std::atomic<uint64_t> written;  // records appended so far
+} telemetry_file_header_t;
+
+typedef struct {
+	telemetry_ring_t ring;
+	std::thread thread;
+	std::atomic<bool> stop;
+	bool running;
+
+	int listener;                       // -1 without socket
+	std::string socket_path;
+	telemetry_file_header_t* file;      // NULL without file
+	size_t file_size;
+
+	// Owned by the exporter thread
+	telemetry_record_t last;
+	uint64_t frames;
+	uint64_t buckets[TELEMETRY_BUCKETS]; // frames up to each bound
+	double frame_ms_sum;
+} telemetry_t;
+
+void telemetryInit(telemetry_t* telemetry);
+/* Empty ring, no exporter */
+
+bool telemetryPush(telemetry_t* telemetry, const telemetry_record_t* record);
+/* From the render thread only. Returns false if the record was dropped */
+
+bool telemetryPop(telemetry_ring_t* ring, telemetry_record_t* record);
+/* From the exporter only. Returns false if the ring is empty */
+
+bool startTelemetryExporter(telemetry_t* telemetry, const char* socket_path, const char* file_path);
+/* Opens the socket and/or the file (either may be NULL) and starts the exporter */
+
+void stopTelemetryExporter(telemetry_t* telemetry);
+/* Drains the ring a last time, joins the exporter and removes the socket */
+
+void writeTelemetryMetrics(std::ostream& out, const telemetry_t* telemetry);
+/* The metrics in the Prometheus text format */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+void telemetryInit(telemetry_t* telemetry)
+{
+	telemetry->ring.head = 0;
+	telemetry->ring.tail = 0;
+	telemetry->ring.dropped = 0;
+	telemetry->stop = false;
+	telemetry->running = false;
+	telemetry->listener = -1;
+	telemetry->file = NULL;
+	telemetry->file_size = 0;
+	memset(&telemetry->last, 0, sizeof(telemetry->last));
+	telemetry->frames = 0;
+	memset(telemetry->buckets, 0, sizeof(telemetry->buckets));
+	telemetry->frame_ms_sum = 0;
+}
+
+bool telemetryPush(telemetry_t* telemetry, const telemetry_record_t* record)
+{
+	telemetry_ring_t* ring = &telemetry->ring;
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->tail.load(std::memory_order_acquire) == TELEMETRY_CAPACITY) {
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	ring->records[head & (TELEMETRY_CAPACITY - 1)] = *record;
+	ring->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool telemetryPop(telemetry_ring_t* ring, telemetry_record_t* record)
+{
+	uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+	if (tail == ring->head.load(std::memory_order_acquire))
+		return false;
+	*record = ring->records[tail & (TELEMETRY_CAPACITY - 1)];
+	ring->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+static void telemetryDrain(telemetry_t* telemetry)
+{
+	telemetry_record_t record;
+	while (telemetryPop(&telemetry->ring, &record)) {
+		telemetry->last = record;
+		telemetry->frames++;
+		telemetry->frame_ms_sum += record.frame_ms;
+		for (int i = 0; i < TELEMETRY_BUCKETS; i++)
+			if (record.frame_ms <= TELEMETRY_BUCKET_MS[i]) telemetry->buckets[i]++;
+
+		if (telemetry->file != NULL) {
+			uint64_t written = telemetry->file->written.load(std::memory_order_relaxed);
+			telemetry_record_t* slots = (telemetry_record_t*)(telemetry->file + 1);
+			slots[written % TELEMETRY_FILE_RECORDS] = record;
+			telemetry->file->written.store(written + 1, std::memory_order_release);
+		}
+	}
+}
+
+void writeTelemetryMetrics(std::ostream& out, const telemetry_t* telemetry)
+{
+	const telemetry_record_t* last = &telemetry->last;
+	out << "# HELP motorbike_frames_total Frames presented.\n"
+	    << "# TYPE motorbike_frames_total counter\n"
+	    << "motorbike_frames_total " << telemetry->frames << "\n"
+	    << "# HELP motorbike_telemetry_dropped_total Frames not recorded because the telemetry ring was full.\n"
+	    << "# TYPE motorbike_telemetry_dropped_total counter\n"
+	    << "motorbike_telemetry_dropped_total " << telemetry->ring.dropped.load(std::memory_order_relaxed) << "\n"
+	    << "# HELP motorbike_frame_seconds CPU time of each frame.\n"
+	    << "# TYPE motorbike_frame_seconds histogram\n";
+	for (int i = 0; i < TELEMETRY_BUCKETS; i++)
+		out << "motorbike_frame_seconds_bucket{le=\"" << TELEMETRY_BUCKET_MS[i] / 1000 << "\"} " << telemetry->buckets[i] << "\n";
+	out << "motorbike_frame_seconds_bucket{le=\"+Inf\"} " << telemetry->frames << "\n"
+	    << "motorbike_frame_seconds_sum " << telemetry->frame_ms_sum / 1000 << "\n"
+	    << "motorbike_frame_seconds_count " << telemetry->frames << "\n"
+	    << "# HELP motorbike_speed_meters_per_second Speed of the vehicle in the last frame.\n"
+	    << "# TYPE motorbike_speed_meters_per_second gauge\n"
+	    << "motorbike_speed_meters_per_second " << last->speed << "\n"
+	    << "# HELP motorbike_distance_meters Distance ridden along the road.\n"
+	    << "# TYPE motorbike_distance_meters gauge\n"
+	    << "motorbike_distance_meters " << last->distance << "\n"
+	    << "# HELP motorbike_draws Draw calls of the last frame.\n"
+	    << "# TYPE motorbike_draws gauge\n"
+	    << "motorbike_draws " << last->draws << "\n"
+	    << "# HELP motorbike_streetlamps Streetlamps lighting the last frame.\n"
+	    << "# TYPE motorbike_streetlamps gauge\n"
+	    << "motorbike_streetlamps " << last->streetlamps << "\n"
+	    << "# HELP motorbike_quality_tier Quality tier in use, 0 is the lowest.\n"
+	    << "# TYPE motorbike_quality_tier gauge\n"
+	    << "motorbike_quality_tier " << last->quality_tier << "\n"
+	    << "# HELP motorbike_resolution_scale Resolution of the scene relative to the window.\n"
+	    << "# TYPE motorbike_resolution_scale gauge\n"
+	    << "motorbike_resolution_scale " << last->resolution_scale << "\n";
+}
+
+// Answers one client with the metrics as they are now
+static void telemetryServe(telemetry_t* telemetry, int client)
+{
+	// HTTP clients speak first; others get the text right away
+	char request[1024];
+	ssize_t received = 0;
+	struct pollfd readable = { client, POLLIN, 0 };
+	if (poll(&readable, 1, TELEMETRY_PERIOD_MS) > 0)
+		received = recv(client, request, sizeof(request) - 1, 0);
+	bool http = received >= 4 && memcmp(request, "GET ", 4) == 0;
+
+	std::ostringstream body;
+	body.precision(12);
+	writeTelemetryMetrics(body, telemetry);
+	std::string text = body.str();
+	if (http) {
+		std::ostringstream header;
+		header << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+		       << text.size() << "\r\nConnection: close\r\n\r\n";
+		text = header.str() + text;
+	}
+	for (size_t sent = 0; sent < text.size(); ) {
+		ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) break;
+		sent += n;
+	}
+	close(client);
+}
+
+static void telemetryExporter(telemetry_t* telemetry)
+{
+	while (!telemetry->stop.load()) {
+		telemetryDrain(telemetry);
+		if (telemetry->listener < 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(TELEMETRY_PERIOD_MS));
+			continue;
+		}
+		struct pollfd incoming = { telemetry->listener, POLLIN, 0 };
+		if (poll(&incoming, 1, TELEMETRY_PERIOD_MS) > 0) {
+			int client = accept(telemetry->listener, NULL, NULL);
+			if (client >= 0) {
+				telemetryDrain(telemetry);
+				telemetryServe(telemetry, client);
+			}
+		}
+	}
+	telemetryDrain(telemetry);
+}
+
+bool startTelemetryExporter(telemetry_t* telemetry, const char* socket_path, const char* file_path)
+{
+	if (socket_path != NULL) {
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (strlen(socket_path) >= sizeof(address.sun_path)) return false;
+		strcpy(address.sun_path, socket_path);
+		unlink(socket_path); // left behind by a previous run
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener < 0) return false;
+		if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 8) < 0) {
+			close(listener);
+			return false;
+		}
+		telemetry->listener = listener;
+		telemetry->socket_path = socket_path;
+	}
+	if (file_path != NULL) {
+		size_t size = sizeof(telemetry_file_header_t) + TELEMETRY_FILE_RECORDS * sizeof(telemetry_record_t);
+		int fd = open(file_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		void* mapped = MAP_FAILED;
+		if (fd >= 0 && ftruncate(fd, size) == 0)
+			mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (fd >= 0) close(fd);
+		if (mapped == MAP_FAILED) {
+			stopTelemetryExporter(telemetry);
+			return false;
+		}
+		telemetry->file = (telemetry_file_header_t*)mapped;
+		telemetry->file_size = size;
+		memcpy(telemetry->file->magic, "TLMY", 4);
+		telemetry->file->record_size = sizeof(telemetry_record_t);
+		telemetry->file->capacity = TELEMETRY_FILE_RECORDS;
+		telemetry->file->written.store(0);
+	}
+	telemetry->stop = false;
+	telemetry->thread = std::thread(telemetryExporter, telemetry);
+	telemetry->running = true;
+	return true;
+}
+
+void stopTelemetryExporter(telemetry_t* telemetry)
+{
+	if (telemetry->running) {
+		telemetry->stop = true;
+		telemetry->thread.join();
+		telemetry->running = false;
+	}
+	if (telemetry->listener >= 0) {
+		close(telemetry->listener);
+		unlink(telemetry->socket_path.c_str());
+		telemetry->listener = -1;
+	}
+	if (telemetry->file != NULL) {
+		munmap(telemetry->file, telemetry->file_size);
+		telemetry->file = NULL;
+	}
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef TESSELLATOR
+#define TESSELLATOR
+/*
+	Batch tessellation.
+
+	Geometry is written into a batch instead of being sent vertex by vertex:
+	interleaved vertices (position, normal, texture coordinates, 8 floats) and
+	indexed triangles. A batch collects any number of quads and loose triangles
+	and is drawn with a single renderer->drawTriangles call, or compiled into a
+	display list the same way.
+
+	tessQuad produces the surface of quadtex() (Utilidades.h) as an indexed grid:
+	(M + 1) x (N + 1) shared vertices instead of 2 (N + 1) per column. Along
+	a column the bilinear patch is linear, so every vertex is two 4 wide
+	multiply-adds of row constants by j / N, with the reciprocals of M and N
+	computed once per quad:
+		[x y z nx] = a + w * d     a, d: the column's first point and direction
+		[ny nz s t] = b + w * e     b: normal, s and tmin;  e: (0, 0, 0, tmax - tmin)
+	With SSE (every x86-64) these are vector instructions writing whole vertices.
+*/
+
+#include <vector>
+#include <cmath>
+#include "Renderer.h"
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define TESS_VERTEX_FLOATS 8
+
+typedef struct {
+	std::vector<GLfloat> vertices; // TESS_VERTEX_FLOATS per vertex: position, normal, texture coordinates
+	std::vector<GLuint> indices;   // three per triangle
+} tess_batch_t;
+
+void tessClear(tess_batch_t* batch);
+/* Empties the batch, keeping its memory */
+
+bool tessEmpty(const tess_batch_t* batch);
+
+void tessQuad(tess_batch_t* batch, const GLfloat v0[3], const GLfloat v1[3], const GLfloat v2[3], const GLfloat v3[3],
+              GLfloat smin = 0, GLfloat smax = 1, GLfloat tmin = 0, GLfloat tmax = 1, int M = 10, int N = 10);
+/* Same arguments and surface as quadtex(): v0..v3 counterclockwise, (smin, tmin)
+   at v0 and (smax, tmax) at v2, M divisions from v0 to v1 and N from v0 to v3 */
+
+void tessVertex(tess_batch_t* batch, const GLfloat p[3], const GLfloat n[3], GLfloat s, GLfloat t);
+/* Appends a vertex of its own. Every three make a triangle */
+
+void tessDraw(const tess_batch_t* batch);
+/* Draws the whole batch with one call */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+void tessClear(tess_batch_t* batch)
+{
+	batch->vertices.clear();
+	batch->indices.clear();
+}
+
+bool tessEmpty(const tess_batch_t* batch)
+{
+	return batch->indices.empty();
+}
+
+// Writes count vertices: out[0..3] = a + w * d and out[4..7] = b + w * e for w = j * step
+static void tessColumn(GLfloat* out, const GLfloat a[4], const GLfloat d[4], const GLfloat b[4], const GLfloat e[4],
+                       int count, float step)
+{
+#if defined(__SSE__)
+	__m128 va = _mm_loadu_ps(a), vd = _mm_loadu_ps(d);
+	__m128 vb = _mm_loadu_ps(b), ve = _mm_loadu_ps(e);
+	for (int j = 0; j < count; j++, out += TESS_VERTEX_FLOATS) {
+		__m128 w = _mm_set1_ps(j * step);
+		_mm_storeu_ps(out,     _mm_add_ps(va, _mm_mul_ps(w, vd)));
+		_mm_storeu_ps(out + 4, _mm_add_ps(vb, _mm_mul_ps(w, ve)));
+	}
+#else
+	for (int j = 0; j < count; j++, out += TESS_VERTEX_FLOATS) {
+		float w = j * step;
+		for (int k = 0; k < 4; k++) {
+			out[k]     = a[k] + w * d[k];
+			out[4 + k] = b[k] + w * e[k];
+		}
+	}
+#endif
+}
+
+void tessQuad(tess_batch_t* batch, const GLfloat v0[3], const GLfloat v1[3], const GLfloat v2[3], const GLfloat v3[3],
+              GLfloat smin, GLfloat smax, GLfloat tmin, GLfloat tmax, int M, int N)
+{
+	if (M < 1) M = 1;
+	if (N < 1) N = 1;
+	float inv_m = 1.0f / M, inv_n = 1.0f / N;
+
+	// Unit normal (v1 - v0) x (v3 - v0)
+	GLfloat v01[] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+	GLfloat v03[] = { v3[0] - v0[0], v3[1] - v0[1], v3[2] - v0[2] };
+	GLfloat normal[] = { v01[1] * v03[2] - v01[2] * v03[1],
+	                     v01[2] * v03[0] - v01[0] * v03[2],
+	                     v01[0] * v03[1] - v01[1] * v03[0] };
+	float inv_norm = 1.0f / sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	for (int k = 0; k < 3; k++) normal[k] *= inv_norm;
+
+	GLuint first = batch->vertices.size() / TESS_VERTEX_FLOATS;
+	int column = N + 1;
+	batch->vertices.resize(batch->vertices.size() + (M + 1) * column * TESS_VERTEX_FLOATS);
+	GLfloat* out = batch->vertices.data() + first * TESS_VERTEX_FLOATS;
+
+	// Column i runs from a point of v0v1 to the matching point of v3v2
+	GLfloat e[4] = { 0, 0, 0, tmax - tmin };
+	for (int i = 0; i <= M; i++, out += column * TESS_VERTEX_FLOATS) {
+		float u = i * inv_m;
+		GLfloat a[4], d[4];
+		for (int k = 0; k < 3; k++) {
+			a[k] = v0[k] + u * (v1[k] - v0[k]);
+			d[k] = v3[k] + u * (v2[k] - v3[k]) - a[k];
+		}
+		a[3] = normal[0];
+		d[3] = 0;
+		GLfloat b[4] = { normal[1], normal[2], smin + (smax - smin) * u, tmin };
+		tessColumn(out, a, d, b, e, column, inv_n);
+	}
+
+	// Cell (i, j) is (i, j) (i + 1, j) (i + 1, j + 1) (i, j + 1), counterclockwise like v0..v3
+	size_t index = batch->indices.size();
+	batch->indices.resize(index + 6 * M * N);
+	GLuint* triangles = batch->indices.data() + index;
+	for (int i = 0; i < M; i++) {
+		for (int j = 0; j < N; j++, triangles += 6) {
+			GLuint k = first + i * column + j;
+			triangles[0] = k;  triangles[1] = k + column;  triangles[2] = k + column + 1;
+			triangles[3] = k;  triangles[4] = k + column + 1;  triangles[5] = k + 1;
+		}
+	}
+}
+
+void tessVertex(tess_batch_t* batch, const GLfloat p[3], const GLfloat n[3], GLfloat s, GLfloat t)
+{
+	GLfloat vertex[TESS_VERTEX_FLOATS] = { p[0], p[1], p[2], n[0], n[1], n[2], s, t };
+	batch->indices.push_back(batch->vertices.size() / TESS_VERTEX_FLOATS);
+	batch->vertices.insert(batch->vertices.end(), vertex, vertex + TESS_VERTEX_FLOATS);
+}
+
+void tessDraw(const tess_batch_t* batch)
+{
+	if (tessEmpty(batch)) return;
+	renderer->drawTriangles(batch->vertices.data(), batch->indices.data(), batch->indices.size());
+}
+
+#endif
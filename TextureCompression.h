@@ -0,0 +1,315 @@
+#ifndef TEXTURECOMPRESSION
+#define TEXTURECOMPRESSION
+/*
+	Block-compressed textures.
+
+	Images are encoded offline (motorbike --compress-textures) into S3TC blocks
+	of 4 x 4 texels: BC1 (DXT1, 8 bytes a block, 4 bits per texel) for opaque
+	images and BC3 (DXT5, 16 bytes a block, 8 bits per texel) for those with any
+	transparent texel, against the 32 bits per texel of loadImageFile(). Every
+	level of the mipmap chain is kept, down to 1 x 1, each one the 2 x 2 box
+	filter of the previous.
+
+	A block stores two endpoint colors in 5:6:5 and a 2 bit index per texel into
+	the four colors they span. Endpoints are the corners of the bounding box of
+	the block's colors, inset by 1/16 of its size, on the diagonal that follows
+	the sign of the covariance of green and blue with red. BC3 adds an alpha
+	block: two 8 bit endpoints and a 3 bit index per texel into eight values.
+
+	Container (.ctex), little-endian:
+		ctex_header_t
+		the blocks of every level, level 0 first, rows of blocks bottom to top as
+		texImage2D() takes texels (the order FreeImage reads them in)
+	The size of each level follows from the format and its dimensions.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <FreeImage.h>
+#include "Renderer.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+#define CTEX_EXTENSION ".ctex"
+
+typedef struct {
+	char magic[4];           // "CTEX"
+	uint32_t format;         // GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	uint32_t width, height;  // of level 0
+	uint32_t levels;
+} ctex_header_t;
+
+GLsizei compressedLevelSize(GLenum format, int w, int h);
+/* Bytes of a level of w x h texels */
+
+void encodeLevel(const uint8_t* rgba, int w, int h, GLenum format, std::vector<uint8_t>* out);
+/* Appends the blocks of the w x h RGBA texels to out */
+
+bool writeCompressedTexture(const char* path, const uint8_t* rgba, int w, int h);
+/* Encodes w x h RGBA texels and their mipmaps into path: BC3 if any texel is
+   not opaque, BC1 otherwise. Returns false if path cannot be written         */
+
+std::string compressedTexturePath(const char* image);
+/* image with its extension replaced by CTEX_EXTENSION */
+
+bool compressTextureFile(const char* image);
+/* Reads image with FreeImage and writes compressedTexturePath(image) */
+
+bool loadCompressedTexture(const char* path);
+/* Uploads every level of path to the bound GL_TEXTURE_2D. Returns false, having
+   uploaded nothing, if path is missing or malformed or S3TC is not supported */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+GLsizei compressedLevelSize(GLenum format, int w, int h)
+{
+	int block_bytes = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+	return ((w + 3) / 4) * ((h + 3) / 4) * block_bytes;
+}
+
+static uint16_t bcPack565(const int c[3])
+{
+	return (uint16_t)(((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+}
+
+static void bcUnpack565(uint16_t v, int c[3])
+{
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+static void bcPut(std::vector<uint8_t>* out, uint64_t bits, int bytes)
+{
+	for (int i = 0; i < bytes; i++) out->push_back((uint8_t)(bits >> (8 * i)));
+}
+
+// BC1 color block of 16 RGBA texels, always in four color mode
+static void bcEncodeColor(const uint8_t block[16][4], std::vector<uint8_t>* out)
+{
+	int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 }, mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		for (int k = 0; k < 3; k++) {
+			if (block[i][k] < lo[k]) lo[k] = block[i][k];
+			if (block[i][k] > hi[k]) hi[k] = block[i][k];
+			mean[k] += block[i][k];
+		}
+	}
+	for (int k = 0; k < 3; k++) {
+		mean[k] /= 16;
+		int inset = (hi[k] - lo[k]) >> 4;
+		lo[k] += inset;
+		hi[k] -= inset;
+	}
+
+	// Green and blue decreasing while red increases take the other diagonal
+	int cov_g = 0, cov_b = 0;
+	for (int i = 0; i < 16; i++) {
+		cov_g += (block[i][0] - mean[0]) * (block[i][1] - mean[1]);
+		cov_b += (block[i][0] - mean[0]) * (block[i][2] - mean[2]);
+	}
+	if (cov_g < 0) std::swap(lo[1], hi[1]);
+	if (cov_b < 0) std::swap(lo[2], hi[2]);
+
+	uint16_t c0 = bcPack565(hi), c1 = bcPack565(lo);
+	if (c0 < c1) std::swap(c0, c1);
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		int palette[4][3];
+		bcUnpack565(c0, palette[0]);
+		bcUnpack565(c1, palette[1]);
+		for (int k = 0; k < 3; k++) {
+			palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+			palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+		}
+		for (int i = 0; i < 16; i++) {
+			int best = 0, best_distance = 1 << 30;
+			for (int p = 0; p < 4; p++) {
+				int distance = 0;
+				for (int k = 0; k < 3; k++) distance += (block[i][k] - palette[p][k]) * (block[i][k] - palette[p][k]);
+				if (distance < best_distance) { best = p; best_distance = distance; }
+			}
+			indices |= (uint32_t)best << (2 * i);
+		}
+	}
+	bcPut(out, c0, 2);
+	bcPut(out, c1, 2);
+	bcPut(out, indices, 4);
+}
+
+// BC3 alpha block of 16 RGBA texels, in eight value mode
+static void bcEncodeAlpha(const uint8_t block[16][4], std::vector<uint8_t>* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++) {
+		if (block[i][3] > a0) a0 = block[i][3];
+		if (block[i][3] < a1) a1 = block[i][3];
+	}
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		int palette[8] = { a0, a1 };
+		for (int p = 2; p < 8; p++) palette[p] = ((8 - p) * a0 + (p - 1) * a1) / 7;
+		for (int i = 0; i < 16; i++) {
+			int best = 0, best_distance = 256;
+			for (int p = 0; p < 8; p++) {
+				int distance = abs(block[i][3] - palette[p]);
+				if (distance < best_distance) { best = p; best_distance = distance; }
+			}
+			indices |= (uint64_t)best << (3 * i);
+		}
+	}
+	out->push_back((uint8_t)a0);
+	out->push_back((uint8_t)a1);
+	bcPut(out, indices, 6);
+}
+
+void encodeLevel(const uint8_t* rgba, int w, int h, GLenum format, std::vector<uint8_t>* out)
+{
+	out->reserve(out->size() + compressedLevelSize(format, w, h));
+	uint8_t block[16][4];
+	for (int by = 0; by < h; by += 4) {
+		for (int bx = 0; bx < w; bx += 4) {
+			// Blocks past the edge repeat the last row and column
+			for (int y = 0; y < 4; y++) {
+				for (int x = 0; x < 4; x++) {
+					int sx = bx + x < w ? bx + x : w - 1, sy = by + y < h ? by + y : h - 1;
+					memcpy(block[4 * y + x], rgba + 4 * (sy * w + sx), 4);
+				}
+			}
+			if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) bcEncodeAlpha(block, out);
+			bcEncodeColor(block, out);
+		}
+	}
+}
+
+// Next level of the mipmap chain: each texel the mean of 2 x 2 of rgba (1 x 2 or 2 x 1 once a side is 1)
+static std::vector<uint8_t> halveImage(const uint8_t* rgba, int w, int h, int* half_w, int* half_h)
+{
+	*half_w = w > 1 ? w / 2 : 1;
+	*half_h = h > 1 ? h / 2 : 1;
+	std::vector<uint8_t> half(4 * *half_w * *half_h);
+	for (int y = 0; y < *half_h; y++) {
+		for (int x = 0; x < *half_w; x++) {
+			int x0 = 2 * x < w ? 2 * x : w - 1, x1 = 2 * x + 1 < w ? 2 * x + 1 : x0;
+			int y0 = 2 * y < h ? 2 * y : h - 1, y1 = 2 * y + 1 < h ? 2 * y + 1 : y0;
+			for (int k = 0; k < 4; k++) {
+				int sum = rgba[4 * (y0 * w + x0) + k] + rgba[4 * (y0 * w + x1) + k]
+				        + rgba[4 * (y1 * w + x0) + k] + rgba[4 * (y1 * w + x1) + k];
+				half[4 * (y * *half_w + x) + k] = (uint8_t)((sum + 2) / 4);
+			}
+		}
+	}
+	return half;
+}
+
+bool writeCompressedTexture(const char* path, const uint8_t* rgba, int w, int h)
+{
+	GLenum format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	for (long i = 0; i < (long)w * h; i++) {
+		if (rgba[4 * i + 3] != 255) {
+			format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			break;
+		}
+	}
+
+	ctex_header_t header = { { 'C', 'T', 'E', 'X' }, format, (uint32_t)w, (uint32_t)h, 1 };
+	std::vector<uint8_t> blocks;
+	encodeLevel(rgba, w, h, format, &blocks);
+	std::vector<uint8_t> level;
+	while (w > 1 || h > 1) {
+		level = halveImage(level.empty() ? rgba : level.data(), w, h, &w, &h);
+		encodeLevel(level.data(), w, h, format, &blocks);
+		header.levels++;
+	}
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) return false;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1
+	            && fwrite(blocks.data(), 1, blocks.size(), file) == blocks.size();
+	return fclose(file) == 0 && written;
+}
+
+std::string compressedTexturePath(const char* image)
+{
+	std::string path = image;
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) path.erase(dot);
+	return path + CTEX_EXTENSION;
+}
+
+bool compressTextureFile(const char* image)
+{
+	FIBITMAP* bitmap = FreeImage_Load(FreeImage_GetFileType(image, 0), image);
+	if (bitmap == NULL) return false;
+	FIBITMAP* bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
+	FreeImage_Unload(bitmap);
+	if (bitmap32 == NULL) return false;
+
+	// FreeImage rows are BGRA and may be padded
+	int w = FreeImage_GetWidth(bitmap32), h = FreeImage_GetHeight(bitmap32);
+	std::vector<uint8_t> rgba(4 * w * h);
+	for (int y = 0; y < h; y++) {
+		const uint8_t* row = FreeImage_GetBits(bitmap32) + y * FreeImage_GetPitch(bitmap32);
+		for (int x = 0; x < w; x++) {
+			uint8_t* texel = &rgba[4 * (y * w + x)];
+			texel[0] = row[4 * x + 2];
+			texel[1] = row[4 * x + 1];
+			texel[2] = row[4 * x];
+			texel[3] = row[4 * x + 3];
+		}
+	}
+	FreeImage_Unload(bitmap32);
+	return writeCompressedTexture(compressedTexturePath(image).c_str(), rgba.data(), w, h);
+}
+
+bool loadCompressedTexture(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+	ctex_header_t header;
+	std::vector<uint8_t> blocks;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "CTEX", 4) == 0
+	          && (header.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || header.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+	          && header.width > 0 && header.height > 0 && header.levels > 0;
+	if (valid) {
+		long start = ftell(file);
+		fseek(file, 0, SEEK_END);
+		blocks.resize(ftell(file) - start);
+		fseek(file, start, SEEK_SET);
+		valid = fread(blocks.data(), 1, blocks.size(), file) == blocks.size();
+	}
+	fclose(file);
+
+	// Every level must be there before the first is uploaded
+	size_t expected = 0;
+	for (uint32_t level = 0, w = header.width, h = header.height; valid && level < header.levels; level++) {
+		expected += compressedLevelSize(header.format, w, h);
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	if (!valid || expected != blocks.size()) return false;
+
+	size_t offset = 0;
+	for (uint32_t level = 0, w = header.width, h = header.height; level < header.levels; level++) {
+		GLsizei size = compressedLevelSize(header.format, w, h);
+		if (!renderer->compressedTexImage2D(GL_TEXTURE_2D, level, header.format, w, h, 0, size, blocks.data() + offset))
+			return false; // only the first level can fail, for want of S3TC
+		offset += size;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+	return true;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef TILEDTARGET
+#define TILEDTARGET
+/*
+	Tiled offscreen target.
+
+	Many small views are drawn into the tiles of one framebuffer, a grid of
+	columns x rows tiles of tile_width x tile_height pixels, tile 0 at the lower
+	left and rows filled first. The whole framebuffer is cleared once per frame
+	and each view only sets its viewport, so the views of a frame share every
+	bound object and are read back together.
+
+	Readback is asynchronous: the framebuffer is copied into one of
+	TILE_READBACKS pixel pack buffers and a fence is put after the copy. The
+	pixels are only mapped once the fence has signaled, usually a frame or two
+	later, so the GPU never waits for the CPU nor the CPU for the GPU. A frame:
+		if (tilesInFlight(target) == TILE_READBACKS) readTiles(target, &pixels, &frame, true);
+		beginTiles(target);
+		for each view: useTile(target, view); draw the view
+		endTiles(target);
+		while (readTiles(target, &pixels, &frame, false)) use pixels
+	and after the last one readTiles(..., true) until it returns false.
+*/
+
+#include <vector>
+#include <cstring>
+#include "Renderer.h"
+
+#define TILE_READBACKS 3
+#define TILE_PIXEL_BYTES 4 // BGRA
+
+typedef struct {
+	GLuint framebuffer, color, depth;
+	int tile_width, tile_height;
+	int columns, rows, tiles;
+	int width, height;                     // of the whole framebuffer
+	GLuint readbacks[TILE_READBACKS];      // pixel pack buffers
+	GLsync fences[TILE_READBACKS];         // after the copy into each, 0 if it holds nothing
+	long frames[TILE_READBACKS];           // frame copied into each
+	int oldest, in_flight;                 // readbacks not read yet, from oldest
+	long frame;                            // counts endTiles()
+} tiled_target_t;
+
+bool createTiledTarget(tiled_target_t* target, int tiles, int tile_width, int tile_height);
+/* Framebuffer for tiles views, as square a grid as possible. Returns false if
+   framebuffers are not supported                                           */
+
+void beginTiles(tiled_target_t* target);
+/* Binds the framebuffer and clears every tile */
+
+void useTile(tiled_target_t* target, int tile);
+/* Sets the viewport to tile */
+
+void endTiles(tiled_target_t* target);
+/* Starts the readback of the frame and binds the window framebuffer again.
+   A readback must be free: see tilesInFlight()                            */
+
+int tilesInFlight(const tiled_target_t* target);
+/* Frames read back but not collected with readTiles() */
+
+bool readTiles(tiled_target_t* target, std::vector<unsigned char>* pixels, long* frame, bool wait);
+/* Copies the oldest frame read back into pixels, if its copy has finished (or
+   waiting for it if wait), and frees its readback. Returns false if there is
+   none. Pixels are BGRA rows of the whole framebuffer, bottom to top        */
+
+void tilePixels(const tiled_target_t* target, const std::vector<unsigned char>& pixels, int tile, unsigned char* out);
+/* Copies the rows of tile out of pixels, bottom to top */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+bool createTiledTarget(tiled_target_t* target, int tiles, int tile_width, int tile_height)
+{
+	target->tiles = tiles;
+	target->tile_width = tile_width;
+	target->tile_height = tile_height;
+	target->columns = 1;
+	while (target->columns * target->columns < tiles) target->columns++;
+	target->rows = (tiles + target->columns - 1) / target->columns;
+	target->width = target->columns * tile_width;
+	target->height = target->rows * tile_height;
+
+	renderer->genFramebuffers(1, &target->framebuffer);
+	renderer->genRenderbuffers(1, &target->color);
+	renderer->genRenderbuffers(1, &target->depth);
+	renderer->bindRenderbuffer(GL_RENDERBUFFER, target->color);
+	renderer->renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, target->width, target->height);
+	renderer->bindRenderbuffer(GL_RENDERBUFFER, target->depth);
+	renderer->renderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, target->width, target->height);
+	renderer->bindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	renderer->framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->color);
+	renderer->framebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth);
+	bool complete = renderer->checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	GLsizeiptr size = (GLsizeiptr)target->width * target->height * TILE_PIXEL_BYTES;
+	renderer->genBuffers(TILE_READBACKS, target->readbacks);
+	for (int i = 0; i < TILE_READBACKS; i++) {
+		renderer->bufferData(target->readbacks[i], size, NULL, GL_STREAM_READ);
+		target->fences[i] = 0;
+		target->frames[i] = 0;
+	}
+	target->oldest = 0;
+	target->in_flight = 0;
+	target->frame = 0;
+	return complete;
+}
+
+void beginTiles(tiled_target_t* target)
+{
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	renderer->viewport(0, 0, target->width, target->height);
+	renderer->clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void useTile(tiled_target_t* target, int tile)
+{
+	int column = tile % target->columns, row = tile / target->columns;
+	renderer->viewport(column * target->tile_width, row * target->tile_height, target->tile_width, target->tile_height);
+}
+
+void endTiles(tiled_target_t* target)
+{
+	int next = (target->oldest + target->in_flight) % TILE_READBACKS;
+	if (target->in_flight < TILE_READBACKS) {
+		renderer->readPixelsToBuffer(0, 0, target->width, target->height, GL_BGRA, GL_UNSIGNED_BYTE, target->readbacks[next], 0);
+		target->fences[next] = renderer->fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		target->frames[next] = target->frame;
+		target->in_flight++;
+	}
+	target->frame++;
+	renderer->bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+int tilesInFlight(const tiled_target_t* target)
+{
+	return target->in_flight;
+}
+
+bool readTiles(tiled_target_t* target, std::vector<unsigned char>* pixels, long* frame, bool wait)
+{
+	if (target->in_flight == 0) return false;
+	int oldest = target->oldest;
+	GLsync fence = target->fences[oldest];
+	if (wait) {
+		GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		while (renderer->clientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED) flags = 0;
+	}
+	else {
+		GLenum status = renderer->clientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) return false;
+	}
+	renderer->deleteSync(fence);
+	target->fences[oldest] = 0;
+
+	GLsizeiptr size = (GLsizeiptr)target->width * target->height * TILE_PIXEL_BYTES;
+	pixels->resize(size);
+	const void* mapped = renderer->mapBufferRange(target->readbacks[oldest], 0, size, GL_MAP_READ_BIT);
+	if (mapped) {
+		memcpy(pixels->data(), mapped, size);
+		renderer->unmapBuffer(target->readbacks[oldest]);
+	}
+	*frame = target->frames[oldest];
+	target->oldest = (oldest + 1) % TILE_READBACKS;
+	target->in_flight--;
+	return mapped != NULL;
+}
+
+void tilePixels(const tiled_target_t* target, const std::vector<unsigned char>& pixels, int tile, unsigned char* out)
+{
+	int column = tile % target->columns, row = tile / target->columns;
+	size_t row_bytes = (size_t)target->tile_width * TILE_PIXEL_BYTES;
+	for (int y = 0; y < target->tile_height; y++) {
+		size_t offset = ((size_t)(row * target->tile_height + y) * target->width + column * target->tile_width) * TILE_PIXEL_BYTES;
+		memcpy(out + y * row_bytes, pixels.data() + offset, row_bytes);
+	}
+}
+
+#endif
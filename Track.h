@@ -0,0 +1,399 @@
+#ifndef TRACK
+#define TRACK
+/*
+	Track files.
+
+	A track describes the centreline of the road as X(Z), the half width of the
+	road and the intervals of Z holding tunnels and streetlamps. Track files are
+	memory mapped and queried in place: every table the queries need is
+	precomputed when the file is written, so loading a track costs the same
+	whatever its length.
+
+	Layout (native byte order, every section 8 byte aligned):
+		track_header_t
+		double           control_x[num_points]        X of the centreline at Z = i * spacing
+		double           arc_length[num_points + 1]   length of the centreline from Z = 0 to Z = i * spacing
+		track_interval_t tunnels[num_tunnels]         sorted and disjoint
+		track_lamps_t    lamps[num_lamp_intervals]    sorted and disjoint
+
+	Tracks are closed: the centreline is a uniform Catmull-Rom spline through the
+	control points, wrapping from the last one back to the first, and Z wraps at
+	num_points * spacing. The spline segment holding a Z is found in O(1), the
+	interval holding it and the Z at a given arc length by binary search.
+*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TRACK_MAGIC "MBTRACK1"
+#define TRACK_VERSION 1
+#define TRACK_MIN_LAMP_SPACING 10 // meters, bounds the lamps per meter of road
+#define TRACK_ARC_SAMPLES 16      // chords per spline segment when measuring arc length
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_points;
+	uint32_t num_tunnels;
+	uint32_t num_lamp_intervals;
+	double spacing;      // meters of Z between control points
+	double width;        // half width of the road
+	uint64_t num_lamps;  // in one lap
+	uint64_t num_signs;  // in one lap
+} track_header_t;
+
+typedef struct {
+	double start, end;   // [start, end)
+} track_interval_t;
+
+typedef struct {
+	double start, end;   // lamps at start, start + spacing, ... below end
+	double spacing;
+	uint32_t sign_every; // every sign_every-th lamp of the interval, starting with the first, carries a sign. 0 for none
+	uint32_t padding;
+	uint64_t first_lamp; // lamps in the previous intervals
+	uint64_t first_sign; // signs in the previous intervals
+} track_lamps_t;
+
+typedef struct {
+	const track_header_t* header; // NULL when no track is loaded
+	const double* control_x;
+	const double* arc_length;
+	const track_interval_t* tunnels;
+	const track_lamps_t* lamps;
+	double length;                // of one lap in Z
+	void* mapping;
+	size_t mapping_size;
+} track_t;
+
+typedef struct {
+	double z;
+	long long index;              // lamps since the start of the track, counting every lap
+	long long sign;               // signs since the start of the track, counting every lap. -1 if the lamp has none
+} track_lamp_t;
+
+bool loadTrack(track_t* track, const char* path);
+/* Maps the track file at path. Returns false and leaves track untouched if it
+   cannot be read or is not a valid track                                     */
+
+void unloadTrack(track_t* track);
+
+double trackX(const track_t* track, double z);
+/* X of the centreline at Z. O(1) */
+
+bool trackInTunnel(const track_t* track, double z);
+/* Whether Z is inside a tunnel. O(log num_tunnels) */
+
+bool trackTunnelAt(const track_t* track, double z, double* start, double* end);
+/* Like trackInTunnel, also giving the Z where the tunnel starts and ends */
+
+double trackArcLength(const track_t* track, double z);
+/* Length of the centreline from Z = 0 to z. O(1) */
+
+double trackZAtArcLength(const track_t* track, double s);
+/* Inverse of trackArcLength. O(log num_points) */
+
+int trackLamps(const track_t* track, double z0, double z1, track_lamp_t* lamps, int max_lamps);
+/* Stores in lamps the streetlamps with Z in [z0, z1), at most max_lamps of them,
+   and returns how many. O(log num_lamp_intervals + lamps found)               */
+
+bool writeTrack(const char* path, double width, double spacing, const std::vector<double>& control_x,
+                const std::vector<track_interval_t>& tunnels, const std::vector<track_lamps_t>& lamps);
+/* Writes a track file, computing arc lengths and lamp and sign counts. Intervals
+   must be sorted, disjoint and inside [0, control_x.size() * spacing)        */
+
+bool generateTrack(const char* path, double length, unsigned seed);
+/* Writes a random track about length meters long: a sum of sinusoids for the
+   centreline, tunnels every few kilometers and stretches of lamps and signs  */
+
+/********** IMPLEMENTATION ************************************************************************************************/
+
+static double catmullRom(double p0, double p1, double p2, double p3, double t)
+{
+	return 0.5 * (2 * p1 + (p2 - p0) * t + (2 * p0 - 5 * p1 + 4 * p2 - p3) * t * t + (3 * p1 - p0 - 3 * p2 + p3) * t * t * t);
+}
+
+static size_t trackFileSize(const track_header_t* h)
+{
+	return sizeof(track_header_t) + sizeof(double) * (2 * (size_t)h->num_points + 1)
+		+ sizeof(track_interval_t) * h->num_tunnels + sizeof(track_lamps_t) * h->num_lamp_intervals;
+}
+
+// Z folded into [0, length), laps counts the wraps
+static double trackWrap(const track_t* track, double z, long long* laps)
+{
+	double lap = floor(z / track->length);
+	if (laps) *laps = (long long)lap;
+	double u = z - lap * track->length;
+	return u < track->length ? u : 0;
+}
+
+bool loadTrack(track_t* track, const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "Fallo carga de circuito " << path << "\n";
+		return false;
+	}
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(track_header_t))
+		mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file
+	if (mapping == MAP_FAILED) {
+		std::cerr << "Fallo carga de circuito " << path << "\n";
+		return false;
+	}
+
+	const track_header_t* h = (const track_header_t*)mapping;
+	bool valid = memcmp(h->magic, TRACK_MAGIC, 8) == 0 && h->version == TRACK_VERSION
+		&& h->num_points >= 4 && h->spacing > 0 && h->width > 0
+		&& trackFileSize(h) == (size_t)st.st_size;
+	const track_lamps_t* lamps = (const track_lamps_t*)((const char*)mapping + trackFileSize(h)
+		- sizeof(track_lamps_t) * (valid ? h->num_lamp_intervals : 0));
+	for (uint32_t i = 0; valid && i < h->num_lamp_intervals; i++)
+		valid = lamps[i].spacing >= TRACK_MIN_LAMP_SPACING;
+	if (!valid) {
+		std::cerr << "Circuito no valido " << path << "\n";
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	track->header = h;
+	track->control_x = (const double*)(h + 1);
+	track->arc_length = track->control_x + h->num_points;
+	track->tunnels = (const track_interval_t*)(track->arc_length + h->num_points + 1);
+	track->lamps = lamps;
+	track->length = h->num_points * h->spacing;
+	track->mapping = mapping;
+	track->mapping_size = st.st_size;
+	return true;
+}
+
+void unloadTrack(track_t* track)
+{
+	if (track->header == NULL) return;
+	munmap(track->mapping, track->mapping_size);
+	track->header = NULL;
+}
+
+double trackX(const track_t* track, double z)
+{
+	int n = track->header->num_points;
+	double u = trackWrap(track, z, NULL) / track->header->spacing;
+	int i = (int)u;
+	if (i >= n) i = n - 1;
+	const double* p = track->control_x;
+	return catmullRom(p[(i + n - 1) % n], p[i], p[(i + 1) % n], p[(i + 2) % n], u - i);
+}
+
+// Index of the last interval starting at or before z, -1 if none
+template <typename T>
+static int lastIntervalBefore(const T* intervals, int count, double z)
+{
+	int lo = 0, hi = count; // first interval starting after z is in [lo, hi]
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (intervals[mid].start <= z) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo - 1;
+}
+
+bool trackInTunnel(const track_t* track, double z)
+{
+	double u = trackWrap(track, z, NULL);
+	int i = lastIntervalBefore(track->tunnels, track->header->num_tunnels, u);
+	return i >= 0 && u < track->tunnels[i].end;
+}
+
+bool trackTunnelAt(const track_t* track, double z, double* start, double* end)
+{
+	long long laps;
+	double u = trackWrap(track, z, &laps);
+	int i = lastIntervalBefore(track->tunnels, track->header->num_tunnels, u);
+	if (i < 0 || u >= track->tunnels[i].end)
+		return false;
+	*start = laps * track->length + track->tunnels[i].start;
+	*end = laps * track->length + track->tunnels[i].end;
+	return true;
+}
+
+double trackArcLength(const track_t* track, double z)
+{
+	long long laps;
+	double u = trackWrap(track, z, &laps) / track->header->spacing;
+	int n = track->header->num_points;
+	int i = (int)u;
+	if (i >= n) i = n - 1;
+	const double* s = track->arc_length;
+	// Arc length grows almost linearly within a segment
+	return laps * s[n] + s[i] + (s[i + 1] - s[i]) * (u - i);
+}
+
+double trackZAtArcLength(const track_t* track, double s)
+{
+	int n = track->header->num_points;
+	const double* a = track->arc_length;
+	double lap = floor(s / a[n]);
+	s -= lap * a[n];
+
+	int lo = 0, hi = n - 1; // segment i covers [a[i], a[i + 1])
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (a[mid] <= s) lo = mid;
+		else hi = mid - 1;
+	}
+	double t = a[lo + 1] > a[lo] ? (s - a[lo]) / (a[lo + 1] - a[lo]) : 0;
+	return lap * track->length + (lo + t) * track->header->spacing;
+}
+
+int trackLamps(const track_t* track, double z0, double z1, track_lamp_t* lamps, int max_lamps)
+{
+	const track_header_t* h = track->header;
+	int found = 0;
+	long long laps;
+	double lap_start = z0 - trackWrap(track, z0, &laps);
+
+	// One lap at a time, in case [z0, z1) crosses the end of the track
+	for (; lap_start < z1 && found < max_lamps; lap_start += track->length, laps++) {
+		double u0 = z0 - lap_start > 0 ? z0 - lap_start : 0;
+		double u1 = z1 - lap_start;
+		int i = lastIntervalBefore(track->lamps, h->num_lamp_intervals, u0);
+		if (i < 0 || u0 >= track->lamps[i].end) i++; // u0 is not inside interval i
+
+		for (; i < (int)h->num_lamp_intervals && track->lamps[i].start < u1 && found < max_lamps; i++) {
+			const track_lamps_t* interval = &track->lamps[i];
+			double first = u0 > interval->start ? ceil((u0 - interval->start) / interval->spacing) : 0;
+			for (long long k = (long long)first; found < max_lamps; k++) {
+				double u = interval->start + k * interval->spacing;
+				if (u >= interval->end || u >= u1) break;
+				track_lamp_t* lamp = &lamps[found++];
+				lamp->z = lap_start + u;
+				lamp->index = laps * (long long)h->num_lamps + interval->first_lamp + k;
+				lamp->sign = -1;
+				if (interval->sign_every > 0 && k % interval->sign_every == 0)
+					lamp->sign = laps * (long long)h->num_signs + interval->first_sign + k / interval->sign_every;
+			}
+		}
+	}
+	return found;
+}
+
+bool writeTrack(const char* path, double width, double spacing, const std::vector<double>& control_x,
+                const std::vector<track_interval_t>& tunnels, const std::vector<track_lamps_t>& lamps)
+{
+	int n = control_x.size();
+	if (n < 4) return false;
+
+	track_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRACK_MAGIC, 8);
+	h.version = TRACK_VERSION;
+	h.num_points = n;
+	h.num_tunnels = tunnels.size();
+	h.num_lamp_intervals = lamps.size();
+	h.spacing = spacing;
+	h.width = width;
+
+	// Arc length of each segment as the sum of TRACK_ARC_SAMPLES chords
+	std::vector<double> arc_length(n + 1, 0.0);
+	for (int i = 0; i < n; i++) {
+		double p0 = control_x[(i + n - 1) % n], p1 = control_x[i], p2 = control_x[(i + 1) % n], p3 = control_x[(i + 2) % n];
+		double length = 0, x = p1;
+		for (int j = 1; j <= TRACK_ARC_SAMPLES; j++) {
+			double next = catmullRom(p0, p1, p2, p3, (double)j / TRACK_ARC_SAMPLES);
+			length += sqrt((next - x) * (next - x) + (spacing / TRACK_ARC_SAMPLES) * (spacing / TRACK_ARC_SAMPLES));
+			x = next;
+		}
+		arc_length[i + 1] = arc_length[i] + length;
+	}
+
+	std::vector<track_lamps_t> counted = lamps;
+	for (size_t i = 0; i < counted.size(); i++) {
+		track_lamps_t* interval = &counted[i];
+		if (interval->spacing < TRACK_MIN_LAMP_SPACING) return false;
+		long long count = (long long)ceil((interval->end - interval->start) / interval->spacing);
+		interval->padding = 0;
+		interval->first_lamp = h.num_lamps;
+		interval->first_sign = h.num_signs;
+		h.num_lamps += count;
+		if (interval->sign_every > 0)
+			h.num_signs += (count + interval->sign_every - 1) / interval->sign_every;
+	}
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		std::cerr << "No se puede escribir " << path << "\n";
+		return false;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, file) == 1
+		&& fwrite(control_x.data(), sizeof(double), n, file) == (size_t)n
+		&& fwrite(arc_length.data(), sizeof(double), n + 1, file) == (size_t)n + 1
+		&& fwrite(tunnels.data(), sizeof(track_interval_t), tunnels.size(), file) == tunnels.size()
+		&& fwrite(counted.data(), sizeof(track_lamps_t), counted.size(), file) == counted.size();
+	return fclose(file) == 0 && ok;
+}
+
+bool generateTrack(const char* path, double length, unsigned seed)
+{
+	const double spacing = 10;
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> unit(0, 1);
+	int n = (int)(length / spacing);
+	if (n < 4) n = 4;
+	length = n * spacing;
+
+	// Centreline: bends of a few hundred meters over slow drifts of kilometers.
+	// Each period divides the length so that the track closes smoothly.
+	const double periods[] = { 300, 1100, 4700 }, amplitudes[] = { 10, 25, 60 };
+	double period[3], amplitude[3], phase[3];
+	for (int k = 0; k < 3; k++) {
+		double waves = floor(length / (periods[k] * (0.7 + 0.6 * unit(rng))));
+		period[k] = length / (waves > 1 ? waves : 1);
+		amplitude[k] = amplitudes[k] * (0.5 + unit(rng));
+		phase[k] = 2 * M_PI * unit(rng);
+	}
+	std::vector<double> control_x(n);
+	for (int i = 0; i < n; i++) {
+		control_x[i] = 0;
+		for (int k = 0; k < 3; k++)
+			control_x[i] += amplitude[k] * sin(2 * M_PI * i * spacing / period[k] + phase[k]);
+	}
+
+	// Tunnels of 150 to 800 m, 500 to 3000 m apart
+	std::vector<track_interval_t> tunnels;
+	for (double z = 500 + 2500 * unit(rng); ; z += 500 + 2500 * unit(rng)) {
+		track_interval_t tunnel = { z, z + 150 + 650 * unit(rng) };
+		if (tunnel.end >= length - 500) break;
+		tunnels.push_back(tunnel);
+		z = tunnel.end;
+	}
+
+	// Stretches of 1 to 5 km with lamps every 25 to 60 m and a sign every 6 to 12 lamps
+	std::vector<track_lamps_t> lamps;
+	for (double z = 30; z < length; ) {
+		track_lamps_t interval;
+		memset(&interval, 0, sizeof(interval));
+		interval.start = z;
+		interval.end = z + 1000 + 4000 * unit(rng);
+		if (interval.end > length) interval.end = length;
+		interval.spacing = 25 + (int)(35 * unit(rng));
+		interval.sign_every = 6 + (int)(7 * unit(rng));
+		lamps.push_back(interval);
+		z = interval.end + 100 + 900 * unit(rng);
+	}
+
+	return writeTrack(path, 8, spacing, control_x, tunnels, lamps);
+}
+
+#endif
@@ -1,12 +1,41 @@
 #define _USE_MATH_DEFINES
+#define GL_GLEXT_PROTOTYPES
 
 #include <iostream> 
 #include <iomanip>
 #include <cmath>
 #include <random>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
 #include <GL/freeglut.h>
 #include <sstream>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include "Track.h"
+#include "RideSimulation.h"
+#include "FramePacing.h"
+#include "Input.h"
+#include "DynamicResolution.h"
+#include "QualitySettings.h"
+#include "Benchmark.h"
+#include "Tessellator.h"
+#include "TaskPool.h"
+#include "StreamBuffer.h"
+#include "TextureCompression.h"
+#include "TiledTarget.h"
+#include "Telemetry.h"
+#include "PassTimer.h"
+#include "Microbench.h"
+#include "PropPool.h"
+#include "OffscreenContext.h"
 #include "Utilidades.h"
+#include "ClusteredLighting.h"
 
 /********************************* CONSTANTS *********************************/
 // Window
@@ -14,56 +43,74 @@
 #define WINDOW_WIDTH 854
 #define WINDOW_HEIGHT 480
 
-// General game behaviour
+// General game behaviour (the vehicle and the built-in road are in RideSimulation.h)
 #define FPS 60
-#define SPEED_INCREMENT 0.4f
-#define MAX_SPEED 30
-#define ANGLE_INCREMENT 0.5f
-#define MAX_ANGLE 45
 
 // Road
-#define ROAD_AMPLITUDE 10
-#define ROAD_PERIOD 300
-#define RENDER_DISTANCE 150
-#define ROAD_WIDTH 8
 #define ROAD_BORDER_HEIGHT 0.4f
 #define ROAD_TUNNEL_HEIGHT 4
 #define DISTANCE_BETWEEN_TUNNELS 800
 #define TUNNEL_LENGTH 400 
-#define NUM_STREETLAMPS 4
 #define LAMP_CYLINDER_RADIUS 0.2f
 #define NUM_LAMPS_BETWEEN_SIGNS 5
 #define SIGN_HEIGHT 4
 #define Z_BETWEEN_TREES 15
 #define X_BETWEEN_TREES 4.5f 
-#define NUM_TREES_X 4
 #define TREE_TRUNK_RADIUS 0.2f
 #define TREE_TRUNK_HEIGHT 3
 #define TREE_CONE_BASE 1
 #define TREE_CONE_HEIGHT 5
+#define TREE_VIEW_DISTANCE 100
 
-#define QUAD_DENSITY 4
+// Ground
+#define GROUND_Y -1
+#define GROUND_TILE_SIZE 50
+#define GROUND_TILES 9 // per side, odd so the camera tile is always the central one
+#define GROUND_TEXTURE_SIZE 15 // meters covered by one repetition of the grass texture
 
 // Lighting
 #define LAMP_HEIGHT ROAD_TUNNEL_HEIGHT
-#define DISTANCE_BETWEEN_LAMPS RENDER_DISTANCE / 4
-#define VEHICLE_PASSING_LAMP_DISTANCE DISTANCE_BETWEEN_LAMPS / 2
+#define DISTANCE_BETWEEN_LAMPS 37
+#define VEHICLE_PASSING_LAMP_DISTANCE (DISTANCE_BETWEEN_LAMPS / 2)
+#define LAMP_LIGHT_RANGE 25 // only used by clustered lighting, fixed function lamps do not attenuate
+#define LAMP_SPOT_EXPONENT 3.0f
+#define MAX_VISIBLE_STREETLAMPS MAX_CLUSTERED_LIGHTS
 
 // Camera
 #define FOV_Y 45
 #define Z_NEAR 1
-#define Z_FAR 200
 #define PLAYER_Y 1.0f
 #define THIRD_PERSON_Y 2.0f
 #define BIRDS_EYE_Y 50.0f
+#define MAX_VIEWPORTS 2
+#define MAX_COLLECTED_VIEWS 64 // views of one collectChunkDraws(), bits of chunk_draw_t::views
+#define PIP_SIZE 0.3f   // picture-in-picture inset, fraction of the window
+#define PIP_MARGIN 0.02f
 
 // Rain
-#define NUM_RAINDROPS 3000
 #define MIN_RAINDROP_SPEED 50
 #define MAX_RAINDROP_SPEED 500
 
+// World chunks
+#define WORLD_CHUNK_LENGTH 50
+#define WORLD_CHUNK_LOOKAHEAD 2 // seconds of travel generated beyond the render distance
+#define WORLD_CHUNK_SLOTS ((TUNNEL_LENGTH + MAX_RENDER_DISTANCE + MAX_SPEED * WORLD_CHUNK_LOOKAHEAD) / WORLD_CHUNK_LENGTH + 3)
+#define WORLD_CHUNK_NONE LLONG_MIN
+#define MAX_LAMPS_PER_CHUNK (WORLD_CHUNK_LENGTH / TRACK_MIN_LAMP_SPACING + 1)
+#define DYNAMIC_VERTICES (2 * MAX_RAINDROPS + 1024) // per frame: rain streaks and overlays
+#define WORLD_CHUNK_SEGMENTS 5 // pieces of road of a chunk generated as separate tasks
+#define WORLD_CHUNK_PARTS (WORLD_CHUNK_SEGMENTS + 1) // and one more with the streetlamps and signs
+#define LAMPS_PER_SIGN (NUM_LAMPS_BETWEEN_SIGNS + 4) // every LAMPS_PER_SIGN-th lamp carries a sign
+
+// Headless runs (null or recording renderer)
+#define HEADLESS_FRAMES 600
+#define HEADLESS_SEED 0 // fixed so that recorded command streams of two builds can be diffed
+#define VIEW_WIDTH 160   // tiles of --views
+#define VIEW_HEIGHT 90
+#define VIEW_SPACING 5   // meters between the rides of --views
+#define SWEEP_WARMUP_FRAMES 60 // not measured, the first frames generate every chunk in range
+
 // Others
-#define HIGH_DETAIL_VIEW_DISTANCE 50
 #define SECOND_IN_MILLIS 1000.0f
 #define X 0
 #define Y 1
@@ -77,14 +124,98 @@ typedef struct {
     float length;
 } raindrop_t;
 
+typedef enum { PLAYER_VIEW, THIRD_PERSON_VIEW, BIRDS_EYE_VIEW, NUM_CAMERA_MODES } camera_mode_t;
+
+// A view of the frame: its camera mode and its part of the window, as
+// fractions of the window from the lower left corner
+typedef struct {
+    camera_mode_t camera;
+    float x, y, width, height;
+} viewport_t;
+
+typedef enum { ROADSIDE_LAMP, SIGN_LAMP, TUNNEL_LAMP } lamp_kind_t;
+
+typedef struct {
+    GLfloat position[4];
+    GLfloat direction[3];
+    lamp_kind_t kind;
+} streetlamp_t;
+
+typedef struct {
+    int tile[2];  // world tile coordinates (X, Z) held by this slot
+    GLuint list;  // display list with the geometry of the tile
+} ground_tile_t;
+
+typedef enum {
+    ROAD_HIGH_DETAIL_MESH, ROAD_LOW_DETAIL_MESH, ROAD_BORDER_MESH,
+    TUNNEL_WALL_MESH, TUNNEL_CEILING_MESH,
+    SUPPORT_MESH, TREE_TRUNK_MESH, TREE_CROWN_MESH, LAMP_MESH, SIGN_MESH,
+    NUM_CHUNK_MESHES
+} chunk_mesh_t;
+
+// Indexed triangles, 8 floats per vertex: position, normal, texture coordinates
+typedef tess_batch_t mesh_t;
+
+// Contents of a chunk as generated by the task pool. Each part is a separate
+// task writing only its own meshes
+typedef struct {
+    long long index;                                   // covers absolute Z [index, index + 1) * WORLD_CHUNK_LENGTH
+    mesh_t meshes[WORLD_CHUNK_PARTS][NUM_CHUNK_MESHES]; // Z relative to the start of the chunk
+    float part_x_range[WORLD_CHUNK_PARTS][2];
+    streetlamp_t lamps[MAX_LAMPS_PER_CHUNK];           // Z relative to the start of the chunk
+    int num_lamps;
+    int sign;                                          // number of the sign hanging in the chunk, -1 if none
+    float x_range[2];                                  // of all the meshes
+    task_count_t parts_left;                           // while its tasks run
+} chunk_data_t;
+
+// A chunk ready to draw
+typedef struct {
+    long long index;      // chunk held by this slot
+    long long requested;  // chunk last asked to the worker for this slot
+    bool resident;
+    GLuint lists;         // NUM_CHUNK_MESHES consecutive display lists
+    bool has_mesh[NUM_CHUNK_MESHES];
+    float x_range[2];
+    int props[MAX_LAMPS_PER_CHUNK]; // handles of its streetlamps in roadside_props
+    int num_props;
+    int sign;
+} world_chunk_t;
+
+// What the camera can see this frame. Inside a tunnel the walls hide everything
+// but the tunnel itself and what lies beyond the exit, seen through its portal.
+typedef struct {
+    bool in_tunnel;
+    bool portal_visible;   // exit closer than the far clipping plane
+    float camera[2];       // X and Z of the camera
+    float exit_z;          // local Z of the exit portal
+    float portal_x;        // X of the centre of the exit portal
+} visibility_t;
+
+// A chunk mesh to draw this frame and the viewports that see it
+typedef struct {
+    GLuint list;
+    float z;               // of the chunk, in the floating origin
+    int sign;
+    unsigned long long views; // bit v set if view v sees it
+} chunk_draw_t;
+
 /******************************** PROTOTYPES *********************************/
 // Rain 
 void initializeRaindrop(raindrop_t*);
 void createRaindrops(void);
-void updateAndRenderRain(void);
+int updateAndRenderRain(void);
+void redrawRain(int, int);
 
 // Tunnel
+bool outsideTunnelAt(long long);
 bool outsideTunnel(int);
+bool tunnelAround(long long, double*, double*);
+int lampsBetween(long long, long long, track_lamp_t*, int);
+double roadDistance(double);
+
+// Floating origin
+double absoluteZ(float);
 
 // Materials & Textures
 void loadTextures(void);
@@ -99,48 +230,107 @@ void setTunnelWallMaterialAndTexture(void);
 void setTunnelCeilingMaterialAndTexture(void);
 
 // Road
+float roadTracingAt(long long, float);
 float road_tracing(float);
-bool insideRoadBorder(float, float);
-void drawCylindricalSupport(GLfloat*, GLfloat, GLfloat, GLfloat);
 void displayRoad(int);
+void collectChunkDraws(int, const visibility_t*, int);
+void drawChunks(int);
+
+// Meshes
+void meshCone(mesh_t*, GLfloat*, GLfloat, GLfloat, int, int);
+void meshSphere(mesh_t*, GLfloat*, GLfloat, int, int);
+
+// Generation of chunk contents (task pool, no GL calls)
+void buildCylindricalSupport(mesh_t*, GLfloat*, GLfloat, GLfloat, GLfloat);
+void buildSignSupports(mesh_t*, long long, float, float);
+void buildSign(mesh_t*, long long, float);
+void buildRoad(mesh_t*, long long, int, int, int);
+void buildRoadWall(mesh_t*, long long, int, int, float);
+void buildRoadCeiling(mesh_t*, long long, int, float);
+void buildTrees(mesh_t*, long long, int, int);
+void buildStreetlamp(chunk_data_t*, mesh_t*, long long, const track_lamp_t*);
+void buildChunkPart(chunk_data_t*, int, const quality_tier_t*);
+void finishChunk(chunk_data_t*);
+void buildChunk(chunk_data_t*, long long, const quality_tier_t*);
+void submitChunk(chunk_data_t*, long long, const quality_tier_t*, bool, task_count_t*);
+
+// World chunks (render thread)
+void startWorldChunks(bool, int);
+void clearWorldChunks(void);
+void stopWorldChunks(void);
+world_chunk_t* chunkSlot(long long);
+void chunkRange(float, long long*, long long*);
+void uploadChunk(world_chunk_t*, chunk_data_t*);
+void updateWorldChunks(void);
+void setChunkMeshMaterialAndTexture(int);
 
 // Rendering of elements
-void renderSignSupports(float, float);
-void renderSign(float);
-void renderLamp(float, float, float);
-void renderRoad(int, int, int);
-void renderRoadWall(int, int, float);
-void renderRoadCeiling(int, float);
 void renderSkyline(int);
-void renderGround(float);
+void compileGroundTile(ground_tile_t*, int, int);
+void renderGround(void);
 void renderWindArrow(void);
+void streamQuadtex(GLfloat*, GLfloat*, GLfloat*, GLfloat*, GLfloat = 0, GLfloat = 1, GLfloat = 0, GLfloat = 1, int = 10, int = 10);
 void renderArrow(void);
-bool atHighQualityRoadPosition(int);
 
 // Configuration of scene
+void updateVisibility(void);
+bool visibleOutdoors(const visibility_t*, float, float, float);
+bool chunkVisible(const visibility_t*, long long, const world_chunk_t*);
+void updateStreetlamps(float, float);
+void setupClusteredLighting(void);
 void configureRoad(void);
+void applyQuality(const quality_tier_t*);
+void applyQualityTier(int);
+void setProjection(void);
 void configureMoonlight(void);
 void configureHeadlight(void);
 void setupLighting(void);
-
-// Trees
-void renderTrees(float);
-void renderTree(GLfloat*);
-bool atTreePosition(int);
+void setCameraMode(camera_mode_t);
+camera_mode_t nextCameraMode(camera_mode_t);
+void placeView(void);
+void renderScene(void);
+int layoutViewports(viewport_t*);
+void viewportRect(const viewport_t*, const GLint*, GLint*);
+void renderViewports(const viewport_t*, int);
 
 // Showing of elements
 void showControls(void);
 void showHUD(void);
+void showPassTimes(void);
 void showBike(void);
 
+// Frame pacing
+void renderFrameHistogram(void);
+void printFrameStats(void);
+
+// Telemetry
+void recordTelemetry(double, int);
+void stopTelemetry(void);
+
+// Headless
+int elapsedMillis(void);
+void resetRide(void);
+double headlessFrame(void);
+void runHeadless(int);
+bool runSweep(const sweep_t*, int, const char*, const char*);
+void autopilot(const ride_observations_t*, ride_actions_t*, int);
+void runSimulation(int, int);
+void placeCamera(const ride_batch_t*, int);
+bool runViews(int, int, int, int, const char*, bool);
+bool runMicrobenchmarks(const char*);
+
 /***************************** GLOBAL VARIABLES ******************************/
 // Modes
 static int draw_mode; // GL_LINE or GL_FILL
-static enum {PLAYER_VIEW, THIRD_PERSON_VIEW, BIRDS_EYE_VIEW} camera_mode;
+static camera_mode_t camera_mode;
 static enum {CLEAR, RAINFALL} weather_mode;
 static enum {AXIS_ON, AXIS_OFF} axis_mode;
 static enum {COLLISIONS, NO_COLLISIONS} collision_mode;
 static enum {HUD_ON, HUD_OFF} hud_mode;
+static enum {TIMINGS_OFF, TIMINGS_ON} timings_mode; // CPU and GPU time of each pass in the HUD
+static enum {CLUSTERED_LIGHTING, FIXED_LIGHTING} lighting_mode;
+static enum {NATIVE_RESOLUTION, SCALED_RESOLUTION} resolution_mode; // scene drawn at window size or through scene_target
+static enum {SINGLE_VIEW, SPLIT_SCREEN, PICTURE_IN_PICTURE} view_layout; // viewports of the frame, see layoutViewports()
 
 // Vehicle physics
 static float speed = 0.0;
@@ -148,8 +338,21 @@ static float velocity[3] = { 0.0, 1.0, 1.0 };
 static float position[3] = { 0.0, 1.0, 0.0 };
 static float turn_angle = 0;
 
-// Rain particles
-static raindrop_t raindrops[NUM_RAINDROPS];
+// Floating origin: absolute Z = origin_z + local Z. Everything handed to GL and
+// all per-frame math uses the local coordinate, which stays below REBASE_DISTANCE.
+static long long origin_z = 0;
+
+// Headless runs have no GLUT window or event loop and use a simulated clock
+static bool headless = false;
+static int headless_time = 0; // ms
+
+// Quality settings in use and the governor choosing them
+static quality_tier_t quality = QUALITY_TIERS[DEFAULT_QUALITY_TIER];
+static quality_governor_t quality_governor;
+static float aspect_ratio = (float)WINDOW_WIDTH / WINDOW_HEIGHT;
+
+// Rain particles, the first quality.num_raindrops fall
+static raindrop_t raindrops[MAX_RAINDROPS];
 static float rain_velocity[3] = { 0.0, -1.0, 0.0 };
 
 // Textures
@@ -167,63 +370,126 @@ GLuint tex_arrow;
 static std::random_device rd;     // only used once to initialise (seed) engine
 static std::mt19937 rng(rd());    // random-number engine used (Mersenne-Twister in this case)
 
+// World chunks. Slots are addressed modulo WORLD_CHUNK_SLOTS by chunk index.
+// The tasks only touch the chunk_data_t they build and the result queue.
+static world_chunk_t world_chunks[WORLD_CHUNK_SLOTS];
+static bool world_threaded = false;              // chunks ahead generated in the background
+static task_pool_t world_tasks;
+static std::mutex world_mutex;
+static std::vector<chunk_data_t*> world_results; // generated, waiting for upload
+static int world_threads = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1;
+
+// Frame scheduling and frame time statistics
+static frame_pacer_t frame_pacer;
+
+// Arrow keys, polled by the simulation, and their latency
+static input_state_t input;
+
+// CPU and GPU time of the passes of the frame
+static pass_timer_t pass_timer;
+
+// Per-frame metrics for monitoring, exported off the render thread
+static telemetry_t telemetry;
+static int scene_draws = 0; // display lists and solids drawn this frame, streamed geometry is counted apart
+
+// Vertices regenerated every frame
+static stream_buffer_t dynamic_geometry;
+static const GLfloat OVERLAY_NORMAL[] = { 0, 0, 1 }; // facing the orthographic camera
+
+// Offscreen target of the 3D scene when its resolution is scaled
+static scene_target_t scene_target = { 0, 0, 0, 0, 0, 1.0f, true, 0, 0 };
+
+// Visibility of the current frame (of the viewport being drawn)
+static visibility_t visibility;
+
+// Chunk meshes of the frame by mesh kind, in the order they are drawn
+static std::vector<chunk_draw_t> chunk_draws[NUM_CHUNK_MESHES];
+
+// Road layout: the built-in road unless a track file is loaded
+static track_t track;
+static ride_road_t ride_road = { NULL, ROAD_WIDTH };
+
 // Other
-static int lamps[] = { GL_LIGHT2, GL_LIGHT3, GL_LIGHT4, GL_LIGHT5 };
-static int num_sidelengths_passed = 1;
+static int lamps[MAX_FIXED_STREETLAMPS] = { GL_LIGHT2, GL_LIGHT3, GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7 };
+static prop_pool_t roadside_props; // streetlamps of the resident chunks, type is their lamp_kind_t
+static streetlamp_t streetlamps[MAX_VISIBLE_STREETLAMPS]; // lamps to render this frame
+static int num_streetlamps = 0;
+static int lit_streetlamps = 0; // lamps[0, lit_streetlamps) enabled
+static GLfloat lamp_ambient[]  = { 0.7, 0.7, 0.7, 1.0 };
+static GLfloat lamp_diffuse[]  = { 0.8, 0.8, 0.8, 1.0 };
+static GLfloat lamp_specular[] = { 0.3, 0.3, 0.3, 1.0 };
+static ground_tile_t ground_tiles[GROUND_TILES][GROUND_TILES]; // toroidal grid around the camera
 
 /***************************** HELPER FUNCTIONS ******************************/
 
-bool atTreePosition(int z) {
-    return outsideTunnel(z) && 
-        z % Z_BETWEEN_TREES == 0 && 
-        z - position[Z] < 100; 
-}
-
-void renderTree(GLfloat* tree_position) {
-    glPushMatrix();
-    setSupportMaterialAndTexture();
-    drawCylindricalSupport(
-            tree_position,
-            TREE_TRUNK_RADIUS,
-            TREE_TRUNK_HEIGHT, 
-            20
-         );
-    glPopMatrix();
-    glPushMatrix();
-    glPushAttrib(GL_CURRENT_BIT);
-    glColor3f(0.2, 1.0, 0.2);
-    glTranslatef(tree_position[X], tree_position[Y]+TREE_TRUNK_HEIGHT, tree_position[Z]);
-    glRotatef(-90, 1, 0, 0);
-    glutSolidCone(TREE_CONE_BASE, TREE_CONE_HEIGHT, 10, 10);
-    glPopAttrib();
-    glPopMatrix();
-}
-
-void renderTrees(float z) {
-    for (int i = 1; i < NUM_TREES_X; i++) {
-        GLfloat left_tree[]  = { road_tracing(z) + ROAD_WIDTH + X_BETWEEN_TREES * i, -2, z };
-        GLfloat right_tree[] = { road_tracing(z) - ROAD_WIDTH - X_BETWEEN_TREES * i, -2, z };
-        renderTree(left_tree);
-        renderTree(right_tree);
-    }
+int positiveModulo(int a, int n) {
+    return ((a % n) + n) % n; // % is not mod op
+}
+
+bool outsideTunnelAt(long long absolute_z) {
+    if (track.header != NULL)
+        return absolute_z <= 0 || !trackInTunnel(&track, absolute_z);
+    return (absolute_z > 0 && 
+            absolute_z % (DISTANCE_BETWEEN_TUNNELS + TUNNEL_LENGTH) < DISTANCE_BETWEEN_TUNNELS) 
+        || absolute_z <= 0;
 }
 
 bool outsideTunnel(int z) {
-    return (z > 0 && 
-            z % (DISTANCE_BETWEEN_TUNNELS + TUNNEL_LENGTH) < DISTANCE_BETWEEN_TUNNELS) 
-        || z <= 0;
+    return outsideTunnelAt(origin_z + z);
+}
+
+// Absolute Z where the tunnel around absolute_z starts and ends. False outside tunnels
+bool tunnelAround(long long absolute_z, double* start, double* end) {
+    if (outsideTunnelAt(absolute_z))
+        return false;
+    if (track.header != NULL)
+        return trackTunnelAt(&track, absolute_z, start, end);
+
+    long long period = DISTANCE_BETWEEN_TUNNELS + TUNNEL_LENGTH;
+    *start = absolute_z - absolute_z % period + DISTANCE_BETWEEN_TUNNELS;
+    *end = *start + TUNNEL_LENGTH;
+    return true;
+}
+
+// Streetlamps with absolute Z in (max(z0, 0), z1), nearest first
+int lampsBetween(long long z0, long long z1, track_lamp_t* found, int max_found) {
+    if (z0 < 1) z0 = 1;
+    if (track.header != NULL)
+        return trackLamps(&track, z0, z1, found, max_found);
+
+    // Built-in road: lamps at multiples of DISTANCE_BETWEEN_LAMPS, every
+    // LAMPS_PER_SIGN-th one with a sign
+    int count = 0;
+    for (long long k = (z0 + DISTANCE_BETWEEN_LAMPS - 1) / DISTANCE_BETWEEN_LAMPS; 
+         k * DISTANCE_BETWEEN_LAMPS < z1 && count < max_found; k++) {
+        found[count].z = k * DISTANCE_BETWEEN_LAMPS;
+        found[count].index = k;
+        found[count].sign = k % LAMPS_PER_SIGN == 0 ? k / LAMPS_PER_SIGN - 1 : -1;
+        count++;
+    }
+    return count;
+}
+
+// Distance travelled along the road up to absolute Z
+double roadDistance(double absolute_z) {
+    return track.header != NULL ? trackArcLength(&track, absolute_z) : absolute_z;
+}
+
+double absoluteZ(float z) {
+    return origin_z + (double)z;
 }
 
+
 void initializeRaindrop(raindrop_t* raindrop) {
     static std::uniform_int_distribution<int> speed_uni(MIN_RAINDROP_SPEED, MAX_RAINDROP_SPEED);
 
     static std::uniform_int_distribution<int> X_uni(-20, 20);
     static std::uniform_int_distribution<int> Y_uni(3, 7);
-    static std::uniform_int_distribution<int> Z_uni(1.5, RENDER_DISTANCE / 3);
+    static std::uniform_int_distribution<int> Z_uni;
 
     raindrop->position[X] = X_uni(rng);
     raindrop->position[Y] = Y_uni(rng); 
-    raindrop->position[Z] = Z_uni(rng);
+    raindrop->position[Z] = Z_uni(rng, std::uniform_int_distribution<int>::param_type(1.5, quality.render_distance / 3));
 
     raindrop->speed = speed_uni(rng);
     raindrop->length = (raindrop->speed / (MAX_RAINDROP_SPEED * 3 )) ;
@@ -237,7 +503,7 @@ raindrop_t createNewRaindrop() {
 }
 
 void createRaindrops() {
-    for (int i = 0; i < NUM_RAINDROPS; i++) {
+    for (int i = 0; i < quality.num_raindrops; i++) {
         raindrops[i] = createNewRaindrop();
     }
 }
@@ -256,8 +522,13 @@ void createRain() {
     createRaindrops();
 }
 
-void updateAndRenderRain() {
-    for (int i = 0; i < NUM_RAINDROPS; i++) {
+// Streaks are written into the stream of dynamic geometry and drawn at once.
+// Returns the number of vertices drawn.
+int updateAndRenderRain() {
+    static const GLfloat up[] = { 0, 1, 0 };
+    GLfloat* streaks = streamVertices(&dynamic_geometry, 2 * quality.num_raindrops);
+    GLfloat* next = streaks;
+    for (int i = 0; i < quality.num_raindrops; i++) {
         // Update
         raindrops[i].position[X] += raindrops[i].speed*rain_velocity[X] / SECOND_IN_MILLIS;
         raindrops[i].position[Y] += raindrops[i].speed*rain_velocity[Y] / SECOND_IN_MILLIS;
@@ -265,370 +536,351 @@ void updateAndRenderRain() {
 
         if (!outsideTunnel(raindrops[i].position[Z]+position[Z]))
             continue;
+        if (!visibleOutdoors(&visibility, raindrops[i].position[X], raindrops[i].position[X], raindrops[i].position[Z] + position[Z]))
+            continue;
 
         if (raindrops[i].position[Y] <= 0) {
             initializeRaindrop(raindrops + i);
         }
 
-        // Draw raindrop
-        glPushMatrix();
-        glPushAttrib(GL_CURRENT_BIT);
-        glColor3f(0.1, 0.1, 1.0);
-        glBegin(GL_LINES);
-        glVertex3f(
+        if (streaks == NULL)
+            continue;
+        next = streamPut(next,
                 raindrops[i].position[X], 
                 raindrops[i].position[Y], 
-                raindrops[i].position[Z] + position[Z]
+                raindrops[i].position[Z] + position[Z],
+                up
             );
-        glVertex3f(
+        next = streamPut(next,
                 raindrops[i].position[X] + raindrops[i].length*rain_velocity[X],
                 raindrops[i].position[Y] + raindrops[i].length*rain_velocity[Y],
-                raindrops[i].position[Z] + position[Z] + raindrops[i].length*rain_velocity[Z]
+                raindrops[i].position[Z] + position[Z] + raindrops[i].length*rain_velocity[Z],
+                up
             );
-        glEnd();
-        glPopAttrib();
-        glPopMatrix();
-     
     }
+
+    renderer->pushAttrib(GL_CURRENT_BIT);
+    renderer->color3f(0.1, 0.1, 1.0);
+    int count = (next - streaks) / STREAM_VERTEX_FLOATS;
+    streamDraw(&dynamic_geometry, GL_LINES, count);
+    renderer->popAttrib();
+    return count;
+}
+
+// The streaks drawn by updateAndRenderRain() again, from another viewport
+void redrawRain(int first, int count) {
+    renderer->pushAttrib(GL_CURRENT_BIT);
+    renderer->color3f(0.1, 0.1, 1.0);
+    streamRedraw(&dynamic_geometry, GL_LINES, first, count);
+    renderer->popAttrib();
+}
+// Into the bound texture: the block-compressed version of image if there is one
+// (--compress-textures) and S3TC is supported, image itself otherwise
+void loadTexture(const char* image) {
+    if (!loadCompressedTexture(compressedTexturePath(image).c_str()))
+        loadImageFile((char*)image);
 }
+
 void loadTextures() {
 
-    glGenTextures(1, &tex_road);
-	glBindTexture(GL_TEXTURE_2D, tex_road);
-	loadImageFile((char*)"assets/road.jpg");
+    renderer->genTextures(1, &tex_road);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_road);
+	loadTexture("assets/road.jpg");
     
-    glGenTextures(1, &tex_bike_pov);
-	glBindTexture(GL_TEXTURE_2D, tex_bike_pov);
-	loadImageFile((char*)"assets/bike_pov.png");
+    renderer->genTextures(1, &tex_bike_pov);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_bike_pov);
+	loadTexture("assets/bike_pov.png");
 
-    glGenTextures(1, &tex_bike_bev);
-	glBindTexture(GL_TEXTURE_2D, tex_bike_bev);
-	loadImageFile((char*)"assets/bike_bev.png");
+    renderer->genTextures(1, &tex_bike_bev);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_bike_bev);
+	loadTexture("assets/bike_bev.png");
 
-    glGenTextures(1, &tex_bike_tpv);
-	glBindTexture(GL_TEXTURE_2D, tex_bike_tpv);
-	loadImageFile((char*)"assets/bike_tpv.png");
+    renderer->genTextures(1, &tex_bike_tpv);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_bike_tpv);
+	loadTexture("assets/bike_tpv.png");
 
-    glGenTextures(1, &tex_ground);
-	glBindTexture(GL_TEXTURE_2D, tex_ground);
-	loadImageFile((char*)"assets/grass.jpg");
+    renderer->genTextures(1, &tex_ground);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_ground);
+	loadTexture("assets/grass.jpg");
 
-    glGenTextures(1, &tex_road_border);
-	glBindTexture(GL_TEXTURE_2D, tex_road_border);
-	loadImageFile((char*)"assets/road_border.jpg");
+    renderer->genTextures(1, &tex_road_border);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_road_border);
+	loadTexture("assets/road_border.jpg");
 
-    glGenTextures(1, &tex_support);
-	glBindTexture(GL_TEXTURE_2D, tex_support);
-	loadImageFile((char*)"assets/wood.jpg");
+    renderer->genTextures(1, &tex_support);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_support);
+	loadTexture("assets/wood.jpg");
 
-    glGenTextures(1, &tex_lamp);
-	glBindTexture(GL_TEXTURE_2D, tex_lamp);
-	loadImageFile((char*)"assets/cream_white.jpg");
+    renderer->genTextures(1, &tex_lamp);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_lamp);
+	loadTexture("assets/cream_white.jpg");
 
-    glGenTextures(1, &tex_sign1);
-	glBindTexture(GL_TEXTURE_2D, tex_sign1);
-	loadImageFile((char*)"assets/welcome_to_paradise.jpg");
+    renderer->genTextures(1, &tex_sign1);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_sign1);
+	loadTexture("assets/welcome_to_paradise.jpg");
 
-    glGenTextures(1, &tex_sign2);
-	glBindTexture(GL_TEXTURE_2D, tex_sign2);
-	loadImageFile((char*)"assets/pain_natural.jpg");
+    renderer->genTextures(1, &tex_sign2);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_sign2);
+	loadTexture("assets/pain_natural.jpg");
 
-    glGenTextures(1, &tex_sign3);
-	glBindTexture(GL_TEXTURE_2D, tex_sign3);
-	loadImageFile((char*)"assets/no_indep.jpg");
+    renderer->genTextures(1, &tex_sign3);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_sign3);
+	loadTexture("assets/no_indep.jpg");
 
-    glGenTextures(1, &tex_sign4);
-	glBindTexture(GL_TEXTURE_2D, tex_sign4);
-	loadImageFile((char*)"assets/consume.jpg");
+    renderer->genTextures(1, &tex_sign4);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_sign4);
+	loadTexture("assets/consume.jpg");
 
-    glGenTextures(1, &tex_sign5);
-	glBindTexture(GL_TEXTURE_2D, tex_sign5);
-	loadImageFile((char*)"assets/marry_reproduce.jpg");
+    renderer->genTextures(1, &tex_sign5);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_sign5);
+	loadTexture("assets/marry_reproduce.jpg");
 
-    glGenTextures(1, &tex_sign6);
-	glBindTexture(GL_TEXTURE_2D, tex_sign6);
-	loadImageFile((char*)"assets/obey.jpg");
+    renderer->genTextures(1, &tex_sign6);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_sign6);
+	loadTexture("assets/obey.jpg");
 
-    glGenTextures(1, &tex_lamp);
-	glBindTexture(GL_TEXTURE_2D, tex_lamp);
-	loadImageFile((char*)"assets/cream_white.jpg");
+    renderer->genTextures(1, &tex_lamp);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_lamp);
+	loadTexture("assets/cream_white.jpg");
 
-    glGenTextures(1, &tex_tunnel_wall);
-	glBindTexture(GL_TEXTURE_2D, tex_tunnel_wall);
-	loadImageFile((char*)"assets/tunnel_wall.jpg");
+    renderer->genTextures(1, &tex_tunnel_wall);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_tunnel_wall);
+	loadTexture("assets/tunnel_wall.jpg");
     
-    glGenTextures(1, &tex_tunnel_ceiling);
-	glBindTexture(GL_TEXTURE_2D, tex_tunnel_ceiling);
-	loadImageFile((char*)"assets/tunnel_ceiling.jpg");
-
-    glGenTextures(1, &tex_skyline);
-	glBindTexture(GL_TEXTURE_2D, tex_skyline);
-	loadImageFile((char*)"assets/background_skyline_long.jpg");
-
-    glGenTextures(1, &tex_arrow);
-	glBindTexture(GL_TEXTURE_2D, tex_arrow);
-	loadImageFile((char*)"assets/arrow.png");
-}
+    renderer->genTextures(1, &tex_tunnel_ceiling);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_tunnel_ceiling);
+	loadTexture("assets/tunnel_ceiling.jpg");
 
-float road_tracing(float u) {
-    return ROAD_AMPLITUDE + ROAD_AMPLITUDE * sin(2 * M_PI * (u - ROAD_PERIOD / 4) / ROAD_PERIOD);
-}
+    renderer->genTextures(1, &tex_skyline);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_skyline);
+	loadTexture("assets/background_skyline_long.jpg");
 
-bool insideRoadBorder(float nextX, float nextZ) {
-    bool left_of_right_border = (nextX <= road_tracing(nextZ) + ROAD_WIDTH - 0.7);
-    bool right_of_left_border = (nextX >= road_tracing(nextZ) - ROAD_WIDTH + 0.7);
-    return (left_of_right_border && right_of_left_border);
+    renderer->genTextures(1, &tex_arrow);
+	renderer->bindTexture(GL_TEXTURE_2D, tex_arrow);
+	loadTexture("assets/arrow.png");
 }
 
-void drawCylindricalSupport(GLfloat* pos, GLfloat radius, GLfloat height, GLfloat slices) {
-    GLfloat h0, h1, x, z;
-
-    for (int i = 0; i < slices; i++) {
-        h0 = ((float)i)     * 2.0 * M_PI / slices;
-        h1 = ((float)i + 1) * 2.0 * M_PI / slices;
-        
-        GLfloat v0[3] = { pos[0] + radius * cos(h0), pos[1], pos[2] + radius * sin(h0) }; // bottom left
-        GLfloat v1[3] = { pos[0] + radius * cos(h1), pos[1], pos[2] + radius * sin(h1) }; // bottom right
-        GLfloat v2[3] = { pos[0] + radius * cos(h0), pos[1] + height, pos[2] + radius * sin(h0) }; // top left
-        GLfloat v3[3] = { pos[0] + radius * cos(h1), pos[1] + height, pos[2] + radius * sin(h1) }; // top right
-        quadtex(v3, v2, v0, v1, 0, 1, 0, 1, 1, 1);
-    }
+// X of the centre of the road at Z = base + u. Only base % ROAD_PERIOD matters
+// for the built-in road, which keeps the argument small at any distance.
+float roadTracingAt(long long base, float u) {
+    return rideRoadX(&ride_road, base, u);
 }
 
-void renderSignSupports(float z, float height) {
-    drawCylindricalSupport(
-            new GLfloat[] { road_tracing(z) + ROAD_WIDTH, 0, z }, 
-            LAMP_CYLINDER_RADIUS,
-            height, 
-            20
-         );
-    drawCylindricalSupport(
-            new GLfloat[] { road_tracing(z) - ROAD_WIDTH, 0, z }, 
-            LAMP_CYLINDER_RADIUS,
-            height, 
-            20
-         );
+float road_tracing(float u) {
+    return roadTracingAt(origin_z, u);
 }
 
 void setArrowMaterialAndTexture() {
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 2;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
-    glBindTexture(GL_TEXTURE_2D, tex_arrow);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    renderer->bindTexture(GL_TEXTURE_2D, tex_arrow);
+    renderer->blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 }
 
 void setSupportMaterialAndTexture() {
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 2;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
-
-    glBindTexture(GL_TEXTURE_2D, tex_support);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-}
-
-void renderSign(float z) {
-    GLfloat top_right[] = {
-        road_tracing(z) + ROAD_WIDTH, 
-        LAMP_HEIGHT + SIGN_HEIGHT, 
-        z
-    };
-    GLfloat top_left[]  =  { 
-        road_tracing(z) - ROAD_WIDTH, 
-        LAMP_HEIGHT + SIGN_HEIGHT, 
-        z
-    };
-    GLfloat bottom_left[] = { 
-        road_tracing(z) - ROAD_WIDTH, 
-        LAMP_HEIGHT - 0.1, 
-        z
-    };
-    GLfloat bottom_right[] = { 
-        road_tracing(z) + ROAD_WIDTH, 
-        LAMP_HEIGHT - 0.1, 
-        z
-    };
-
-    quadtex(top_right, top_left, bottom_left, bottom_right, 0, 1, 1, 0, 1, 1);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+
+    renderer->bindTexture(GL_TEXTURE_2D, tex_support);
+	renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
 void setSignMaterialAndTexture(int signs_passed) {
 
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 2;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
     // Choose sign texture
     if (signs_passed == 0) {
-        glBindTexture(GL_TEXTURE_2D, tex_sign1);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_sign1);
     }
     else if (signs_passed == 1) {
-        glBindTexture(GL_TEXTURE_2D, tex_sign2);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_sign2);
     }
     else if (signs_passed % 4 == 0){
-        glBindTexture(GL_TEXTURE_2D, tex_sign3);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_sign3);
     }
     else if (signs_passed % 4 == 1) {
-        glBindTexture(GL_TEXTURE_2D, tex_sign4);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_sign4);
     }
     else if (signs_passed % 4 == 2){
-        glBindTexture(GL_TEXTURE_2D, tex_sign5);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_sign5);
     }
     else if (signs_passed % 4 == 3) {
-        glBindTexture(GL_TEXTURE_2D, tex_sign6);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_sign6);
     }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-}
-
-void renderLamp(float x, float y, float z) {
-    glTranslatef(x, y, z);
-    glutSolidSphere(0.4, 10, 10);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
 void setLampMaterialAndTexture() {
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 10;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
-    glBindTexture(GL_TEXTURE_2D, tex_lamp);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    renderer->bindTexture(GL_TEXTURE_2D, tex_lamp);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
-// Configures lighting, adds geometry to lighting and controls where signs appear 
-void configureRoad() {
-    // TODO: fix spheres with no light
-    static float SL_z[NUM_STREETLAMPS] = { DISTANCE_BETWEEN_LAMPS, 
-                                           2 * DISTANCE_BETWEEN_LAMPS, 
-                                           3 * DISTANCE_BETWEEN_LAMPS,
-                                           4 * DISTANCE_BETWEEN_LAMPS
-                                    }; 
-    static int first_SL = 0;
-    static int count_SL_since_last_sign = 0;
-    static int sign_index = -1; // index in SL_z of z position of the sign 
-    static int signs_passed = 0;
-
-    // Rotate lamp positions to render next lamp in correct position
-    if (position[Z] > (SL_z[first_SL] + VEHICLE_PASSING_LAMP_DISTANCE)) {
-        SL_z[first_SL] += NUM_STREETLAMPS * DISTANCE_BETWEEN_LAMPS;
-        first_SL = (first_SL + 1) % 4;
-        count_SL_since_last_sign++;
-        
-        // The sign must not be rendered after we passed enough lamps
-        if (sign_index != -1 && count_SL_since_last_sign > NUM_STREETLAMPS - 1) {
-            sign_index = -1;
-            count_SL_since_last_sign = 0;
-            signs_passed++;
-        }
+void updateVisibility() {
+    float camera_y = camera_mode == THIRD_PERSON_VIEW ? THIRD_PERSON_Y : position[Y];
+    double start, end;
+
+    visibility.camera[0] = position[X];
+    visibility.camera[1] = position[Z];
+    visibility.in_tunnel = camera_y < ROAD_TUNNEL_HEIGHT 
+        && tunnelAround((long long)floor(absoluteZ(position[Z])), &start, &end);
+    if (visibility.in_tunnel) {
+        visibility.exit_z = (float)(end - origin_z);
+        visibility.portal_x = road_tracing(visibility.exit_z);
+        visibility.portal_visible = visibility.exit_z - position[Z] < quality.z_far;
     }
-    
-    // Check if sign should be rendered 
-    if (count_SL_since_last_sign == NUM_LAMPS_BETWEEN_SIGNS) {
-        sign_index = (NUM_STREETLAMPS + first_SL - 1) % NUM_STREETLAMPS; // % is not mod op
-        count_SL_since_last_sign = 0;
-    }
-   
-    // By default we assume the lamps are not in a tunnel 
-    GLfloat positions_SL[NUM_STREETLAMPS][4] = {
-        { road_tracing(SL_z[0]) + ROAD_WIDTH, LAMP_HEIGHT, SL_z[0], 1.0 },
-        { road_tracing(SL_z[1]) - ROAD_WIDTH, LAMP_HEIGHT, SL_z[1], 1.0 },
-        { road_tracing(SL_z[2]) + ROAD_WIDTH, LAMP_HEIGHT, SL_z[2], 1.0 },
-        { road_tracing(SL_z[3]) - ROAD_WIDTH, LAMP_HEIGHT, SL_z[3], 1.0 }
-    };
-
-    GLfloat directions_SL[NUM_STREETLAMPS][3] = {
-        { -1.0, -1.0, 0.0 }, // left one directs light to the right
-        {  1.0, -1.0, 0.0 }, // right one directs light to the left
-        { -1.0, -1.0, 0.0 },  
-        {  1.0, -1.0, 0.0 }
-    };
-
-    // Geometric structures holding lamps
-    for (int i = 0; i < NUM_STREETLAMPS; i++) {
-        // Render sign
-        if (i == sign_index && outsideTunnel(SL_z[i])) {
-            glPushMatrix();
-            setSupportMaterialAndTexture();
-            renderSignSupports(SL_z[sign_index], LAMP_HEIGHT + SIGN_HEIGHT);
-            glPopMatrix();
+}
 
-            // Rectangle that will contain the texture
-            glPushMatrix();
-            setSignMaterialAndTexture(signs_passed);
-            renderSign(SL_z[sign_index]);
-            glPopMatrix();
+// Whether something outside the tunnel walls, spanning [x_min, x_max] and
+// reaching far_z, can be seen. From inside a tunnel it has to be beyond the
+// exit and inside the wedge of lines of sight through the portal.
+bool visibleOutdoors(const visibility_t* seen, float x_min, float x_max, float far_z) {
+    if (!seen->in_tunnel)
+        return true;
+    if (!seen->portal_visible || far_z <= seen->exit_z)
+        return false;
+
+    float k = (far_z - seen->camera[1]) / (seen->exit_z - seen->camera[1]);
+    float left  = seen->camera[0] + (seen->portal_x - ride_road.half_width - seen->camera[0]) * k;
+    float right = seen->camera[0] + (seen->portal_x + ride_road.half_width - seen->camera[0]) * k;
+    return x_max >= left && x_min <= right;
+}
 
-            positions_SL[i][X] = road_tracing(SL_z[i]); // sign lamp goes on middle
-            directions_SL[i][X] = 0.0; // pointing down
-        }
-        // Render lamp supports for outside tunnel
-        else if (outsideTunnel(SL_z[i])) {
-            glPushMatrix();
-            setSupportMaterialAndTexture();
+bool chunkVisible(const visibility_t* seen, long long index, const world_chunk_t* chunk) {
+    if (!seen->in_tunnel)
+        return true;
+
+    float near_z = (float)(index * WORLD_CHUNK_LENGTH - origin_z);
+    float far_z = near_z + WORLD_CHUNK_LENGTH;
+    if (far_z <= seen->camera[1])
+        return false; // behind the camera, past the entry portal
+    if (near_z < seen->exit_z)
+        return true;  // holds part of the tunnel
+    return visibleOutdoors(seen, chunk->x_range[0], chunk->x_range[1], far_z);
+}
 
-            drawCylindricalSupport(
-                    new GLfloat[] { positions_SL[i][X], 0, positions_SL[i][Z] }, 
-                    LAMP_CYLINDER_RADIUS,
-                    LAMP_HEIGHT, 
-                    20
-                );
-            glPopMatrix();
-        }
-        // Do not render anything else, tunnel geometry supports lamps
-        else {
-            positions_SL[i][X] = road_tracing(SL_z[i]); // lamps in tunnel go on middle
-            directions_SL[i][X] = 0.0; // and they point straight down
-        }
+// Chooses the streetlamps that light this frame among those of the resident
+// chunks in range of cameras spread from rear_z to front_z (local Z): all of
+// them in clustered mode, the nearest ones ahead of the rear camera otherwise.
+// Culling is one pass over the Z of every prop of the pool.
+void updateStreetlamps(float rear_z, float front_z) {
+    bool clustered = lighting_mode == CLUSTERED_LIGHTING && clusteredLightingSupported();
+    int max_lamps = clustered ? MAX_VISIBLE_STREETLAMPS : quality.streetlamps;
+    double near_z = absoluteZ(rear_z) - VEHICLE_PASSING_LAMP_DISTANCE;
+    double far_z = absoluteZ(front_z) + quality.render_distance;
+    prop_pool_t* pool = &roadside_props;
+
+    static std::vector<int> in_range;
+    in_range.clear();
+    for (int row = 0; row < pool->count; row++) {
+        bool culled = pool->z[row] < near_z || pool->z[row] > far_z;
+        pool->lod[row] = culled ? PROP_CULLED : PROP_IN_RANGE;
+        pool->light[row] = -1;
+        if (!culled)
+            in_range.push_back(row);
     }
-    
-    // Lamps themselves
-    for (int i = 0; i < NUM_STREETLAMPS; i++) {
-        glLightfv(lamps[i], GL_SPOT_DIRECTION, directions_SL[i]);
-	    glLightfv(lamps[i], GL_POSITION, positions_SL[i]);
-        glPushMatrix();
-        setLampMaterialAndTexture();
-        renderLamp(positions_SL[i][X], positions_SL[i][Y], positions_SL[i][Z]);
-        glPopMatrix();
+
+    // Rows are in no particular order, lights go to the nearest lamps first
+    std::sort(in_range.begin(), in_range.end(), [pool](int a, int b) {
+        return pool->z[a] < pool->z[b] || (pool->z[a] == pool->z[b] && pool->x[a] < pool->x[b]);
+    });
+    num_streetlamps = 0;
+    for (size_t i = 0; i < in_range.size() && num_streetlamps < max_lamps; i++) {
+        int row = in_range[i];
+        streetlamp_t* lamp = &streetlamps[num_streetlamps];
+        lamp->position[X] = pool->x[row];
+        lamp->position[Y] = LAMP_HEIGHT;
+        lamp->position[Z] = (float)(pool->z[row] - origin_z);
+        lamp->position[3] = 1.0;
+        lamp->direction[X] = -pool->side[row];
+        lamp->direction[Y] = -1.0;
+        lamp->direction[Z] = 0.0;
+        lamp->kind = (lamp_kind_t)pool->type[row];
+        pool->lod[row] = PROP_LIT;
+        pool->light[row] = num_streetlamps++;
+    }
+}
+
+// Hands every streetlamp of this frame to the clustered lighting shader
+void setupClusteredLighting() {
+    clusteredLightingBeginFrame();
+    for (int i = 0; i < num_streetlamps; i++) {
+        clusteredLightingAdd(
+                streetlamps[i].position,
+                streetlamps[i].direction,
+                LAMP_LIGHT_RANGE,
+                LAMP_SPOT_EXPONENT
+            );
     }
+    clusteredLightingUse(lamp_ambient, lamp_diffuse, lamp_specular);
 }
 
 
+// Points the fixed function streetlights at the lamps of this frame and turns
+// off those left without one (all of them with clustered lighting). Lamp and
+// sign geometry is part of the chunk meshes.
+void configureRoad() {
+    bool clustered = lighting_mode == CLUSTERED_LIGHTING && clusteredLightingSupported();
+    int lit = clustered ? 0 : num_streetlamps;
+    for (int i = lit; i < lit_streetlamps; i++) {
+        renderer->disable(lamps[i]);
+    }
+    for (int i = lit_streetlamps; i < lit; i++) {
+        renderer->enable(lamps[i]);
+    }
+    lit_streetlamps = lit;
+
+    for (int i = 0; i < lit; i++) {
+        renderer->lightfv(lamps[i], GL_SPOT_DIRECTION, streetlamps[i].direction);
+        renderer->lightfv(lamps[i], GL_POSITION, streetlamps[i].position);
+    }
+}
+
 void configureMoonlight() {
     static GLfloat ML_position[] = { 0.0, 10.0, 0.0, 0.0 };
-	glLightfv(GL_LIGHT0, GL_POSITION, ML_position);
+	renderer->lightfv(GL_LIGHT0, GL_POSITION, ML_position);
 }
 
 void configureHeadlight() {
     static GLfloat HL_position[] = { 0.0, 0.7, 0.0, 1.0 };
     static GLfloat HL_direction[] = { 0.0, -0.3, -0.6 };
-	glLightfv(GL_LIGHT1, GL_POSITION, HL_position);
-    glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, HL_direction);
+	renderer->lightfv(GL_LIGHT1, GL_POSITION, HL_position);
+    renderer->lightfv(GL_LIGHT1, GL_SPOT_DIRECTION, HL_direction);
 }
 
 void showControls() {
@@ -636,236 +888,711 @@ void showControls() {
     std::cout << "\tArrows: control vehicle movement." << "\n";
     std::cout << "\t'S' or 's': toggle between solid and wire drawing modes." << "\n";
     std::cout << "\t'P' or 'p': cycle between player view, third person view and birds-eye view." << "\n";
+    std::cout << "\t'V' or 'v': cycle between one view, split screen and picture-in-picture." << "\n";
     std::cout << "\t'Y' or 'y': randomly change the wind." << "\n";
     std::cout << "\t'L' or 'l': toggle between night and day." << "\n";
     std::cout << "\t'D' or 'd': toggle between active and inactive collision for the road." << "\n";
     std::cout << "\t'W' or 'w': toggle between clear and rainy weather." << "\n";
     std::cout << "\t'N' or 'n': toggle between fog and no fog." << "\n";
     std::cout << "\t'C' or 'c': show/hide HUD." << "\n";
+    std::cout << "\t'T' or 't': show/hide the CPU and GPU time of each rendering pass." << "\n";
     std::cout << "\t'E' or 'e': show/hide axis vectors." << "\n";
+    std::cout << "\t'K' or 'k': toggle between clustered and fixed function lighting." << "\n";
+    std::cout << "\t'R' or 'r': toggle between dynamic and native resolution of the scene." << "\n";
+    std::cout << "\t'Q' or 'q': cycle between automatic quality and each quality tier." << "\n";
     std::cout << "\tESC: exit." << "\n";
 }
 
-void renderGround(float sidelength) {
-    if (position[Z] + RENDER_DISTANCE > sidelength*num_sidelengths_passed) {
-        num_sidelengths_passed++;
+// Builds the tile at world tile coordinates (tile_x, tile_z) into the given slot.
+// Geometry is local to the tile corner, texture coordinates are in world space
+// so neighbouring tiles are seamless.
+void compileGroundTile(ground_tile_t* slot, int tile_x, int tile_z) {
+    if (slot->list == 0) {
+        slot->list = renderer->genLists(1);
     }
-    setGroundMaterialAndTexture();
-    GLfloat top_right[] = {
-        sidelength * num_sidelengths_passed, 
-        -1, 
-        sidelength * num_sidelengths_passed
-    };
-    GLfloat top_left[]  =  { 
-        -sidelength * num_sidelengths_passed,
-        -1,
-        sidelength * num_sidelengths_passed
-    };
-    GLfloat bottom_left[] = { 
-        -sidelength * num_sidelengths_passed,
-        -1,
-        -sidelength * num_sidelengths_passed
-    };
-    GLfloat bottom_right[] = { 
-        sidelength * num_sidelengths_passed,
-        -1,
-        -sidelength * num_sidelengths_passed
-    };
-
-    quadtex(top_right, top_left, bottom_left, bottom_right, 20, 0, 20, 0, 1, 1);
+    slot->tile[0] = tile_x;
+    slot->tile[1] = tile_z;
+
+    float tiles_per_texture = (float)GROUND_TEXTURE_SIZE / GROUND_TILE_SIZE;
+    float s0 = std::fmod(tile_x / tiles_per_texture, 1.0f);
+    float t0 = std::fmod(tile_z / tiles_per_texture, 1.0f);
+    if (s0 < 0) s0 += 1;
+    if (t0 < 0) t0 += 1;
+    float repeats = 1 / tiles_per_texture;
+
+    GLfloat top_right[]    = { GROUND_TILE_SIZE, 0, GROUND_TILE_SIZE };
+    GLfloat top_left[]     = { 0,                0, GROUND_TILE_SIZE };
+    GLfloat bottom_left[]  = { 0,                0, 0 };
+    GLfloat bottom_right[] = { GROUND_TILE_SIZE, 0, 0 };
+
+    renderer->newList(slot->list, GL_COMPILE);
+    quadtex(top_right, top_left, bottom_left, bottom_right, 
+            s0 + repeats, s0, t0 + repeats, t0, 1, 1);
+    renderer->endList();
 }
 
-void renderSkyline(int radius) {
-    static GLUquadric *quadric;
-    quadric = gluNewQuadric();
+// Draws a fixed GROUND_TILES x GROUND_TILES grid of tiles centred on the camera.
+// Slots are addressed modulo the grid size, so moving forward only recompiles
+// the row of tiles that wrapped around. Tile coordinates are absolute so slots
+// survive origin rebasing.
+void renderGround() {
+    int center_x = (int)std::floor(position[X] / GROUND_TILE_SIZE);
+    int center_z = (int)std::floor(absoluteZ(position[Z]) / GROUND_TILE_SIZE);
 
-    glPushMatrix();
-	glBindTexture(GL_TEXTURE_2D, tex_skyline);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	gluQuadricTexture(quadric, 1);
+    setGroundMaterialAndTexture();
+    for (int i = -GROUND_TILES / 2; i <= GROUND_TILES / 2; i++) {
+        for (int j = -GROUND_TILES / 2; j <= GROUND_TILES / 2; j++) {
+            int tile_x = center_x + i;
+            int tile_z = center_z + j;
+            ground_tile_t* slot = &ground_tiles[positiveModulo(tile_x, GROUND_TILES)]
+                                               [positiveModulo(tile_z, GROUND_TILES)];
+
+            float tile_far_z = (float)((double)(tile_z + 1) * GROUND_TILE_SIZE - origin_z);
+            if (!visibleOutdoors(&visibility, tile_x * GROUND_TILE_SIZE, (tile_x + 1) * GROUND_TILE_SIZE, tile_far_z))
+                continue;
+
+            if (slot->list == 0 || slot->tile[0] != tile_x || slot->tile[1] != tile_z) {
+                compileGroundTile(slot, tile_x, tile_z);
+            }
 
-	glTranslatef(position[X], -30, position[Z]);
-    glRotatef(91, 0, 1, 0);
-	glRotatef(-90, 1, 0, 0);
-	gluCylinder(quadric, radius, radius, 110, 50, 50);
-	glPopMatrix();
+            renderer->pushMatrix();
+            renderer->translatef(tile_x * GROUND_TILE_SIZE, GROUND_Y, (float)((double)tile_z * GROUND_TILE_SIZE - origin_z));
+            renderer->callList(slot->list);
+            scene_draws++;
+            renderer->popMatrix();
+        }
+    }
+}
+
+void renderSkyline(int radius) {
+    renderer->pushMatrix();
+	renderer->bindTexture(GL_TEXTURE_2D, tex_skyline);
+	renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	renderer->translatef(position[X], -30, position[Z]);
+    renderer->rotatef(91, 0, 1, 0);
+	renderer->rotatef(-90, 1, 0, 0);
+	renderer->texturedCylinder(radius, radius, 110, 50, 50);
+	renderer->popMatrix();
+    scene_draws++;
 }
 
 void setGroundMaterialAndTexture() {
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 2;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
-    glBindTexture(GL_TEXTURE_2D, tex_ground);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    renderer->bindTexture(GL_TEXTURE_2D, tex_ground);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
 void setRoadMaterialAndTexture() {
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 2;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
-    glBindTexture(GL_TEXTURE_2D, tex_road);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    renderer->bindTexture(GL_TEXTURE_2D, tex_road);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
 void setRoadBorderMaterialAndTexture() {
-    static GLfloat D[] = { 0.8, 0.8, 0.8 };
-    static GLfloat S[] = { 0.3, 0.3, 0.3 };
+    static GLfloat D[] = { 0.8, 0.8, 0.8, 1.0 };
+    static GLfloat S[] = { 0.3, 0.3, 0.3, 1.0 };
     static float BE = 5;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
-    glBindTexture(GL_TEXTURE_2D, tex_road_border);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    renderer->bindTexture(GL_TEXTURE_2D, tex_road_border);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
 void setTunnelWallMaterialAndTexture() {
-    static GLfloat D[] = { 0.6, 0.6, 0.6 };
-    static GLfloat S[] = { 0.5, 0.5, 0.5 };
+    static GLfloat D[] = { 0.6, 0.6, 0.6, 1.0 };
+    static GLfloat S[] = { 0.5, 0.5, 0.5, 1.0 };
     static float BE = 4;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
 
-    glBindTexture(GL_TEXTURE_2D, tex_tunnel_wall);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    renderer->bindTexture(GL_TEXTURE_2D, tex_tunnel_wall);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
 }
 
 void setBikeTexture() {
     if (camera_mode == PLAYER_VIEW)
-        glBindTexture(GL_TEXTURE_2D, tex_bike_pov);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_bike_pov);
     else if (camera_mode == BIRDS_EYE_VIEW)
-        glBindTexture(GL_TEXTURE_2D, tex_bike_bev);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_bike_bev);
     else
-        glBindTexture(GL_TEXTURE_2D, tex_bike_tpv);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+        renderer->bindTexture(GL_TEXTURE_2D, tex_bike_tpv);
+    renderer->blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
 }
 
 void setTunnelCeilingMaterialAndTexture() {
-    static GLfloat D[] = { 0.6, 0.6, 0.6 };
-    static GLfloat S[] = { 0.5, 0.5, 0.5 };
+    static GLfloat D[] = { 0.6, 0.6, 0.6, 1.0 };
+    static GLfloat S[] = { 0.5, 0.5, 0.5, 1.0 };
     static float BE = 2;
 
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, D);
+    renderer->materialfv(GL_FRONT_AND_BACK, GL_SPECULAR, S);
+    renderer->materialf(GL_FRONT_AND_BACK, GL_SHININESS, BE);
+
+    renderer->bindTexture(GL_TEXTURE_2D, tex_tunnel_ceiling);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    renderer->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    renderer->texEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+}
+
+/********** Meshes **********/
+// Quads go through tessQuad() and loose triangles through tessVertex() (Tessellator.h)
+
+// Upright cone with its base centred at base_center, like glutSolidCone rotated to point up
+void meshCone(mesh_t* mesh, GLfloat* base_center, GLfloat radius, GLfloat height, int slices, int stacks) {
+    float slant = sqrt(radius * radius + height * height);
+    float ny = radius / slant, nr = height / slant;
+    for (int i = 0; i < stacks; i++) {
+        float r0 = radius * (1 - (float)i / stacks),       y0 = height * i / stacks;
+        float r1 = radius * (1 - (float)(i + 1) / stacks), y1 = height * (i + 1) / stacks;
+        for (int j = 0; j < slices; j++) {
+            float a0 = 2 * M_PI * j / slices, a1 = 2 * M_PI * (j + 1) / slices;
+            GLfloat p[4][3] = { { base_center[X] + r0 * cos(a1), base_center[Y] + y0, base_center[Z] + r0 * sin(a1) },
+                                { base_center[X] + r0 * cos(a0), base_center[Y] + y0, base_center[Z] + r0 * sin(a0) },
+                                { base_center[X] + r1 * cos(a0), base_center[Y] + y1, base_center[Z] + r1 * sin(a0) },
+                                { base_center[X] + r1 * cos(a1), base_center[Y] + y1, base_center[Z] + r1 * sin(a1) } };
+            GLfloat n[4][3] = { { nr * (float)cos(a1), ny, nr * (float)sin(a1) }, { nr * (float)cos(a0), ny, nr * (float)sin(a0) },
+                                { nr * (float)cos(a0), ny, nr * (float)sin(a0) }, { nr * (float)cos(a1), ny, nr * (float)sin(a1) } };
+            int order[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; k++)
+                tessVertex(mesh, p[order[k]], n[order[k]], 0, 0);
+        }
+    }
+    // Base
+    GLfloat down[] = { 0, -1, 0 };
+    for (int j = 0; j < slices; j++) {
+        float a0 = 2 * M_PI * j / slices, a1 = 2 * M_PI * (j + 1) / slices;
+        GLfloat p0[] = { base_center[X] + radius * (float)cos(a0), base_center[Y], base_center[Z] + radius * (float)sin(a0) };
+        GLfloat p1[] = { base_center[X] + radius * (float)cos(a1), base_center[Y], base_center[Z] + radius * (float)sin(a1) };
+        tessVertex(mesh, base_center, down, 0, 0);
+        tessVertex(mesh, p0, down, 0, 0);
+        tessVertex(mesh, p1, down, 0, 0);
+    }
+}
+
+void meshSphere(mesh_t* mesh, GLfloat* center, GLfloat radius, int slices, int stacks) {
+    for (int i = 0; i < stacks; i++) {
+        float b0 = M_PI * i / stacks - M_PI / 2, b1 = M_PI * (i + 1) / stacks - M_PI / 2;
+        for (int j = 0; j < slices; j++) {
+            float a0 = 2 * M_PI * j / slices, a1 = 2 * M_PI * (j + 1) / slices;
+            GLfloat n[4][3] = { { (float)(cos(b0) * cos(a1)), (float)sin(b0), (float)(cos(b0) * sin(a1)) },
+                                { (float)(cos(b0) * cos(a0)), (float)sin(b0), (float)(cos(b0) * sin(a0)) },
+                                { (float)(cos(b1) * cos(a0)), (float)sin(b1), (float)(cos(b1) * sin(a0)) },
+                                { (float)(cos(b1) * cos(a1)), (float)sin(b1), (float)(cos(b1) * sin(a1)) } };
+            GLfloat p[4][3];
+            for (int c = 0; c < 4; c++)
+                for (int k = 0; k < 3; k++)
+                    p[c][k] = center[k] + radius * n[c][k];
+            int order[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; k++)
+                tessVertex(mesh, p[order[k]], n[order[k]], 0, 0);
+        }
+    }
+}
+
+/********** Generation of chunk contents **********/
+// Everything below only depends on its arguments and runs on the worker thread.
+// Z is relative to the start of the chunk, absolute Z is base + z.
+
+void buildCylindricalSupport(mesh_t* mesh, GLfloat* pos, GLfloat radius, GLfloat height, GLfloat slices) {
+    GLfloat h0, h1;
 
-    glBindTexture(GL_TEXTURE_2D, tex_tunnel_ceiling);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    for (int i = 0; i < slices; i++) {
+        h0 = ((float)i)     * 2.0 * M_PI / slices;
+        h1 = ((float)i + 1) * 2.0 * M_PI / slices;
+        
+        GLfloat v0[3] = { pos[0] + radius * cos(h0), pos[1], pos[2] + radius * sin(h0) }; // bottom left
+        GLfloat v1[3] = { pos[0] + radius * cos(h1), pos[1], pos[2] + radius * sin(h1) }; // bottom right
+        GLfloat v2[3] = { pos[0] + radius * cos(h0), pos[1] + height, pos[2] + radius * sin(h0) }; // top left
+        GLfloat v3[3] = { pos[0] + radius * cos(h1), pos[1] + height, pos[2] + radius * sin(h1) }; // top right
+        tessQuad(mesh, v3, v2, v0, v1, 0, 1, 0, 1, 1, 1);
+    }
 }
 
-void renderRoad(int z, int horizontal_slices, int vertical_slices) {
-    GLfloat next_left[3]  = { road_tracing(z + 1) + ROAD_WIDTH, 0, (float)z + 1 };
-    GLfloat next_right[3] = { road_tracing(z + 1) - ROAD_WIDTH, 0, (float)z + 1 };
-    GLfloat this_right[3] = { road_tracing(z    ) - ROAD_WIDTH, 0, (float)z };
-    GLfloat this_left[3]  = { road_tracing(z    ) + ROAD_WIDTH, 0, (float)z };
+void buildSignSupports(mesh_t* mesh, long long base, float z, float height) {
+    GLfloat left[]  = { roadTracingAt(base, z) + ride_road.half_width, 0, z };
+    GLfloat right[] = { roadTracingAt(base, z) - ride_road.half_width, 0, z };
+    buildCylindricalSupport(mesh, left, LAMP_CYLINDER_RADIUS, height, 20);
+    buildCylindricalSupport(mesh, right, LAMP_CYLINDER_RADIUS, height, 20);
+}
+
+void buildSign(mesh_t* mesh, long long base, float z) {
+    GLfloat top_right[]    = { roadTracingAt(base, z) + ride_road.half_width, LAMP_HEIGHT + SIGN_HEIGHT, z };
+    GLfloat top_left[]     = { roadTracingAt(base, z) - ride_road.half_width, LAMP_HEIGHT + SIGN_HEIGHT, z };
+    GLfloat bottom_left[]  = { roadTracingAt(base, z) - ride_road.half_width, LAMP_HEIGHT - 0.1f, z };
+    GLfloat bottom_right[] = { roadTracingAt(base, z) + ride_road.half_width, LAMP_HEIGHT - 0.1f, z };
 
-    quadtex(next_right, next_left, this_left, this_right, 0, 1, 0, 1, horizontal_slices, vertical_slices);
+    tessQuad(mesh, top_right, top_left, bottom_left, bottom_right, 0, 1, 1, 0, 1, 1);
 }
 
-void renderRoadWall(int z, int side, float height) {
+void buildRoad(mesh_t* mesh, long long base, int z, int horizontal_slices, int vertical_slices) {
+    GLfloat next_left[3]  = { roadTracingAt(base, z + 1) + ride_road.half_width, 0, (float)z + 1 };
+    GLfloat next_right[3] = { roadTracingAt(base, z + 1) - ride_road.half_width, 0, (float)z + 1 };
+    GLfloat this_right[3] = { roadTracingAt(base, z    ) - ride_road.half_width, 0, (float)z };
+    GLfloat this_left[3]  = { roadTracingAt(base, z    ) + ride_road.half_width, 0, (float)z };
+
+    tessQuad(mesh, next_right, next_left, this_left, this_right, 0, 1, 0, 1, horizontal_slices, vertical_slices);
+}
+
+void buildRoadWall(mesh_t* mesh, long long base, int z, int side, float height) {
     // side is 1 => left, -1 => right
-    GLfloat next_down[3] = { road_tracing(z + 1) + side * ROAD_WIDTH, 0, (float)z + 1 }; 
-    GLfloat this_up[3]   = { road_tracing(z    ) + side * ROAD_WIDTH, height, (float)z };
-    GLfloat next_up[3]   = { road_tracing(z + 1) + side * ROAD_WIDTH, height, (float)z + 1 };
-    GLfloat this_down[3] = { road_tracing(z    ) + side * ROAD_WIDTH, 0, (float)z }; 
+    GLfloat next_down[3] = { roadTracingAt(base, z + 1) + side * ride_road.half_width, 0, (float)z + 1 }; 
+    GLfloat this_up[3]   = { roadTracingAt(base, z    ) + side * ride_road.half_width, height, (float)z };
+    GLfloat next_up[3]   = { roadTracingAt(base, z + 1) + side * ride_road.half_width, height, (float)z + 1 };
+    GLfloat this_down[3] = { roadTracingAt(base, z    ) + side * ride_road.half_width, 0, (float)z }; 
    
     // Order matters (so the border is facing us)
     if (side == -1) {
-        quadtex(next_up, next_down, this_down, this_up, 0, 1, 0, 1, 1, 1);
+        tessQuad(mesh, next_up, next_down, this_down, this_up, 0, 1, 0, 1, 1, 1);
     }
     else {
-        quadtex(next_down, next_up, this_up, this_down, 0, 1, 0, 1, 1, 1);
+        tessQuad(mesh, next_down, next_up, this_up, this_down, 0, 1, 0, 1, 1, 1);
     }
 }
 
-void renderRoadCeiling(int z, float height) {
-    GLfloat next_right[3] = { road_tracing(z + 1) - ROAD_WIDTH, height, (float)z + 1 };
-    GLfloat this_right[3] = { road_tracing(z    ) - ROAD_WIDTH, height, (float)z };
-    GLfloat next_left[3]  = { road_tracing(z + 1) + ROAD_WIDTH, height, (float)z + 1 };
-    GLfloat this_left[3]  = { road_tracing(z    ) + ROAD_WIDTH, height, (float)z };
+void buildRoadCeiling(mesh_t* mesh, long long base, int z, float height) {
+    GLfloat next_right[3] = { roadTracingAt(base, z + 1) - ride_road.half_width, height, (float)z + 1 };
+    GLfloat this_right[3] = { roadTracingAt(base, z    ) - ride_road.half_width, height, (float)z };
+    GLfloat next_left[3]  = { roadTracingAt(base, z + 1) + ride_road.half_width, height, (float)z + 1 };
+    GLfloat this_left[3]  = { roadTracingAt(base, z    ) + ride_road.half_width, height, (float)z };
     
-    quadtex(next_right, next_left, this_left, this_right, 0, 1, 0, 1, 1, 1);
+    tessQuad(mesh, next_right, next_left, this_left, this_right, 0, 1, 0, 1, 1, 1);
 }
 
-bool atHighQualityRoadPosition(int z) {
-    return (z - position[Z] < HIGH_DETAIL_VIEW_DISTANCE);
+// Rows of trees on both sides of the road at z
+void buildTrees(mesh_t* meshes, long long base, int z, int rows) {
+    for (int i = 1; i <= rows; i++) {
+        for (int side = -1; side <= 1; side += 2) {
+            GLfloat trunk[] = { roadTracingAt(base, z) + side * (ride_road.half_width + X_BETWEEN_TREES * i), -2, (float)z };
+            GLfloat crown[] = { trunk[X], trunk[Y] + TREE_TRUNK_HEIGHT, trunk[Z] };
+            buildCylindricalSupport(&meshes[TREE_TRUNK_MESH], trunk, TREE_TRUNK_RADIUS, TREE_TRUNK_HEIGHT, 20);
+            meshCone(&meshes[TREE_CROWN_MESH], crown, TREE_CONE_BASE, TREE_CONE_HEIGHT, 10, 10);
+        }
+    }
 }
 
-void displayRoad(int length) {
-    glPolygonMode(GL_FRONT_AND_BACK, draw_mode);
+// Streetlamps alternate sides. Lamps carrying a sign hang over the middle of the
+// road, like the lamps inside tunnels.
+void buildStreetlamp(chunk_data_t* chunk, mesh_t* meshes, long long base, const track_lamp_t* found) {
+    streetlamp_t* lamp = &chunk->lamps[chunk->num_lamps++];
+    long long absolute_z = (long long)floor(found->z);
+    float z = (float)(found->z - base);
+    int side = found->index % 2 ? 1 : -1; // 1 => left, -1 => right
+
+    lamp->position[X] = roadTracingAt(base, z) + side * ride_road.half_width;
+    lamp->position[Y] = LAMP_HEIGHT;
+    lamp->position[Z] = z;
+    lamp->position[3] = 1.0;
+
+    lamp->direction[X] = -side; // left one directs light to the right and viceversa
+    lamp->direction[Y] = -1.0;
+    lamp->direction[Z] = 0.0;
+    lamp->kind = ROADSIDE_LAMP;
+
+    bool has_sign = found->sign >= 0;
+    if (!outsideTunnelAt(absolute_z) || has_sign) {
+        lamp->kind = outsideTunnelAt(absolute_z) ? SIGN_LAMP : TUNNEL_LAMP;
+        lamp->position[X] = roadTracingAt(base, z); 
+        lamp->direction[X] = 0.0; // pointing down
+    }
+
+    // Geometry holding the lamp, tunnel geometry supports its own lamps
+    if (lamp->kind == SIGN_LAMP) {
+        chunk->sign = found->sign; // signs of a chunk share its texture
+        buildSignSupports(&meshes[SUPPORT_MESH], base, z, LAMP_HEIGHT + SIGN_HEIGHT);
+        buildSign(&meshes[SIGN_MESH], base, z);
+    }
+    else if (lamp->kind == ROADSIDE_LAMP) {
+        GLfloat support_position[] = { lamp->position[X], 0, z };
+        buildCylindricalSupport(&meshes[SUPPORT_MESH], support_position, LAMP_CYLINDER_RADIUS, LAMP_HEIGHT, 20);
+    }
+    meshSphere(&meshes[LAMP_MESH], lamp->position, 0.4, 10, 10);
+}
+
+// Parts below WORLD_CHUNK_SEGMENTS are WORLD_CHUNK_LENGTH / WORLD_CHUNK_SEGMENTS
+// meters of road with their tunnel and trees, the last one holds the streetlamps.
+// The road is split in quad_density pieces per meter near the vehicle and in a
+// quarter of that further away
+void buildChunkPart(chunk_data_t* chunk, int part, const quality_tier_t* settings) {
+    int quad_density = settings->quad_density;
+    long long base = chunk->index * WORLD_CHUNK_LENGTH;
+    mesh_t* meshes = chunk->meshes[part];
+    for (int m = 0; m < NUM_CHUNK_MESHES; m++)
+        tessClear(&meshes[m]);
+
+    if (part < WORLD_CHUNK_SEGMENTS) {
+        int length = WORLD_CHUNK_LENGTH / WORLD_CHUNK_SEGMENTS;
+        for (int i = part * length; i < (part + 1) * length; i++) {
+            long long z = base + i;
+
+            // Road, in both levels of detail
+            int low_density = quad_density / 4 > 0 ? quad_density / 4 : 1;
+            buildRoad(&meshes[ROAD_HIGH_DETAIL_MESH], base, i, 3*quad_density, quad_density);
+            buildRoad(&meshes[ROAD_LOW_DETAIL_MESH], base, i, 3*low_density, low_density);
+            buildRoadWall(&meshes[ROAD_BORDER_MESH], base, i, -1, ROAD_BORDER_HEIGHT);
+            buildRoadWall(&meshes[ROAD_BORDER_MESH], base, i,  1, ROAD_BORDER_HEIGHT);
+
+            if (outsideTunnelAt(z)) {
+                if (z % Z_BETWEEN_TREES == 0) 
+                    buildTrees(meshes, base, i, settings->tree_rows);
+            }
+            else {
+                buildRoadWall(&meshes[TUNNEL_WALL_MESH], base, i, -1, ROAD_TUNNEL_HEIGHT);
+                buildRoadWall(&meshes[TUNNEL_WALL_MESH], base, i,  1, ROAD_TUNNEL_HEIGHT);
+                buildRoadCeiling(&meshes[TUNNEL_CEILING_MESH], base, i, ROAD_TUNNEL_HEIGHT);
+            }
+        }
+    }
+    else {
+        chunk->num_lamps = 0;
+        chunk->sign = -1;
+        track_lamp_t found[MAX_LAMPS_PER_CHUNK];
+        int num_found = lampsBetween(base, base + WORLD_CHUNK_LENGTH, found, MAX_LAMPS_PER_CHUNK);
+        for (int i = 0; i < num_found; i++) {
+            buildStreetlamp(chunk, meshes, base, &found[i]);
+        }
+    }
+
+    float* x_range = chunk->part_x_range[part];
+    x_range[0] = x_range[1] = roadTracingAt(base, 0);
+    for (int m = 0; m < NUM_CHUNK_MESHES; m++) {
+        const std::vector<GLfloat>& vertices = meshes[m].vertices;
+        for (size_t v = 0; v < vertices.size(); v += TESS_VERTEX_FLOATS) {
+            float x = vertices[v];
+            if (x < x_range[0]) x_range[0] = x;
+            if (x > x_range[1]) x_range[1] = x;
+        }
+    }
+}
+
+// Once every part is built
+void finishChunk(chunk_data_t* chunk) {
+    chunk->x_range[0] = chunk->part_x_range[0][0];
+    chunk->x_range[1] = chunk->part_x_range[0][1];
+    for (int part = 1; part < WORLD_CHUNK_PARTS; part++) {
+        if (chunk->part_x_range[part][0] < chunk->x_range[0]) chunk->x_range[0] = chunk->part_x_range[part][0];
+        if (chunk->part_x_range[part][1] > chunk->x_range[1]) chunk->x_range[1] = chunk->part_x_range[part][1];
+    }
+}
+
+// Every part on the calling thread
+void buildChunk(chunk_data_t* chunk, long long index, const quality_tier_t* settings) {
+    chunk->index = index;
+    for (int part = 0; part < WORLD_CHUNK_PARTS; part++)
+        buildChunkPart(chunk, part, settings);
+    finishChunk(chunk);
+}
+
+// Every part as a task of the pool. The last one to end finishes the chunk and,
+// if deliver, queues it for upload. count, if given, counts the tasks
+void submitChunk(chunk_data_t* chunk, long long index, const quality_tier_t* settings, bool deliver, task_count_t* count) {
+    chunk->index = index;
+    chunk->parts_left = WORLD_CHUNK_PARTS;
+    quality_tier_t copy = *settings;
+    for (int part = 0; part < WORLD_CHUNK_PARTS; part++) {
+        taskSubmit(&world_tasks, [chunk, part, copy, deliver] {
+            buildChunkPart(chunk, part, &copy);
+            if (--chunk->parts_left > 0)
+                return;
+            finishChunk(chunk);
+            if (deliver) {
+                std::lock_guard<std::mutex> lock(world_mutex);
+                world_results.push_back(chunk);
+            }
+        }, count);
+    }
+}
+
+/********** World chunks **********/
+// The world is split in WORLD_CHUNK_LENGTH long chunks, generated in
+// WORLD_CHUNK_PARTS parts by a task pool. In the background the pool generates
+// the chunks the vehicle will reach in the next WORLD_CHUNK_LOOKAHEAD seconds,
+// the render thread compiles them into display lists once and then only draws
+// resident chunks. Chunks needed right away and not ready yet (the first frame)
+// are generated at once, the render thread taking tasks too while it waits, and
+// compiled in order. A change of quality only applies to chunks requested
+// afterwards, the ones already resident are kept.
+
+// threads: workers of the pool, 0 generates every chunk on the render thread
+void startWorldChunks(bool threaded, int threads) {
+    propPoolInit(&roadside_props, WORLD_CHUNK_SLOTS * MAX_LAMPS_PER_CHUNK);
+    clearWorldChunks();
+    world_threaded = threaded && threads > 0;
+    if (threads > 0) {
+        taskPoolStart(&world_tasks, threads);
+        atexit(stopWorldChunks); // before the result queue is destroyed
+    }
+}
+
+// Forgets every chunk, they are generated again when needed
+void clearWorldChunks() {
+    for (int i = 0; i < WORLD_CHUNK_SLOTS; i++) {
+        world_chunks[i].index = WORLD_CHUNK_NONE;
+        world_chunks[i].requested = WORLD_CHUNK_NONE;
+        world_chunks[i].resident = false;
+        world_chunks[i].num_props = 0;
+    }
+    propPoolClear(&roadside_props);
+}
+
+void stopWorldChunks() {
+    taskPoolStop(&world_tasks);
+}
 
-    for (int i = position[Z] - TUNNEL_LENGTH; i < position[Z] + length; i++) {
-        glPushMatrix();
-        setRoadMaterialAndTexture(); 
+world_chunk_t* chunkSlot(long long index) {
+    return &world_chunks[(index % WORLD_CHUNK_SLOTS + WORLD_CHUNK_SLOTS) % WORLD_CHUNK_SLOTS];
+}
+
+// Chunks from TUNNEL_LENGTH behind the vehicle to ahead meters in front of it
+void chunkRange(float ahead, long long* first, long long* last) {
+    *first = (long long)std::floor((absoluteZ(position[Z]) - TUNNEL_LENGTH) / WORLD_CHUNK_LENGTH);
+    *last  = (long long)std::floor((absoluteZ(position[Z]) + ahead) / WORLD_CHUNK_LENGTH);
+}
 
-        // Road
-        if (atHighQualityRoadPosition(i)) { 
-            renderRoad(i, 3*QUAD_DENSITY, QUAD_DENSITY);
+void uploadChunk(world_chunk_t* chunk, chunk_data_t* data) {
+    if (chunk->lists == 0) {
+        chunk->lists = renderer->genLists(NUM_CHUNK_MESHES);
+    }
+    for (int m = 0; m < NUM_CHUNK_MESHES; m++) {
+        chunk->has_mesh[m] = false;
+        for (int part = 0; part < WORLD_CHUNK_PARTS; part++)
+            chunk->has_mesh[m] |= !tessEmpty(&data->meshes[part][m]);
+        if (!chunk->has_mesh[m])
+            continue;
+
+        // One list per mesh kind, one draw per part
+        renderer->newList(chunk->lists + m, GL_COMPILE);
+        for (int part = 0; part < WORLD_CHUNK_PARTS; part++)
+            tessDraw(&data->meshes[part][m]);
+        renderer->endList();
+    }
+    // The lamps of the chunk held by the slot until now leave the pool
+    for (int i = 0; i < chunk->num_props; i++) {
+        propRemove(&roadside_props, chunk->props[i]);
+    }
+    chunk->num_props = 0;
+    for (int i = 0; i < data->num_lamps; i++) {
+        const streetlamp_t* lamp = &data->lamps[i];
+        int side = lamp->kind == ROADSIDE_LAMP ? (int)-lamp->direction[X] : 0;
+        int handle = propAdd(&roadside_props, lamp->kind, (double)data->index * WORLD_CHUNK_LENGTH + lamp->position[Z],
+                             lamp->position[X], side, lamp->kind == SIGN_LAMP ? data->sign : -1);
+        if (handle >= 0)
+            chunk->props[chunk->num_props++] = handle;
+    }
+    chunk->sign = data->sign;
+    chunk->x_range[0] = data->x_range[0];
+    chunk->x_range[1] = data->x_range[1];
+    chunk->index = data->index;
+    chunk->resident = true;
+}
+
+// Uploads what the pool finished and asks for the chunks coming next
+void updateWorldChunks() {
+    long long first, last_visible, last_wanted;
+    chunkRange(quality.render_distance, &first, &last_visible);
+    chunkRange(quality.render_distance + speed * WORLD_CHUNK_LOOKAHEAD, &first, &last_wanted);
+    if (last_wanted > first + WORLD_CHUNK_SLOTS - 1)
+        last_wanted = first + WORLD_CHUNK_SLOTS - 1;
+
+    if (world_threaded) {
+        std::vector<chunk_data_t*> finished;
+        {
+            std::lock_guard<std::mutex> lock(world_mutex);
+            finished.swap(world_results);
         }
-        else {
-            renderRoad(i, 3*QUAD_DENSITY/4, QUAD_DENSITY/4);
+        for (size_t i = 0; i < finished.size(); i++) {
+            long long index = finished[i]->index;
+            world_chunk_t* chunk = chunkSlot(index);
+            if (index >= first && index <= last_wanted && !(chunk->resident && chunk->index == index)) {
+                uploadChunk(chunk, finished[i]);
+            }
+            delete finished[i];
         }
-        glPopMatrix(); 
+    }
 
-        glPushMatrix();
-        setRoadBorderMaterialAndTexture();
-        renderRoadWall(i, -1, ROAD_BORDER_HEIGHT);
-        renderRoadWall(i,  1, ROAD_BORDER_HEIGHT);
-        glPopMatrix();
+    static chunk_data_t needed[WORLD_CHUNK_SLOTS]; // keep the capacity of their meshes
+    int num_needed = 0;
+    task_count_t tasks(0);
+    for (long long index = first; index <= last_wanted; index++) {
+        world_chunk_t* chunk = chunkSlot(index);
+        if (chunk->resident && chunk->index == index)
+            continue;
 
-        // Trees
-        if (atTreePosition(i)) {
-            renderTrees(i);
+        if (index <= last_visible) {
+            chunk_data_t* data = &needed[num_needed++];
+            if (taskPoolThreads(&world_tasks) > 0)
+                submitChunk(data, index, &quality, false, &tasks);
+            else
+                buildChunk(data, index, &quality);
+        }
+        else if (world_threaded && chunk->requested != index) {
+            chunk->requested = index;
+            submitChunk(new chunk_data_t, index, &quality, true, NULL);
         }
+    }
+    if (num_needed > 0) {
+        taskWait(&world_tasks, &tasks);
+        for (int i = 0; i < num_needed; i++)
+            uploadChunk(chunkSlot(needed[i].index), &needed[i]);
+    }
+}
 
-        // Tunnel
-        if (!outsideTunnel(i)) {
-            glPushMatrix();
+void setChunkMeshMaterialAndTexture(int mesh) {
+    switch (mesh) {
+        case ROAD_HIGH_DETAIL_MESH:
+        case ROAD_LOW_DETAIL_MESH:
+            setRoadMaterialAndTexture();
+            break;
+        case ROAD_BORDER_MESH:
+            setRoadBorderMaterialAndTexture();
+            break;
+        case TUNNEL_WALL_MESH:
             setTunnelWallMaterialAndTexture();
+            break;
+        case TUNNEL_CEILING_MESH:
+            setTunnelCeilingMaterialAndTexture();
+            break;
+        case LAMP_MESH:
+            setLampMaterialAndTexture();
+            break;
+        case SIGN_MESH:
+            break; // the texture depends on the sign
+        default:
+            setSupportMaterialAndTexture();
+            break;
+    }
+}
 
-            renderRoadWall(i, -1, ROAD_TUNNEL_HEIGHT);
-            renderRoadWall(i,  1, ROAD_TUNNEL_HEIGHT);
-            glPopMatrix(); 
+// Draws the resident chunks in range, grouped by material
+void displayRoad(int length) {
+    collectChunkDraws(length, &visibility, 1);
+    drawChunks(0);
+}
 
-            glPushMatrix();
-            setTunnelCeilingMaterialAndTexture();
-            renderRoadCeiling(i, ROAD_TUNNEL_HEIGHT);
-            glPopMatrix();
+// Walks the resident chunks in range once for all the views of the frame (at
+// most MAX_COLLECTED_VIEWS, their cameras possibly at different vehicles):
+// keeps every mesh some view sees, with the views that see it at the level of
+// detail of their distance to it.
+void collectChunkDraws(int length, const visibility_t* views, int num_views) {
+    float rear_z = views[0].camera[1], front_z = views[0].camera[1];
+    for (int view = 1; view < num_views; view++) {
+        if (views[view].camera[1] < rear_z) rear_z = views[view].camera[1];
+        if (views[view].camera[1] > front_z) front_z = views[view].camera[1];
+    }
+    long long first = (long long)std::floor((absoluteZ(rear_z) - TUNNEL_LENGTH) / WORLD_CHUNK_LENGTH);
+    long long last  = (long long)std::floor((absoluteZ(front_z) + length) / WORLD_CHUNK_LENGTH);
+
+    for (int mesh = 0; mesh < NUM_CHUNK_MESHES; mesh++)
+        chunk_draws[mesh].clear();
+    for (long long index = first; index <= last; index++) {
+        world_chunk_t* chunk = chunkSlot(index);
+        if (!chunk->resident || chunk->index != index)
+            continue;
+
+        // Views that see the chunk, and those close enough for the detailed road and the trees
+        float chunk_z = (float)(index * WORLD_CHUNK_LENGTH - origin_z);
+        unsigned long long seen = 0, high_detail = 0, trees = 0;
+        for (int view = 0; view < num_views; view++) {
+            float ahead = chunk_z - views[view].camera[1];
+            if (ahead > length || ahead + WORLD_CHUNK_LENGTH <= -TUNNEL_LENGTH)
+                continue;
+            if (!chunkVisible(&views[view], index, chunk))
+                continue;
+            seen |= 1ull << view;
+            if (ahead < quality.high_detail_view_distance)
+                high_detail |= 1ull << view;
+            if (ahead < TREE_VIEW_DISTANCE)
+                trees |= 1ull << view;
         }
-	}
-    configureRoad();
+        if (seen == 0)
+            continue;
+
+        for (int mesh = 0; mesh < NUM_CHUNK_MESHES; mesh++) {
+            if (!chunk->has_mesh[mesh])
+                continue;
+            unsigned long long drawn = seen;
+            if (mesh == ROAD_HIGH_DETAIL_MESH)
+                drawn &= high_detail;
+            else if (mesh == ROAD_LOW_DETAIL_MESH)
+                drawn &= ~high_detail;
+            else if (mesh == TREE_TRUNK_MESH || mesh == TREE_CROWN_MESH)
+                drawn &= trees;
+            if (drawn == 0)
+                continue;
+            chunk_draw_t draw = { chunk->lists + mesh, chunk_z, chunk->sign, drawn };
+            chunk_draws[mesh].push_back(draw);
+        }
+    }
 }
 
+// Draws the meshes collectChunkDraws() kept for viewport view, grouped by material
+void drawChunks(int view) {
+    configureRoad();
+    renderer->polygonMode(GL_FRONT_AND_BACK, draw_mode);
+
+    for (int mesh = 0; mesh < NUM_CHUNK_MESHES; mesh++) {
+        if (mesh == TUNNEL_WALL_MESH)
+            passTimerMark(&pass_timer, PASS_TUNNELS);
+        else if (mesh == SUPPORT_MESH)
+            passTimerMark(&pass_timer, PASS_PROPS);
+
+        renderer->pushMatrix();
+        setChunkMeshMaterialAndTexture(mesh);
+        renderer->pushAttrib(GL_CURRENT_BIT);
+        if (mesh == TREE_CROWN_MESH)
+            renderer->color3f(0.2, 1.0, 0.2);
+
+        for (size_t i = 0; i < chunk_draws[mesh].size(); i++) {
+            const chunk_draw_t* draw = &chunk_draws[mesh][i];
+            if (!(draw->views & (1ull << view)))
+                continue;
+            if (mesh == SIGN_MESH)
+                setSignMaterialAndTexture(draw->sign);
+
+            renderer->pushMatrix();
+            renderer->translatef(0, 0, draw->z);
+            renderer->callList(draw->list);
+            scene_draws++;
+            renderer->popMatrix();
+        }
+        renderer->popAttrib();
+        renderer->popMatrix();
+    }
+}
 
 void setupLighting() {
     // Moonlight
@@ -873,9 +1600,9 @@ void setupLighting() {
     GLfloat D0[] = { 0.1, 0.1, 0.1, 1.0 };
     GLfloat S0[] = { 0.0, 0.0, 0.0, 1.0 };
 
-    glLightfv(GL_LIGHT0, GL_AMBIENT, A0);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, D0);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, S0);
+    renderer->lightfv(GL_LIGHT0, GL_AMBIENT, A0);
+    renderer->lightfv(GL_LIGHT0, GL_DIFFUSE, D0);
+    renderer->lightfv(GL_LIGHT0, GL_SPECULAR, S0);
 
     // Vehicle headlight
     GLfloat A1[] = { 0.9, 0.9, 0.9, 1.0 };
@@ -884,40 +1611,45 @@ void setupLighting() {
     float cutoff = 40.0; // degrees
     float exponent = 20.0;
     
-    glLightfv(GL_LIGHT1, GL_AMBIENT, A1);
-    glLightfv(GL_LIGHT1, GL_DIFFUSE, D1);
-    glLightfv(GL_LIGHT1, GL_SPECULAR, S1);
-    glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, cutoff);
-    glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, exponent);
+    renderer->lightfv(GL_LIGHT1, GL_AMBIENT, A1);
+    renderer->lightfv(GL_LIGHT1, GL_DIFFUSE, D1);
+    renderer->lightfv(GL_LIGHT1, GL_SPECULAR, S1);
+    renderer->lightf(GL_LIGHT1, GL_SPOT_CUTOFF, cutoff);
+    renderer->lightf(GL_LIGHT1, GL_SPOT_EXPONENT, exponent);
 
     // Streetlamps
-    GLfloat A[] = {0.7, 0.7, 0.7, 1.0};
-    GLfloat D[] = {0.8, 0.8, 0.8, 1.0};
-    GLfloat S[] = {0.3, 0.3, 0.3, 1.0};
     cutoff = 90.0; // degrees
-    exponent = 3.0;
+    exponent = LAMP_SPOT_EXPONENT;
     
-    for (int i = 0; i < NUM_STREETLAMPS; i++) {
-        glLightfv(lamps[i], GL_AMBIENT, A);
-        glLightfv(lamps[i], GL_DIFFUSE, D);
-        glLightfv(lamps[i], GL_SPECULAR, S);
-        glLightf(lamps[i], GL_SPOT_CUTOFF, cutoff);
-        glLightf(lamps[i], GL_SPOT_EXPONENT, exponent);
+    for (int i = 0; i < MAX_FIXED_STREETLAMPS; i++) {
+        renderer->lightfv(lamps[i], GL_AMBIENT, lamp_ambient);
+        renderer->lightfv(lamps[i], GL_DIFFUSE, lamp_diffuse);
+        renderer->lightfv(lamps[i], GL_SPECULAR, lamp_specular);
+        renderer->lightf(lamps[i], GL_SPOT_CUTOFF, cutoff);
+        renderer->lightf(lamps[i], GL_SPOT_EXPONENT, exponent);
     }
 }
 
 
+// quadtex() through the stream of dynamic geometry
+void streamQuadtex(GLfloat* v0, GLfloat* v1, GLfloat* v2, GLfloat* v3, 
+                   GLfloat smin, GLfloat smax, GLfloat tmin, GLfloat tmax, int M, int N) {
+    static tess_batch_t batch; // keeps its capacity
+    tessClear(&batch);
+    tessQuad(&batch, v0, v1, v2, v3, smin, smax, tmin, tmax, M, N);
+    streamTriangles(&dynamic_geometry, batch.vertices.data(), batch.indices.data(), batch.indices.size());
+}
+
 void renderArrow() {
-    quadtex(
-            new GLfloat[] {  0,  0, 0}, 
-            new GLfloat[] { -1,  0, 0},
-            new GLfloat[] { -1, -2, 0}, 
-            new GLfloat[] {  0, -2, 0},
-            1, 0, 1, 0, 1, 1);
+    static GLfloat v0[] = {  0,  0, 0 };
+    static GLfloat v1[] = { -1,  0, 0 };
+    static GLfloat v2[] = { -1, -2, 0 };
+    static GLfloat v3[] = {  0, -2, 0 };
+    streamQuadtex(v0, v1, v2, v3, 1, 0, 1, 0, 1, 1);
 }
 
 void renderWindArrow() {
-    glPushMatrix();
+    renderer->pushMatrix();
     setArrowMaterialAndTexture();
     // Rotate so as to always point towards wind (rain) velocity x
     // This means we must get the angle between our LOOK AT vector and the rain velocity
@@ -929,33 +1661,39 @@ void renderWindArrow() {
 
     if (velocity[X] > rain_velocity[X]) angle_arrow_rot = 360-angle_arrow_rot;
 
-    glTranslatef(0.8, -0.55, 0);
-    glScalef(0.07, 0.12, 1);
+    renderer->translatef(0.8, -0.55, 0);
+    renderer->scalef(0.07, 0.12, 1);
     
-    glTranslatef(0, -1, 0);
-    glRotatef(angle_arrow_rot, 0, 0, 1);
-    glTranslatef(0, 1, 0);
+    renderer->translatef(0, -1, 0);
+    renderer->rotatef(angle_arrow_rot, 0, 0, 1);
+    renderer->translatef(0, 1, 0);
 
     renderArrow();
-    glPopMatrix();
+    renderer->popMatrix();
 }
 
 void showHUD() {
-    static int starting_time = glutGet(GLUT_ELAPSED_TIME);
+    static int starting_time = elapsedMillis();
     static int previous = starting_time; 
     static int frames = 0;
     static int fps = FPS;
     
-    int current = glutGet(GLUT_ELAPSED_TIME);
+    int current = elapsedMillis();
     frames++; // each time this function is called a frame is presented to the user
 
-    std::stringstream speed_ss, fps_ss, time_ss, distance_ss;
+    std::stringstream speed_ss, fps_ss, time_ss, distance_ss, frame_ss;
 
     speed_ss << std::setprecision(3) << speed << "\t m/s";
     time_ss << (int)((current - starting_time) / SECOND_IN_MILLIS + 0.5)<< "\t s";
-    distance_ss << (int) position[Z] << "\t m";
+    distance_ss << (long long) roadDistance(absoluteZ(position[Z])) << "\t m";
 
-    fps_ss << std::setprecision(3) << fps << "\t fps";
+    fps_ss << std::setprecision(3) << fps << "\t fps " << quality.name;
+    if (resolution_mode == SCALED_RESOLUTION)
+        fps_ss << " " << (int)(scene_target.scale * 100 + 0.5) << "%";
+    double p99 = frameHistogramPercentile(&frame_pacer.last_second, 99);
+    frame_ss << std::fixed << std::setprecision(1) 
+             << frameHistogramPercentile(&frame_pacer.last_second, 50) << "/" 
+             << (p99 >= FRAME_HISTOGRAM_MAX_MS ? ">=" : "") << p99 << "\t ms";
 
     if (current - previous >= SECOND_IN_MILLIS) {
         fps = frames;
@@ -966,57 +1704,140 @@ void showHUD() {
     
 
     // Background of HUD text and arrow in dark for better readability
-    glPushMatrix();
-    glPushAttrib(GL_CURRENT_BIT);
-    glColor4f(0.2, 0.0, 0.7, 0.8);
+    renderer->pushMatrix();
+    renderer->pushAttrib(GL_CURRENT_BIT);
+    renderer->color4f(0.2, 0.0, 0.7, 0.8);
     setSupportMaterialAndTexture(); // any texture just for blending
 
-    glTranslatef(1, 1, 0);
-    glBegin(GL_TRIANGLE_STRIP);
-    glVertex3f( -0.2, -0.3, 0);
-    glVertex3f(  0.2, -0.3, 0);
-    glVertex3f( -0.2,    0, 0);
-    glVertex3f(  0.2,    0, 0);
-    glEnd();
-    glPopAttrib();
-    glPopMatrix();
+    renderer->translatef(1, 1, 0);
+    GLfloat* background = streamVertices(&dynamic_geometry, 4);
+    if (background) {
+        GLfloat* next = streamPut(background, -0.2, -0.43, 0, OVERLAY_NORMAL);
+        next = streamPut(next,  0.2, -0.43, 0, OVERLAY_NORMAL);
+        next = streamPut(next, -0.2,     0, 0, OVERLAY_NORMAL);
+        next = streamPut(next,  0.2,     0, 0, OVERLAY_NORMAL);
+        streamDraw(&dynamic_geometry, GL_TRIANGLE_STRIP, 4);
+    }
+    renderer->popAttrib();
+    renderer->popMatrix();
     
     // Text
-    glPushMatrix();
-    glTranslatef(0.85, 0.92, 0);
+    renderer->pushMatrix();
+    renderer->translatef(0.85, 0.92, 0);
     texto(0, 0, (char *) speed_ss.str().c_str(), BLANCO);
-    glPopMatrix();
+    renderer->popMatrix();
 
-    glPushMatrix();
-    glTranslatef(0.85, 0.87, 0);
+    renderer->pushMatrix();
+    renderer->translatef(0.85, 0.87, 0);
     texto(0, 0, (char *) time_ss.str().c_str(), BLANCO);
-    glPopMatrix();
+    renderer->popMatrix();
 
-    glPushMatrix();
-    glTranslatef(0.85, 0.82, 0);
+    renderer->pushMatrix();
+    renderer->translatef(0.85, 0.82, 0);
     texto(0, 0, (char *) distance_ss.str().c_str(), BLANCO);
-    glPopMatrix();
+    renderer->popMatrix();
     
-    glPushMatrix();
-    glTranslatef(0.85, 0.77, 0);
+    renderer->pushMatrix();
+    renderer->translatef(0.85, 0.77, 0);
     texto(0, 0, (char *) fps_ss.str().c_str(), BLANCO);
-    glPopMatrix();
+    renderer->popMatrix();
+
+    renderer->pushMatrix();
+    renderer->translatef(0.85, 0.72, 0);
+    texto(0, 0, (char *) frame_ss.str().c_str(), BLANCO);
+    renderer->popMatrix();
+
+    renderFrameHistogram();
+    if (timings_mode == TIMINGS_ON)
+        showPassTimes();
+}
+
+// CPU / GPU ms per frame of each pass, averaged over the last PASS_TIMER_WINDOW frames
+void showPassTimes() {
+    renderer->pushMatrix();
+    renderer->pushAttrib(GL_CURRENT_BIT);
+    renderer->color4f(0.2, 0.0, 0.7, 0.8);
+    setSupportMaterialAndTexture(); // any texture just for blending
+    renderer->translatef(-1, 1, 0);
+    GLfloat* background = streamVertices(&dynamic_geometry, 4);
+    if (background) {
+        float bottom = -0.07 - 0.05 * NUM_PASSES;
+        GLfloat* next = streamPut(background, 0, bottom, 0, OVERLAY_NORMAL);
+        next = streamPut(next, 0.42, bottom, 0, OVERLAY_NORMAL);
+        next = streamPut(next, 0,    0, 0, OVERLAY_NORMAL);
+        next = streamPut(next, 0.42, 0, 0, OVERLAY_NORMAL);
+        streamDraw(&dynamic_geometry, GL_TRIANGLE_STRIP, 4);
+    }
+    renderer->popAttrib();
+    renderer->popMatrix();
+
+    char line[64];
+    for (int pass = -1; pass < NUM_PASSES; pass++) {
+        if (pass < 0)
+            snprintf(line, sizeof(line), "pass  cpu / gpu ms");
+        else if (pass_timer.gpu)
+            snprintf(line, sizeof(line), "%s  %.2f / %.2f", PASS_NAMES[pass], pass_timer.cpu_ms[pass], pass_timer.gpu_ms[pass]);
+        else
+            snprintf(line, sizeof(line), "%s  %.2f / -", PASS_NAMES[pass], pass_timer.cpu_ms[pass]);
+        renderer->pushMatrix();
+        renderer->translatef(-0.98, 0.93 - 0.05 * (pass + 1), 0);
+        texto(0, 0, line, BLANCO);
+        renderer->popMatrix();
+    }
+}
+
+// Share of the frames of the last second in each 2 ms band, up to 32 ms.
+// Bands slower than the target frame period are drawn in red.
+void renderFrameHistogram() {
+    const frame_histogram_t* histogram = &frame_pacer.last_second;
+    const int bands = 16;
+    if (histogram->frames == 0)
+        return;
+
+    // Two draws, bands within the period in green and slower ones in red
+    renderer->pushAttrib(GL_CURRENT_BIT);
+    for (int slow = 0; slow <= 1; slow++) {
+        GLfloat* bars = streamVertices(&dynamic_geometry, 6 * bands);
+        if (bars == NULL)
+            break;
+        GLfloat* next = bars;
+        for (int band = 0; band < bands; band++) {
+            if ((band * 2 >= frame_pacer.period_ms) != (slow == 1))
+                continue;
+            unsigned long count = frameHistogramCount(histogram, band * 2, band * 2 + 2);
+            if (count == 0)
+                continue;
+
+            float height = 0.01 + 0.07 * count / histogram->frames;
+            float x = 0.84 + band * 0.01;
+            next = streamPut(next, x,         0.59, 0, OVERLAY_NORMAL);
+            next = streamPut(next, x + 0.008, 0.59, 0, OVERLAY_NORMAL);
+            next = streamPut(next, x + 0.008, 0.59 + height, 0, OVERLAY_NORMAL);
+            next = streamPut(next, x,         0.59, 0, OVERLAY_NORMAL);
+            next = streamPut(next, x + 0.008, 0.59 + height, 0, OVERLAY_NORMAL);
+            next = streamPut(next, x,         0.59 + height, 0, OVERLAY_NORMAL);
+        }
+        if (slow) renderer->color4f(1.0, 0.3, 0.3, 1.0);
+        else      renderer->color4f(0.3, 1.0, 0.3, 1.0);
+        streamDraw(&dynamic_geometry, GL_TRIANGLES, (next - bars) / STREAM_VERTEX_FLOATS);
+    }
+    renderer->popAttrib();
 }
 
 void showBike() {
-    glEnable(GL_BLEND);
-    glDepthMask(GL_FALSE);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    renderer->enable(GL_BLEND);
+    renderer->depthMask(GL_FALSE);
+    renderer->enable(GL_CULL_FACE);
+    renderer->cullFace(GL_BACK);
     
-    glPushMatrix();
-    glLoadIdentity();
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    glOrtho(-1, 1, -1, 1, -1, 1);
-    glMatrixMode(GL_MODELVIEW);
-    gluLookAt(0, 0, 0, 0, 0, -1, 0, 1, 0);
+    renderer->pushMatrix();
+    renderer->loadIdentity();
+    renderer->matrixMode(GL_PROJECTION);
+    renderer->pushMatrix();
+    renderer->loadIdentity();
+    renderer->ortho(-1, 1, -1, 1, -1, 1);
+    renderer->matrixMode(GL_MODELVIEW);
+    renderer->lookAt(0, 0, 0, 0, 0, -1, 0, 1, 0);
     
     renderWindArrow();
 
@@ -1027,7 +1848,7 @@ void showBike() {
         float v2[3] = {  0.5,     0, 0 };
         float v3[3] = { -0.5,     0, 0 };
         
-        quadtex(v0, v1, v2, v3);
+        streamQuadtex(v0, v1, v2, v3);
     }
     else if (camera_mode == THIRD_PERSON_VIEW) {
         float v0[3] = { -0.3, -1.2, 0 };
@@ -1035,7 +1856,7 @@ void showBike() {
         float v2[3] = {  0.3, -0.2, 0 };
         float v3[3] = { -0.3, -0.2, 0 };
         
-        quadtex(v0, v1, v2, v3);
+        streamQuadtex(v0, v1, v2, v3);
 
     }
     else if (camera_mode == BIRDS_EYE_VIEW && outsideTunnel(position[Z])) {
@@ -1045,19 +1866,19 @@ void showBike() {
         float v2[3] = {  0.5f / pov_to_bev_factor,  0 / pov_to_bev_factor, 0 };
         float v3[3] = { -0.5f / pov_to_bev_factor,  0 / pov_to_bev_factor, 0 };
 
-        quadtex(v0, v1, v2, v3);
+        streamQuadtex(v0, v1, v2, v3);
     }
     
     showHUD();
 
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
+    renderer->matrixMode(GL_PROJECTION);
+    renderer->popMatrix();
 
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
-    glDisable(GL_CULL_FACE);
-    glDepthMask(GL_TRUE);
-    glDisable(GL_BLEND);
+    renderer->matrixMode(GL_MODELVIEW);
+    renderer->popMatrix();
+    renderer->disable(GL_CULL_FACE);
+    renderer->depthMask(GL_TRUE);
+    renderer->disable(GL_BLEND);
 
 }
 
@@ -1071,41 +1892,81 @@ void init() {
     loadTextures();
 
     setupLighting();
+    if (renderer != &legacy_renderer || !clusteredLightingInit()) {
+        lighting_mode = FIXED_LIGHTING;
+        if (!headless)
+            std::cout << "Clustered lighting unavailable, using fixed function lighting" << "\n";
+    }
 
     createRain();
+    createStreamBuffer(&dynamic_geometry, DYNAMIC_VERTICES);
+    passTimerInit(&pass_timer);
+    startWorldChunks(!headless, world_threads); // headless runs stay deterministic
 
-	glClearColor(0, 0, 0, 1);
+	renderer->clearColor(0, 0, 0, 1);
 
     GLfloat fog_color[]={ 0.4, 0.4, 0.4, 0.6}; // Color de la niebla
-    glFogfv(GL_FOG_COLOR, fog_color);
-    glFogf(GL_FOG_DENSITY, 0.05);
+    renderer->fogfv(GL_FOG_COLOR, fog_color);
+    renderer->fogf(GL_FOG_DENSITY, 0.05);
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_NORMALIZE);
-    glEnable(GL_TEXTURE_2D);
+    renderer->enable(GL_DEPTH_TEST);
+    renderer->enable(GL_NORMALIZE);
+    renderer->enable(GL_TEXTURE_2D);
 
-    glEnable(GL_LIGHT0);
-    glEnable(GL_LIGHT1);
-    glEnable(GL_LIGHT2);
-    glEnable(GL_LIGHT3);
-    glEnable(GL_LIGHT4);
-    glEnable(GL_LIGHT5);
+    renderer->enable(GL_LIGHT0);
+    renderer->enable(GL_LIGHT1);
 
-    showControls();
+    if (!headless)
+        showControls();
 }
 
-void display() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// The scene seen from the vehicle with the current camera mode, into the
+// current viewport
+void renderScene() {
+    placeView();
+   
+    // Camera-independent elements
+    updateVisibility();
+    updateWorldChunks();
+    updateStreetlamps(position[Z], position[Z]);
+    bool clustered = lighting_mode == CLUSTERED_LIGHTING && clusteredLightingSupported();
+    if (clustered) {
+        setupClusteredLighting();
+    }
+
+    passTimerMark(&pass_timer, PASS_ROAD);
+    displayRoad(quality.render_distance);
+    bool outdoors_visible = !visibility.in_tunnel || visibility.portal_visible;
+    if (outdoors_visible) {
+        passTimerMark(&pass_timer, PASS_SKYLINE);
+        renderSkyline(quality.render_distance);
+        passTimerMark(&pass_timer, PASS_GROUND);
+        renderGround();
+    }
+    if (weather_mode == RAINFALL && outdoors_visible) {
+        passTimerMark(&pass_timer, PASS_RAIN);
+        updateAndRenderRain();
+    }
+    passTimerMark(&pass_timer, PASS_OTHER);
+
+    if (clustered) {
+        clusteredLightingEnd();
+    }
+    
+    if (axis_mode == AXIS_ON)
+        ejes();
+}
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
+// Camera of the current mode at the vehicle, with the lights that move with it
+void placeView() {
+	renderer->matrixMode(GL_MODELVIEW);
+	renderer->loadIdentity();
 
-    // Camera-dependent elements
     configureMoonlight();
     configureHeadlight();
     
     if (camera_mode == THIRD_PERSON_VIEW) {
-        gluLookAt(
+        renderer->lookAt(
                position[X], THIRD_PERSON_Y, position[Z], 
                position[X] + velocity[X], THIRD_PERSON_Y/2 + velocity[Y], position[Z] + velocity[Z], 
                0, 1, 0
@@ -1113,114 +1974,276 @@ void display() {
 
     }
     else {
-        gluLookAt(
+        renderer->lookAt(
                position[X], position[Y], position[Z], 
                position[X] + velocity[X], velocity[Y], position[Z] + velocity[Z], 
                0, 1, 0
             );
     }
-   
-    // Camera-independent elements
-    displayRoad(RENDER_DISTANCE);
-    renderSkyline(RENDER_DISTANCE);
-    renderGround(RENDER_DISTANCE);
-    if (weather_mode == RAINFALL) {
-        updateAndRenderRain();
+}
+
+// The viewports of view_layout, the main one (the camera mode chosen with P)
+// first. Split screen puts the next camera mode under it, picture-in-picture
+// the birds-eye view in an inset (or the player view, over the birds-eye view).
+int layoutViewports(viewport_t* viewports) {
+    viewport_t main_view = { camera_mode, 0, 0, 1, 1 };
+    viewports[0] = main_view;
+    if (view_layout == SPLIT_SCREEN) {
+        viewport_t top = { camera_mode, 0, 0.5f, 1, 0.5f };
+        viewport_t bottom = { nextCameraMode(camera_mode), 0, 0, 1, 0.5f };
+        viewports[0] = top;
+        viewports[1] = bottom;
+        return 2;
     }
-    
-    if (axis_mode == AXIS_ON)
-        ejes();
+    if (view_layout == PICTURE_IN_PICTURE) {
+        viewport_t inset = { camera_mode == BIRDS_EYE_VIEW ? PLAYER_VIEW : BIRDS_EYE_VIEW,
+                             1 - PIP_SIZE - PIP_MARGIN, 1 - PIP_SIZE - PIP_MARGIN, PIP_SIZE, PIP_SIZE };
+        viewports[1] = inset;
+        return 2;
+    }
+    return 1;
+}
 
-    if (hud_mode == HUD_ON) {
-        showBike();
+// Pixels (x, y, width, height) of viewport inside area
+void viewportRect(const viewport_t* viewport, const GLint* area, GLint* rect) {
+    rect[0] = area[0] + (GLint)(viewport->x * area[2] + 0.5f);
+    rect[1] = area[1] + (GLint)(viewport->y * area[3] + 0.5f);
+    rect[2] = (GLint)(viewport->width * area[2] + 0.5f);
+    rect[3] = (GLint)(viewport->height * area[3] + 0.5f);
+    if (rect[2] < 1) rect[2] = 1;
+    if (rect[3] < 1) rect[3] = 1;
+}
+
+// The scene from the cameras of several viewports, each into its part of the
+// current viewport. The world, the streetlamps and the rain are updated once,
+// and the chunks walked and culled once against all the viewports: each one
+// then only places its camera and lights and draws again what its culling
+// kept. All the cameras are at the vehicle. The camera mode of the first
+// viewport is left current.
+void renderViewports(const viewport_t* viewports, int count) {
+    GLint area[4];
+    renderer->getIntegerv(GL_VIEWPORT, area);
+
+    // Cameras share X and Z, so one outside the tunnels sees all that any other does
+    visibility_t views[MAX_VIEWPORTS] = {};
+    int widest = 0;
+    for (int view = 0; view < count; view++) {
+        setCameraMode(viewports[view].camera);
+        updateVisibility();
+        views[view] = visibility;
+        if (views[widest].in_tunnel && !views[view].in_tunnel)
+            widest = view;
+    }
+    updateWorldChunks();
+    updateStreetlamps(position[Z], position[Z]);
+    collectChunkDraws(quality.render_distance, views, count);
+    bool clustered = lighting_mode == CLUSTERED_LIGHTING && clusteredLightingSupported();
+
+    int rain_first = 0, rain_count = -1; // streaks not generated yet
+    for (int view = 0; view < count; view++) {
+        GLint rect[4];
+        viewportRect(&viewports[view], area, rect);
+        renderer->viewport(rect[0], rect[1], rect[2], rect[3]);
+        if (view > 0)
+            renderer->clearRect(rect[0], rect[1], rect[2], rect[3], GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderer->matrixMode(GL_PROJECTION);
+        renderer->loadIdentity();
+        renderer->perspective(FOV_Y, (float)rect[2] / rect[3], Z_NEAR, quality.z_far);
+
+        setCameraMode(viewports[view].camera);
+        visibility = views[view];
+        placeView();
+        if (clustered) {
+            setupClusteredLighting();
+        }
+
+        passTimerMark(&pass_timer, PASS_ROAD);
+        drawChunks(view);
+        bool outdoors_visible = !visibility.in_tunnel || visibility.portal_visible;
+        if (outdoors_visible) {
+            passTimerMark(&pass_timer, PASS_SKYLINE);
+            renderSkyline(quality.render_distance);
+            passTimerMark(&pass_timer, PASS_GROUND);
+            renderGround();
+        }
+        if (weather_mode == RAINFALL && outdoors_visible) {
+            passTimerMark(&pass_timer, PASS_RAIN);
+            if (rain_count < 0) {
+                visibility = views[widest];
+                rain_first = streamDrawn(&dynamic_geometry);
+                rain_count = updateAndRenderRain();
+                visibility = views[view];
+            }
+            else {
+                redrawRain(rain_first, rain_count);
+            }
+        }
+        passTimerMark(&pass_timer, PASS_OTHER);
+
+        if (clustered) {
+            clusteredLightingEnd();
+        }
+
+        if (axis_mode == AXIS_ON)
+            ejes();
+    }
+
+    renderer->viewport(area[0], area[1], area[2], area[3]);
+    setCameraMode(viewports[0].camera);
+    visibility = views[0];
+    setProjection();
+}
+
+void display() {
+    auto frame_start = std::chrono::steady_clock::now();
+    passTimerBeginFrame(&pass_timer);
+    if (resolution_mode == SCALED_RESOLUTION) {
+        beginScene(&scene_target);
     }
+	renderer->clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    viewport_t viewports[MAX_VIEWPORTS];
+    int num_viewports = layoutViewports(viewports);
+    if (num_viewports == 1)
+        renderScene();
+    else
+        renderViewports(viewports, num_viewports);
 
-	glutSwapBuffers();
+    // Overlays at the resolution of the window
+    if (resolution_mode == SCALED_RESOLUTION) {
+        endScene(&scene_target);
+    }
+
+    if (hud_mode == HUD_ON) {
+        passTimerMark(&pass_timer, PASS_HUD);
+        if (num_viewports == 1) {
+            showBike();
+        }
+        else { // over the main view
+            GLint window[4], rect[4];
+            renderer->getIntegerv(GL_VIEWPORT, window);
+            viewportRect(&viewports[0], window, rect);
+            renderer->viewport(rect[0], rect[1], rect[2], rect[3]);
+            showBike();
+            renderer->viewport(window[0], window[1], window[2], window[3]);
+        }
+    }
+    passTimerEndFrame(&pass_timer);
+    // The work of the frame without the swap, which waits for the display under
+    // vsync and would make every frame look a whole refresh period long. The GPU
+    // time of the latest frame read back covers work the swap would have waited for
+    double work_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+    if (pass_timer.gpu_frame_ms > work_ms) work_ms = pass_timer.gpu_frame_ms;
+
+	renderer->swapBuffers();
+    int draws = scene_draws + dynamic_geometry.draws;
+    scene_draws = 0;
+    streamEndFrame(&dynamic_geometry);
+    if (!headless) {
+        framePacerPresented(&frame_pacer);
+        inputPresented(&input);
+    }
+    double frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+    recordTelemetry(frame_ms, draws);
+    if (!headless) {
+        updateResolutionScale(&scene_target, work_ms, frame_pacer.period_ms);
+        // The resolution reacts first: while it is between its limits the frame
+        // counts as neither too slow nor calm, so quality only drops once the
+        // resolution cannot, and only rises again at full resolution
+        bool resolution_limited = resolution_mode == SCALED_RESOLUTION && 
+            scene_target.scale < 1 && scene_target.scale > MIN_RESOLUTION_SCALE;
+        double governed_ms = resolution_limited ? frame_pacer.period_ms : work_ms;
+        if (updateQualityGovernor(&quality_governor, governed_ms, frame_pacer.period_ms))
+            applyQualityTier(quality_governor.tier);
+    }
 }
 
 void reshape(GLint w, GLint h) {
-	glViewport(0, 0, w, h);
-	float aspect_ratio = (float)w / h;
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(FOV_Y, aspect_ratio, Z_NEAR, Z_FAR);
+    if (resolution_mode == SCALED_RESOLUTION && !createSceneTarget(&scene_target, w, h)) {
+        resolution_mode = NATIVE_RESOLUTION;
+        std::cout << "Framebuffer objects unavailable, drawing at window resolution" << "\n";
+    }
+	renderer->viewport(0, 0, w, h);
+	aspect_ratio = (float)w / h;
+	setProjection();
 }
 
-void onTimer(int interval) {
-	static int previous = glutGet(GLUT_ELAPSED_TIME);
-	int current = glutGet(GLUT_ELAPSED_TIME);
-	float elapsed = (current - previous) / SECOND_IN_MILLIS;
+void setProjection() {
+	renderer->matrixMode(GL_PROJECTION);
+	renderer->loadIdentity();
+	renderer->perspective(FOV_Y, aspect_ratio, Z_NEAR, quality.z_far);
+}
 
-	float displacement = elapsed * speed;
-	previous = current;
-    
-    float nextX = position[X] + displacement * velocity[X]; 
-    float nextZ = position[Z] + displacement * velocity[Z]; 
+void applyQuality(const quality_tier_t* settings) {
+    int previous_raindrops = quality.num_raindrops;
+    quality = *settings;
+    for (int i = previous_raindrops; i < quality.num_raindrops; i++) {
+        initializeRaindrop(raindrops + i);
+    }
+    setProjection();
+}
 
+void applyQualityTier(int tier) {
+    applyQuality(&QUALITY_TIERS[tier]);
+}
 
-    if (collision_mode == COLLISIONS) {
-        // Only check if inside road (will be used for points)
-        if (insideRoadBorder(nextX, nextZ)) {
+void onTimer(int interval) {
+	static int previous = elapsedMillis();
+	int current = elapsedMillis();
+	float elapsed = (current - previous) / SECOND_IN_MILLIS;
 
-            position[X] += displacement * velocity[X];
-            position[Z] += displacement * velocity[Z];
-        }
-        else {
-            if (speed){
-                if (speed > 2)
-                    speed /= 2;
-                else
-                    speed = 0;
-            }
+	previous = current;
 
-	        displacement = elapsed * speed;
+    float steps[NUM_INPUTS];
+    inputPoll(&input, steps);
+    rideAdvance(&ride_road, elapsed, steps[INPUT_ACCELERATE] - steps[INPUT_BRAKE], steps[INPUT_LEFT] - steps[INPUT_RIGHT],
+                collision_mode == COLLISIONS, &position[X], &position[Z], &origin_z, &speed, &turn_angle, &velocity[X], &velocity[Z]);
 
-            if (position[X] < road_tracing(position[Z])){
-                position[X] += displacement * (road_tracing(position[Z]))/5;
-            }
-            else {
-                position[X] += displacement * -(road_tracing(position[Z]))/5;
-            }
-        }
+    if (!headless) {
+	    glutPostRedisplay();
+	    glutTimerFunc(framePacerDelay(&frame_pacer), onTimer, interval);
     }
-    else {
-        position[X] += displacement * velocity[X];
-        position[Z] += displacement * velocity[Z];
-    }
-
+}
 
-	glutPostRedisplay();
-	glutTimerFunc(interval, onTimer, interval);
+// Arrow keys only change the key states; onTimer() applies them
+static bool arrowInput(int key, input_t* arrow) {
+    switch (key) {
+        case GLUT_KEY_UP:    *arrow = INPUT_ACCELERATE; return true;
+        case GLUT_KEY_DOWN:  *arrow = INPUT_BRAKE;      return true;
+        case GLUT_KEY_LEFT:  *arrow = INPUT_LEFT;       return true;
+        case GLUT_KEY_RIGHT: *arrow = INPUT_RIGHT;      return true;
+    }
+    return false;
 }
 
 void onSpecialKey(int key, int x, int y) {
-	switch (key) {
-        case GLUT_KEY_UP:
-            if (speed + SPEED_INCREMENT <= MAX_SPEED)
-                speed += SPEED_INCREMENT;
-            else
-                speed = MAX_SPEED;
-            break;
-        case GLUT_KEY_DOWN:
-            if (speed >= SPEED_INCREMENT) 
-                speed -= SPEED_INCREMENT;
-            else 
-                speed = 0;
-            break;
-        case GLUT_KEY_LEFT:
-            if (turn_angle + ANGLE_INCREMENT <= MAX_ANGLE)
-                turn_angle += ANGLE_INCREMENT;
-            break;
-        case GLUT_KEY_RIGHT:
-            if (turn_angle - ANGLE_INCREMENT >= -MAX_ANGLE)
-                turn_angle -= ANGLE_INCREMENT;
-            break;
-	}
+    input_t arrow;
+    if (arrowInput(key, &arrow))
+        inputPress(&input, arrow);
+}
+
+void onSpecialKeyUp(int key, int x, int y) {
+    input_t arrow;
+    if (arrowInput(key, &arrow))
+        inputRelease(&input, arrow);
+}
 
-	velocity[X] = sin(turn_angle * M_PI / 180);
-	velocity[Z] = cos(turn_angle * M_PI / 180);
+// Moves the camera to its height in the mode; only the player and third person
+// views light the road with the headlight
+void setCameraMode(camera_mode_t mode) {
+    camera_mode = mode;
+    position[Y] = mode == BIRDS_EYE_VIEW ? BIRDS_EYE_Y : PLAYER_Y;
+    if (mode == BIRDS_EYE_VIEW) {
+        if (renderer->isEnabled(GL_LIGHT1))
+            renderer->disable(GL_LIGHT1);
+    }
+    else if (!renderer->isEnabled(GL_LIGHT1)) {
+        renderer->enable(GL_LIGHT1);
+    }
+}
 
+camera_mode_t nextCameraMode(camera_mode_t mode) {
+    return mode == PLAYER_VIEW ? THIRD_PERSON_VIEW : mode == THIRD_PERSON_VIEW ? BIRDS_EYE_VIEW : PLAYER_VIEW;
 }
 
 void onKey(unsigned char key, int x, int y) {
@@ -1229,10 +2252,10 @@ void onKey(unsigned char key, int x, int y) {
         case 'S':
             draw_mode = (draw_mode == GL_LINE) ? GL_FILL : GL_LINE;
             if (draw_mode == GL_LINE) {
-                glDisable(GL_TEXTURE_2D);
+                renderer->disable(GL_TEXTURE_2D);
             }
             else {
-                glEnable(GL_TEXTURE_2D);
+                renderer->enable(GL_TEXTURE_2D);
             }
 
             break;
@@ -1242,6 +2265,11 @@ void onKey(unsigned char key, int x, int y) {
             hud_mode = (hud_mode == HUD_ON) ? HUD_OFF : HUD_ON;
             break;
 
+        case 't':
+        case 'T':
+            timings_mode = (timings_mode == TIMINGS_ON) ? TIMINGS_OFF : TIMINGS_ON;
+            break;
+
         case 'e':
         case 'E':
             axis_mode = (axis_mode == AXIS_ON) ? AXIS_OFF : AXIS_ON;
@@ -1249,21 +2277,21 @@ void onKey(unsigned char key, int x, int y) {
 
         case 'n':
         case 'N':
-            if (glIsEnabled(GL_FOG)){ 
-                glDisable(GL_FOG);
+            if (renderer->isEnabled(GL_FOG)){ 
+                renderer->disable(GL_FOG);
             }
             else {
-                glEnable(GL_FOG);
+                renderer->enable(GL_FOG);
             }
             break;
 
         case 'l':
         case 'L':
-            if (glIsEnabled(GL_LIGHTING)){
-                glDisable(GL_LIGHTING);
+            if (renderer->isEnabled(GL_LIGHTING)){
+                renderer->disable(GL_LIGHTING);
             }
             else {
-                glEnable(GL_LIGHTING);
+                renderer->enable(GL_LIGHTING);
             }
             break;
 
@@ -1277,6 +2305,36 @@ void onKey(unsigned char key, int x, int y) {
             changeRainVelocity();    
             break;
 
+        case 'k':
+        case 'K':
+            lighting_mode = (lighting_mode == CLUSTERED_LIGHTING) ? FIXED_LIGHTING : CLUSTERED_LIGHTING;
+            break;
+
+        case 'q':
+        case 'Q':
+            // automatic, then every tier from the lowest
+            if (quality_governor.automatic) {
+                qualityGovernorInit(&quality_governor, 0, false);
+            }
+            else if (quality_governor.tier + 1 < NUM_QUALITY_TIERS) {
+                quality_governor.tier++;
+            }
+            else {
+                qualityGovernorInit(&quality_governor, quality_governor.tier, true);
+            }
+            applyQualityTier(quality_governor.tier);
+            break;
+
+        case 'r':
+        case 'R':
+            if (resolution_mode == SCALED_RESOLUTION) {
+                resolution_mode = NATIVE_RESOLUTION;
+            }
+            else if (createSceneTarget(&scene_target, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT))) {
+                resolution_mode = SCALED_RESOLUTION;
+            }
+            break;
+
         case 'w':
         case 'W':
             weather_mode = (weather_mode == RAINFALL) ? CLEAR : RAINFALL;
@@ -1284,26 +2342,13 @@ void onKey(unsigned char key, int x, int y) {
 
         case 'p':
         case 'P':
-            switch (camera_mode) {
-                case PLAYER_VIEW:
-                    camera_mode = THIRD_PERSON_VIEW;
-                    if (!glIsEnabled(GL_LIGHT1))
-                        glEnable(GL_LIGHT1);
-                    break;
-                case THIRD_PERSON_VIEW:
-                    camera_mode = BIRDS_EYE_VIEW;
-                    position[Y] = BIRDS_EYE_Y;
-                    if (glIsEnabled(GL_LIGHT1))
-                        glDisable(GL_LIGHT1);
-                    break; 
-                default:
-                    camera_mode = PLAYER_VIEW;
-                    position[Y] = PLAYER_Y;
-                    if (!glIsEnabled(GL_LIGHT1))
-                        glEnable(GL_LIGHT1);
-                    break;
-            }
+            setCameraMode(nextCameraMode(camera_mode));
+            break;
 
+        case 'v':
+        case 'V':
+            view_layout = view_layout == SINGLE_VIEW ? SPLIT_SCREEN :
+                          view_layout == SPLIT_SCREEN ? PICTURE_IN_PICTURE : SINGLE_VIEW;
             break;
 
         case 27: // esc
@@ -1311,17 +2356,659 @@ void onKey(unsigned char key, int x, int y) {
 	}
 }
 
+/********************************* HEADLESS **********************************/
+int elapsedMillis() {
+    return headless ? headless_time : glutGet(GLUT_ELAPSED_TIME);
+}
+
+// Puts the vehicle back at the start with the rain of a fresh headless run
+void resetRide() {
+    rng.seed(HEADLESS_SEED);
+    createRain();
+    clearWorldChunks();
+    origin_z = 0;
+    position[X] = 0;
+    position[Z] = 0;
+    velocity[X] = 0;
+    velocity[Z] = 1;
+    turn_angle = 0;
+    speed = MAX_SPEED;
+}
+
+// Deterministic ride: fixed time step, full speed along the centre of the road.
+// Returns the time the scene traversal took, in ms.
+double headlessFrame() {
+    int interval = SECOND_IN_MILLIS / FPS;
+    headless_time += interval;
+    position[X] = road_tracing(position[Z]);
+    onTimer(interval);
+
+    auto start = std::chrono::steady_clock::now();
+    display();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void runHeadless(int frames) {
+    rng.seed(HEADLESS_SEED); // fixed rain
+    init();
+    reshape(WINDOW_WIDTH, WINDOW_HEIGHT);
+    speed = MAX_SPEED;
+
+    frame_histogram_t traversal;
+    memset(&traversal, 0, sizeof(traversal));
+    for (int frame = 0; frame < frames; frame++) {
+        frameHistogramAdd(&traversal, headlessFrame());
+    }
+
+    std::cout << "Frames: " << frames << "\n";
+    std::cout << "Distance: " << (long long) roadDistance(absoluteZ(position[Z])) << " m" << "\n";
+    printFrameHistogram(std::cout, "Frame traversal", &traversal);
+    printPassTimes(std::cout, &pass_timer);
+    if (renderer->name == std::string("recording"))
+        std::cout << "Recorded calls: " << recordedCommandCount() << " (" << recordedCommandCount() / frames << " per frame)" << "\n";
+}
+
+// Rides every point of the sweep twice in the rain: once timed with the null
+// backend and once counting the calls, so that counting does not add to the
+// times. Writes the results to the given files, CSV to the standard output if
+// there is none.
+bool runSweep(const sweep_t* sweep, int frames, const char* csv_path, const char* json_path) {
+    quality_tier_t base = quality;
+    for (size_t i = 0; i < sweep->size(); i++) {
+        if (qualitySetting(&base, (*sweep)[i].name.c_str()) == NULL) {
+            std::cerr << "Unknown sweep parameter " << (*sweep)[i].name 
+                      << " (render_distance, quad_density, high_detail_view_distance, raindrops, z_far, tree_rows or streetlamps)" << "\n";
+            return false;
+        }
+    }
+
+    useNullRenderer();
+    init();
+    reshape(WINDOW_WIDTH, WINDOW_HEIGHT);
+    weather_mode = RAINFALL;
+
+    std::vector<sweep_result_t> results;
+    int points = sweepPoints(sweep);
+    for (int point = 0; point < points; point++) {
+        sweep_result_t result;
+        result.values = sweepPoint(sweep, point);
+        quality_tier_t settings = base;
+        for (size_t i = 0; i < sweep->size(); i++) {
+            *qualitySetting(&settings, (*sweep)[i].name.c_str()) = result.values[i];
+        }
+        if (!clampQuality(&settings)) {
+            std::cerr << "Sweep point " << point + 1 << " out of range, clamped" << "\n";
+        }
+        applyQuality(&settings);
+
+        useNullRenderer(true);
+        resetRide();
+        for (int frame = 0; frame < SWEEP_WARMUP_FRAMES + frames; frame++) {
+            double ms = headlessFrame();
+            if (frame >= SWEEP_WARMUP_FRAMES)
+                result.frame_ms.push_back(ms);
+        }
+
+        useCountingRenderer();
+        resetRide();
+        for (int frame = 0; frame < SWEEP_WARMUP_FRAMES; frame++) {
+            headlessFrame();
+        }
+        useCountingRenderer(); // counts from here
+        for (int frame = 0; frame < frames; frame++) {
+            headlessFrame();
+        }
+        result.calls = countedCommands();
+        result.vertices = countedVertices();
+        result.frames = frames;
+        if (!sweepResultDrewVertices(&result)) {
+            std::cerr << "Sweep point " << point + 1 << " drew no vertices" << "\n";
+            return false;
+        }
+        results.push_back(result);
+
+        std::cerr << "Sweep point " << point + 1 << "/" << points << ": p50 " 
+                  << samplePercentile(result.frame_ms, 50) << " ms" << "\n";
+    }
+
+    if (csv_path) {
+        std::ofstream out(csv_path);
+        writeSweepCSV(out, sweep, results);
+        if (!out) { std::cerr << "Cannot write " << csv_path << "\n"; return false; }
+    }
+    if (json_path) {
+        std::ofstream out(json_path);
+        writeSweepJSON(out, sweep, results);
+        if (!out) { std::cerr << "Cannot write " << json_path << "\n"; return false; }
+    }
+    if (!csv_path && !json_path) {
+        writeSweepCSV(std::cout, sweep, results);
+    }
+    return true;
+}
+
+// Full throttle, turning towards the centre of the road
+void autopilot(const ride_observations_t* observations, ride_actions_t* actions, int rides) {
+    for (int i = 0; i < rides; i++) {
+        float target_angle = -4 * observations->offset[i];
+        if (target_angle > 20) target_angle = 20;
+        if (target_angle < -20) target_angle = -20;
+        float steer = (target_angle - observations->turn_angle[i]) / ANGLE_INCREMENT;
+        actions->steer[i] = steer > 4 ? 4 : steer < -4 ? -4 : steer;
+        actions->throttle[i] = observations->speed[i] < MAX_SPEED ? 1 : 0;
+    }
+}
+
+// Steps a batch of rides on the road (RideSimulation.h), spread along it and
+// driven by a simple autopilot, on world_threads workers. Reports how many
+// ride steps per second the simulation takes, leaving the autopilot out.
+void runSimulation(int rides, int steps) {
+    ride_batch_t batch;
+    ride_actions_t actions;
+    ride_observations_t observations;
+    rideBatchInit(&batch, rides, &ride_road, true);
+    for (int i = 0; i < rides; i++)
+        rideBatchReset(&batch, i, (double)i * DISTANCE_BETWEEN_LAMPS);
+    rideActionsInit(&actions, rides);
+    rideObservationsInit(&observations, rides);
+
+    task_pool_t pool;
+    if (world_threads > 0)
+        taskPoolStart(&pool, world_threads);
+
+    double simulation_s = 0;
+    long long off_road = 0;
+    for (int step = 0; step < steps; step++) {
+        autopilot(&observations, &actions, rides);
+
+        auto start = std::chrono::steady_clock::now();
+        rideBatchStep(&batch, &actions, 1 / (float)FPS, &observations, &pool);
+        simulation_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (int i = 0; i < rides; i++)
+            off_road += observations.off_road[i];
+    }
+    int workers = taskPoolThreads(&pool);
+    taskPoolStop(&pool);
+
+    double travelled = 0;
+    for (int i = 0; i < rides; i++)
+        travelled += observations.distance[i] - (double)i * DISTANCE_BETWEEN_LAMPS;
+    double ride_steps = (double)rides * steps;
+    std::cout << "Rides: " << rides << ", steps: " << steps << ", workers: " << workers << "\n";
+    std::cout << "Simulation: " << (long long)(simulation_s > 0 ? ride_steps / simulation_s : 0) << " ride steps per second" << "\n";
+    std::cout << "Mean distance: " << (long long)(travelled / rides) << " m, off road: " 
+              << 100.0 * off_road / ride_steps << "% of steps" << "\n";
+}
+
+// Puts the vehicle where ride is, in the floating origin of the frame
+void placeCamera(const ride_batch_t* batch, int ride) {
+    position[X] = batch->x[ride];
+    position[Z] = (float)(batch->origin[ride] - origin_z) + batch->z[ride];
+    velocity[X] = batch->velocity_x[ride];
+    velocity[Z] = batch->velocity_z[ride];
+    speed = batch->speed[ride];
+    turn_angle = batch->turn_angle[ride];
+}
+
+// Renders a convoy of views rides, driven by the autopilot a few meters apart,
+// into the tiles of one offscreen framebuffer (TiledTarget.h) every frame, each
+// with its own camera mode, and reads them back asynchronously. The first ride
+// leads: the world chunks, the floating origin and the streamed geometry are
+// updated once per frame for all the views, which stay within TUNNEL_LENGTH of
+// it, inside the chunks kept behind the lead. The streetlamps are chosen once
+// for the whole convoy and the chunks walked once per MAX_COLLECTED_VIEWS views,
+// each view then only drawing what its culling kept, as renderViewports() does.
+// No window, HUD, axes or rain. Writes the tiles of the last frame to image_path
+// if given.
+bool runViews(int views, int frames, int tile_width, int tile_height, const char* image_path, bool core_profile) {
+    if (!createOffscreenContext(core_profile)) {
+        std::cerr << "No offscreen OpenGL context (EGL surfaceless platform)" << "\n";
+        return false;
+    }
+    if (core_profile && !useCoreRenderer()) {
+        std::cerr << "OpenGL 3.3 core profile backend unavailable" << "\n";
+        return false;
+    }
+    std::cout << "Renderer: " << renderer->name << " (" << (const char*)glGetString(GL_RENDERER) << ")" << "\n";
+
+    rng.seed(HEADLESS_SEED);
+    init();
+    axis_mode = AXIS_OFF; // GLUT solids, and GLUT is not initialized
+    tiled_target_t target;
+    if (!createTiledTarget(&target, views, tile_width, tile_height)) {
+        std::cerr << "Framebuffer objects unavailable" << "\n";
+        return false;
+    }
+    aspect_ratio = (float)tile_width / tile_height;
+    setProjection();
+
+    ride_batch_t batch;
+    ride_actions_t actions;
+    ride_observations_t observations;
+    float spacing = views > 1 && VIEW_SPACING * (views - 1) >= TUNNEL_LENGTH ? (float)(TUNNEL_LENGTH - 1) / (views - 1) : VIEW_SPACING;
+    rideBatchInit(&batch, views, &ride_road, collision_mode == COLLISIONS);
+    for (int i = 0; i < views; i++)
+        rideBatchReset(&batch, i, (double)(views - 1 - i) * spacing);
+    rideActionsInit(&actions, views);
+    rideObservationsInit(&observations, views);
+
+    std::vector<visibility_t> seen(views);
+    bool clustered = lighting_mode == CLUSTERED_LIGHTING && clusteredLightingSupported();
+    frame_histogram_t render;
+    memset(&render, 0, sizeof(render));
+    std::vector<unsigned char> pixels;
+    long frame_read = -1;
+    int collected = 0, waited = 0;
+    auto run_start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        autopilot(&observations, &actions, views);
+        rideBatchStep(&batch, &actions, 1 / (float)FPS, &observations);
+
+        auto start = std::chrono::steady_clock::now();
+        if (tilesInFlight(&target) == TILE_READBACKS) {
+            collected += readTiles(&target, &pixels, &frame_read, true);
+            waited++;
+        }
+        origin_z = batch.origin[0];
+        passTimerBeginFrame(&pass_timer);
+        beginTiles(&target);
+        float rear_z = 0, front_z = 0;
+        for (int view = 0; view < views; view++) {
+            placeCamera(&batch, view);
+            setCameraMode((camera_mode_t)(view % NUM_CAMERA_MODES));
+            updateVisibility();
+            seen[view] = visibility;
+            if (view == 0 || position[Z] < rear_z) rear_z = position[Z];
+            if (view == 0 || position[Z] > front_z) front_z = position[Z];
+        }
+        placeCamera(&batch, 0);
+        updateWorldChunks();
+        updateStreetlamps(rear_z, front_z);
+        for (int group = 0; group < views; group += MAX_COLLECTED_VIEWS) {
+            int count = views - group < MAX_COLLECTED_VIEWS ? views - group : MAX_COLLECTED_VIEWS;
+            collectChunkDraws(quality.render_distance, &seen[group], count);
+            for (int view = group; view < group + count; view++) {
+                placeCamera(&batch, view);
+                setCameraMode((camera_mode_t)(view % NUM_CAMERA_MODES));
+                useTile(&target, view);
+                visibility = seen[view];
+                placeView();
+                if (clustered) {
+                    setupClusteredLighting();
+                }
+
+                passTimerMark(&pass_timer, PASS_ROAD);
+                drawChunks(view - group);
+                if (!visibility.in_tunnel || visibility.portal_visible) {
+                    passTimerMark(&pass_timer, PASS_SKYLINE);
+                    renderSkyline(quality.render_distance);
+                    passTimerMark(&pass_timer, PASS_GROUND);
+                    renderGround();
+                }
+                passTimerMark(&pass_timer, PASS_OTHER);
+
+                if (clustered) {
+                    clusteredLightingEnd();
+                }
+            }
+        }
+        endTiles(&target);
+        passTimerEndFrame(&pass_timer);
+        streamEndFrame(&dynamic_geometry);
+        frameHistogramAdd(&render, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        while (readTiles(&target, &pixels, &frame_read, false))
+            collected++;
+    }
+    while (tilesInFlight(&target) > 0)
+        collected += readTiles(&target, &pixels, &frame_read, true);
+    double run_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - run_start).count();
+
+    std::cout << "Views: " << views << " of " << tile_width << "x" << tile_height << " in " 
+              << target.columns << "x" << target.rows << " tiles, frames: " << frames << "\n";
+    std::cout << "Distance: " << (long long) roadDistance(observations.distance[0]) << " m" << "\n";
+    printFrameHistogram(std::cout, "Frame rendering", &render);
+    std::cout << "Per view: " << run_ms / frames / views << " ms, " << (long long)(1000.0 * frames * views / run_ms) 
+              << " views per second" << "\n";
+    std::cout << "Readbacks: " << collected << " collected, " << waited << " waited for" << "\n";
+    printPassTimes(std::cout, &pass_timer);
+
+    if (image_path && collected > 0) {
+        FIBITMAP* image = FreeImage_ConvertFromRawBits(pixels.data(), target.width, target.height, target.width * TILE_PIXEL_BYTES,
+                                                       32, 0xFF0000, 0x00FF00, 0x0000FF, false);
+        if (image == NULL || !FreeImage_Save(FIF_PNG, image, image_path, 0)) {
+            std::cerr << "Cannot write " << image_path << "\n";
+            return false;
+        }
+        FreeImage_Unload(image);
+        std::cout << "Frame " << frame_read << " written to " << image_path << "\n";
+    }
+    return true;
+}
+
+// Times the kernels of a frame one at a time (Microbench.h), with the null
+// backend as GL sink: the road function, the border and tunnel tests, a
+// tessellated quad, a lamp support, the rain and the physics step of onTimer.
+// Only the benchmarks whose name contains filter run, all of them without one.
+bool runMicrobenchmarks(const char* filter) {
+    if (!useNullRenderer())
+        return false;
+    rng.seed(HEADLESS_SEED);
+    init();
+    speed = MAX_SPEED;
+
+    std::vector<microbench_t> benches;
+    benches.push_back({ "road_tracing", [](long n) {
+        float sum = 0;
+        for (long i = 0; i < n; i++)
+            sum += road_tracing((float)(i % REBASE_DISTANCE));
+        benchKeep(sum);
+    }});
+    benches.push_back({ "rideInsideRoad", [](long n) {
+        int inside = 0;
+        for (long i = 0; i < n; i++)
+            inside += rideInsideRoad(&ride_road, origin_z, (i % 64) * 0.5f - 6, (float)(i % REBASE_DISTANCE));
+        benchKeep(inside);
+    }});
+    benches.push_back({ "outsideTunnel", [](long n) {
+        int outside = 0;
+        for (long i = 0; i < n; i++)
+            outside += outsideTunnel(i % (4 * (DISTANCE_BETWEEN_TUNNELS + TUNNEL_LENGTH)));
+        benchKeep(outside);
+    }});
+    benches.push_back({ "quadtex 10x10", [](long n) {
+        GLfloat v0[3] = { -1, 0, 0 }, v1[3] = { 1, 0, 0 }, v2[3] = { 1, 0, -2 }, v3[3] = { -1, 0, -2 };
+        for (long i = 0; i < n; i++) {
+            quadtex(v0, v1, v2, v3, 0, 1, 0, 1, 10, 10);
+            benchKeep(v0);
+        }
+    }});
+    benches.push_back({ "buildCylindricalSupport", [](long n) {
+        static mesh_t mesh;
+        GLfloat pos[3] = { 8, 0, 10 };
+        for (long i = 0; i < n; i++) {
+            tessClear(&mesh);
+            buildCylindricalSupport(&mesh, pos, LAMP_CYLINDER_RADIUS, SIGN_HEIGHT, 20);
+            benchKeep(mesh.vertices.data());
+        }
+    }});
+    benches.push_back({ "rain " + std::to_string(quality.num_raindrops) + " drops", [](long n) {
+        for (long i = 0; i < n; i++) {
+            updateAndRenderRain();
+            streamEndFrame(&dynamic_geometry);
+        }
+        benchKeep(raindrops);
+    }});
+    benches.push_back({ "rideAdvance", [](long n) {
+        float x = 0, z = 0, ride_speed = MAX_SPEED, angle = 0, vx = 0, vz = 1;
+        long long origin = 0;
+        for (long i = 0; i < n; i++) {
+            float steer = (i & 15) == 0 ? ((i & 16) ? 1 : -1) : 0; // a key now and then
+            rideAdvance(&ride_road, 1 / (float)FPS, 0, steer, true, &x, &z, &origin, &ride_speed, &angle, &vx, &vz);
+        }
+        benchKeep(x);
+        benchKeep(z);
+    }});
+
+    std::vector<microbench_result_t> results;
+    for (size_t i = 0; i < benches.size(); i++) {
+        if (filter == NULL || benches[i].name.find(filter) != std::string::npos)
+            results.push_back(runMicrobench(&benches[i]));
+    }
+    if (results.empty()) {
+        std::cerr << "No benchmark matches " << filter << "\n";
+        return false;
+    }
+    printMicrobenchResults(std::cout, results);
+    return true;
+}
+
+void printFrameStats() {
+    std::cout << "Frame pacing: " << (frame_pacer.vsync ? "vsync" : "deadlines") 
+              << ", " << frame_pacer.period_ms << " ms period" << "\n";
+    printFrameHistogram(std::cout, "Frame time", &frame_pacer.total);
+    printInputLatency(std::cout, &input);
+    printPassTimes(std::cout, &pass_timer);
+}
+
+// Hands the metrics of the frame to the exporter thread, if there is one
+void recordTelemetry(double frame_ms, int draws) {
+    static uint64_t frame = 0;
+    telemetry_record_t record;
+    record.frame = frame++;
+    if (!telemetry.running)
+        return;
+    record.time_ms = elapsedMillis();
+    record.distance = roadDistance(absoluteZ(position[Z]));
+    record.frame_ms = frame_ms;
+    record.speed = speed;
+    record.resolution_scale = resolution_mode == SCALED_RESOLUTION ? scene_target.scale : 1;
+    record.draws = draws;
+    record.streetlamps = num_streetlamps;
+    record.quality_tier = quality_governor.tier;
+    telemetryPush(&telemetry, &record);
+}
+
+void stopTelemetry() {
+    stopTelemetryExporter(&telemetry);
+}
+
 int main(int argc, char** argv) {
+    // --core:          OpenGL 3.3 core profile backend instead of the fixed function pipeline
+    // --null:          no window, every draw call is discarded
+    // --record <file>: no window, every draw call is written to <file>
+    // --frames <n>:    length of --null and --record runs
+    // --fps <n>:       target frame rate, FPS by default
+    // --vsync:         let the display refresh pace the frames
+    // --scale <s>:     draw the scene at a fixed s times the window resolution
+    // --native:        draw the scene at window resolution, no dynamic scaling
+    // --quality <tier>: low, medium, high or ultra; auto (default) adapts it to the frame time
+    // --layout <l>:    single (default), split (split screen) or pip (picture-in-picture)
+    // --track <file>:  ride the track in <file> instead of the built-in road
+    // --make-track <file> <km>: write a random track <km> kilometers long to <file> and exit
+    // --simulate <rides> <steps>: step <rides> independent rides <steps> times without
+    //                  rendering (on --threads workers) and report the steps per second
+    // --views <k>:     render <k> rides into the tiles of one offscreen framebuffer, each
+    //                  with a camera mode, for --frames frames and report the cost; needs
+    //                  no window or display (EGL), --core for the core profile backend
+    // --view-size <w>x<h>: size of each view, VIEW_WIDTH x VIEW_HEIGHT by default
+    // --views-image <file>: write the tiles of the last frame of --views to a PNG <file>
+    // --microbench [<filter>]: time the hot kernels of a frame in isolation, only those
+    //                  whose name contains <filter> if given, and exit
+    // --compress-textures <image>...: write the block-compressed version of each image
+    //                  next to it (.ctex), which is loaded instead when supported, and exit
+    // --sweep <name>=<v1>,<v2>...: ride every combination of the values of the swept
+    //                  quality settings (repeat for each setting) and report their cost
+    // --csv <file>, --json <file>: where --sweep writes its results
+    // --telemetry-socket <path>: serve live metrics in the Prometheus text format on the
+    //                  Unix socket <path>
+    // --telemetry-file <path>: append the metrics of every frame to the memory mapped <path>
+    // --threads <n>:   workers generating the world, one less than the cores by default;
+    //                  0 generates it on the render thread
+    bool core_profile = false;
+    const char* record_path = NULL;
+    int frames = HEADLESS_FRAMES;
+    int fps = FPS;
+    bool vsync = false, native = false;
+    sweep_t sweep;
+    const char* csv_path = NULL;
+    const char* json_path = NULL;
+    int simulate_rides = 0, simulate_steps = 0;
+    int views = 0, view_width = VIEW_WIDTH, view_height = VIEW_HEIGHT;
+    const char* views_image = NULL;
+    bool microbench = false;
+    const char* microbench_filter = NULL;
+    const char* telemetry_socket = NULL;
+    const char* telemetry_file = NULL;
+    int quality_tier = DEFAULT_QUALITY_TIER;
+    bool automatic_quality = true;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--core") core_profile = true;
+        else if (arg == "--null") headless = true;
+        else if (arg == "--record" && i + 1 < argc) { headless = true; record_path = argv[++i]; }
+        else if (arg == "--frames" && i + 1 < argc) frames = atoi(argv[++i]);
+        else if (arg == "--fps" && i + 1 < argc) fps = atoi(argv[++i]);
+        else if (arg == "--vsync") vsync = true;
+        else if (arg == "--scale" && i + 1 < argc) {
+            resolution_mode = SCALED_RESOLUTION;
+            scene_target.dynamic = false;
+            scene_target.scale = atof(argv[++i]);
+            if (scene_target.scale < MIN_RESOLUTION_SCALE) scene_target.scale = MIN_RESOLUTION_SCALE;
+            if (scene_target.scale > 1) scene_target.scale = 1;
+        }
+        else if (arg == "--native") native = true;
+        else if (arg == "--quality" && i + 1 < argc) {
+            std::string name = argv[++i];
+            automatic_quality = name == "auto";
+            if (!automatic_quality && (quality_tier = qualityTierByName(name.c_str())) < 0) {
+                std::cerr << "Unknown quality " << name << "\n";
+                return 1;
+            }
+            if (automatic_quality) quality_tier = DEFAULT_QUALITY_TIER;
+        }
+        else if (arg == "--sweep" && i + 1 < argc) {
+            sweep_parameter_t parameter;
+            if (!parseSweepParameter(argv[++i], &parameter)) {
+                std::cerr << "Malformed sweep " << argv[i] << ", expected name=value,value..." << "\n";
+                return 1;
+            }
+            sweep.push_back(parameter);
+            headless = true;
+        }
+        else if (arg == "--layout" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "single") view_layout = SINGLE_VIEW;
+            else if (name == "split") view_layout = SPLIT_SCREEN;
+            else if (name == "pip") view_layout = PICTURE_IN_PICTURE;
+            else {
+                std::cerr << "Unknown layout " << name << " (single, split or pip)" << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--csv" && i + 1 < argc) csv_path = argv[++i];
+        else if (arg == "--json" && i + 1 < argc) json_path = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc) world_threads = atoi(argv[++i]);
+        else if (arg == "--telemetry-socket" && i + 1 < argc) telemetry_socket = argv[++i];
+        else if (arg == "--telemetry-file" && i + 1 < argc) telemetry_file = argv[++i];
+        else if (arg == "--track" && i + 1 < argc) {
+            if (!loadTrack(&track, argv[++i]))
+                return 1;
+            ride_road = { &track, (float)track.header->width };
+        }
+        else if (arg == "--make-track" && i + 2 < argc) {
+            const char* path = argv[++i];
+            double km = atof(argv[++i]);
+            return generateTrack(path, km * 1000, HEADLESS_SEED) ? 0 : 1;
+        }
+        else if (arg == "--simulate" && i + 2 < argc) {
+            simulate_rides = atoi(argv[++i]);
+            simulate_steps = atoi(argv[++i]);
+            if (simulate_rides < 1 || simulate_steps < 1) {
+                std::cerr << "--simulate needs at least one ride and one step" << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--views" && i + 1 < argc) {
+            views = atoi(argv[++i]);
+            if (views < 1) {
+                std::cerr << "--views needs at least one view" << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--view-size" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &view_width, &view_height) != 2 || view_width < 1 || view_height < 1) {
+                std::cerr << "Malformed view size " << argv[i] << ", expected <width>x<height>" << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--views-image" && i + 1 < argc) views_image = argv[++i];
+        else if (arg == "--microbench") {
+            microbench = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                microbench_filter = argv[++i];
+        }
+        else if (arg == "--compress-textures") {
+            int failed = 0;
+            for (i++; i < argc; i++) {
+                if (compressTextureFile(argv[i]))
+                    std::cout << argv[i] << " -> " << compressedTexturePath(argv[i]) << "\n";
+                else {
+                    std::cerr << "Cannot compress " << argv[i] << "\n";
+                    failed++;
+                }
+            }
+            return failed ? 1 : 0;
+        }
+    }
+    if (frames < 1) frames = 1;
+    if (fps < 1) fps = FPS;
+    if (native) resolution_mode = NATIVE_RESOLUTION;
+    else if (!headless) resolution_mode = SCALED_RESOLUTION; // headless runs only scale with --scale
+    framePacerInit(&frame_pacer, SECOND_IN_MILLIS / fps, false);
+    inputInit(&input);
+    qualityGovernorInit(&quality_governor, quality_tier, automatic_quality && !headless);
+    quality = QUALITY_TIERS[quality_tier];
+    telemetryInit(&telemetry);
+    if (telemetry_socket || telemetry_file) {
+        if (!startTelemetryExporter(&telemetry, telemetry_socket, telemetry_file)) {
+            std::cerr << "Cannot open the telemetry socket or file" << "\n";
+            return 1;
+        }
+        atexit(stopTelemetry);
+    }
+
+    if (simulate_rides > 0) {
+        runSimulation(simulate_rides, simulate_steps);
+        return 0;
+    }
+    if (microbench) {
+        headless = true;
+        return runMicrobenchmarks(microbench_filter) ? 0 : 1;
+    }
+    if (views > 0) {
+        headless = true;
+        return runViews(views, frames, view_width, view_height, views_image, core_profile) ? 0 : 1;
+    }
+    if (!sweep.empty()) {
+        return runSweep(&sweep, frames, csv_path, json_path) ? 0 : 1;
+    }
+    if (headless) {
+        if (record_path ? !useRecordingRenderer(record_path) : !useNullRenderer())
+            return 1;
+        std::cout << "Renderer: " << renderer->name << "\n";
+        runHeadless(frames);
+        return 0;
+    }
+
 	glutInit(&argc, argv); 
+    if (core_profile) {
+        glutInitContextVersion(3, 3);
+        glutInitContextProfile(GLUT_CORE_PROFILE);
+    }
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 	glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
 	glutCreateWindow(PROJECT_NAME);
+    if (core_profile && !useCoreRenderer()) {
+        std::cerr << "OpenGL 3.3 core profile backend unavailable" << "\n";
+        return 1;
+    }
+    std::cout << "Renderer: " << renderer->name << "\n";
+    if (vsync && !enableVsync()) {
+        std::cerr << "Swap interval control unavailable, pacing with deadlines" << "\n";
+        vsync = false;
+    }
+    framePacerInit(&frame_pacer, SECOND_IN_MILLIS / fps, vsync);
+    atexit(printFrameStats);
 	init(); 
 
 	glutDisplayFunc(display);
 	glutReshapeFunc(reshape);
-	glutTimerFunc(SECOND_IN_MILLIS / FPS, onTimer, SECOND_IN_MILLIS / FPS);
+	glutTimerFunc(0, onTimer, 0);
 	glutSpecialFunc(onSpecialKey);
+	glutSpecialUpFunc(onSpecialKeyUp);
+	glutIgnoreKeyRepeat(1);
 	glutKeyboardFunc(onKey);
 
 	glutMainLoop();